@@ -0,0 +1,320 @@
+// コーデックのマイクロベンチマーク
+// 固定の合成フレームに対して変換と圧縮・展開の各関数を繰り返し実行し、
+// 1フレームあたりの時間 (ns)、1コアあたりのフレーム数/秒、1ビンあたりのサイクル数を表示する
+//
+// 使い方: ./bench_codec [--json] [--isa <name>] [--iterations <n>]
+//                      [--frame-size <n>] [--sample-rate <hz>] [--generic] [--entropy] [--masking]
+//                      [--band-layout <linear|bark|erb>] [--bfp-bits <n>] [--capture-rate <hz>]
+//   --json をつけるとコミット間で比較しやすいJSONを標準出力に書き出す
+//   --generic をつけるとフレームサイズ特殊化カーネルを使わない (特殊化の効果の比較用)
+//   --entropy をつけると圧縮・展開をレンジ符号化ありで測る
+//   --masking をつけると心理音響圧縮をフレームごとのビット割り当てありで測る
+//   --bfp-bits をつけると電話帯域圧縮をブロック浮動小数点 (仮数 n ビット) で測る
+//   --capture-rate は標本化周波数変換を測るときの取り込み・再生のレート (既定 44100 Hz)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "i3_codec.h"
+
+#define REPEATS 5  // 計測の繰り返し回数 (最小値を採用)
+
+// ベンチマーク用の作業領域
+typedef struct {
+    CodecPlan plan;
+    _Alignas(CACHE_LINE) float pcm[MAX_FRAME_SIZE];       // 合成PCM (実数)
+    _Alignas(CACHE_LINE) float time_out[MAX_FRAME_SIZE];  // 逆変換の出力
+    _Alignas(CACHE_LINE) float cplx_re[MAX_FRAME_SIZE];   // 複素FFTの入力
+    _Alignas(CACHE_LINE) float cplx_im[MAX_FRAME_SIZE];
+    _Alignas(CACHE_LINE) float work_re[MAX_FRAME_SIZE];   // 複素FFTの作業領域
+    _Alignas(CACHE_LINE) float work_im[MAX_FRAME_SIZE];
+    _Alignas(CACHE_LINE) float mdct_coefs[MAX_MDCT_HOP];
+    Spectrum spectrum;       // pcm の rfft
+    Spectrum work_spectrum;  // 展開結果・逆変換の作業領域
+    unsigned char psycho_data[PAYLOAD_BUFFER_BYTES];
+    int psycho_size;
+    unsigned char phone_data[PAYLOAD_BUFFER_BYTES];
+    int phone_size;
+    unsigned char mdct_data[PAYLOAD_BUFFER_BYTES];
+    int mdct_size;
+    PlcState plc;                 // パケット損失の補間 (spectrum を覚えた状態)
+    Resampler capture_resampler;  // 取り込みのレート -> コーデックのレート
+    Resampler playout_resampler;  // コーデックのレート -> 再生のレート
+    short codec_pcm[MAX_FRAME_SIZE];            // pcm を16bitにしたもの
+    short capture_pcm[MAX_FRAME_SIZE * 16];     // 取り込みのレートで1フレーム分の合成PCM
+    short resample_out[MAX_FRAME_SIZE * 16 + 1];
+    int capture_samples;
+} BenchContext;
+
+// サイクル/ビンの計算に使うビン数の種類
+typedef enum {
+    BINS_HALF,      // フレームサイズ/2
+    BINS_SPECTRUM,  // フレームサイズ/2+1
+    BINS_PHONE,     // 電話帯域のビン数
+    BINS_FRAME      // フレームサイズ (コーデックのレートでのサンプル数)
+} BenchBins;
+
+typedef struct {
+    const char *name;
+    BenchBins bins;
+    void (*run)(BenchContext *ctx);
+} BenchCase;
+
+// --- 各ケース ---
+
+static void run_fft(BenchContext *ctx) {
+    int half = ctx->plan.frame_size / 2;
+    memcpy(ctx->work_re, ctx->cplx_re, half * sizeof(float));
+    memcpy(ctx->work_im, ctx->cplx_im, half * sizeof(float));
+    fft(&ctx->plan, ctx->work_re, ctx->work_im, half);
+}
+
+static void run_ifft(BenchContext *ctx) {
+    int half = ctx->plan.frame_size / 2;
+    memcpy(ctx->work_re, ctx->cplx_re, half * sizeof(float));
+    memcpy(ctx->work_im, ctx->cplx_im, half * sizeof(float));
+    ifft(&ctx->plan, ctx->work_re, ctx->work_im, half);
+}
+
+static void run_rfft(BenchContext *ctx) {
+    rfft(&ctx->plan, ctx->pcm, &ctx->work_spectrum);
+}
+
+static void run_irfft(BenchContext *ctx) {
+    int bins = ctx->plan.spectrum_bins;
+    memcpy(ctx->work_spectrum.re, ctx->spectrum.re, bins * sizeof(float));
+    memcpy(ctx->work_spectrum.im, ctx->spectrum.im, bins * sizeof(float));
+    irfft(&ctx->plan, &ctx->work_spectrum, ctx->time_out);
+}
+
+static void run_psycho_compress(BenchContext *ctx) {
+    psychoacoustic_compress(&ctx->plan, &ctx->spectrum, ctx->psycho_data, &ctx->psycho_size);
+}
+
+static void run_psycho_decompress(BenchContext *ctx) {
+    psychoacoustic_decompress(&ctx->plan, ctx->psycho_data, &ctx->work_spectrum, ctx->psycho_size);
+}
+
+static void run_phone_compress(BenchContext *ctx) {
+    phone_band_compress(&ctx->plan, &ctx->spectrum, ctx->phone_data, &ctx->phone_size);
+}
+
+static void run_phone_decompress(BenchContext *ctx) {
+    phone_band_decompress(&ctx->plan, ctx->phone_data, &ctx->work_spectrum, ctx->phone_size);
+}
+
+static void run_mdct_forward(BenchContext *ctx) {
+    mdct_forward(&ctx->plan, ctx->pcm, ctx->mdct_coefs);
+}
+
+static void run_mdct_inverse(BenchContext *ctx) {
+    mdct_inverse(&ctx->plan, ctx->mdct_coefs, ctx->time_out);
+}
+
+static void run_mdct_compress(BenchContext *ctx) {
+    mdct_compress(&ctx->plan, ctx->mdct_coefs, ctx->mdct_data, &ctx->mdct_size);
+}
+
+static void run_mdct_decompress(BenchContext *ctx) {
+    mdct_decompress(&ctx->plan, ctx->mdct_data, ctx->mdct_coefs, ctx->mdct_size);
+}
+
+static void run_plc_update(BenchContext *ctx) {
+    plc_update(&ctx->plan, &ctx->plc, &ctx->spectrum);
+}
+
+static void run_plc_conceal(BenchContext *ctx) {
+    plc_conceal(&ctx->plan, &ctx->plc, &ctx->work_spectrum);
+}
+
+// 取り込みのレートで1フレーム分を変換する (コーデックのレートで約 frame_size サンプルになる)
+static void run_resample_capture(BenchContext *ctx) {
+    resampler_process(&ctx->capture_resampler, ctx->capture_pcm, ctx->capture_samples, ctx->resample_out);
+}
+
+static void run_resample_playout(BenchContext *ctx) {
+    resampler_process(&ctx->playout_resampler, ctx->codec_pcm, ctx->plan.frame_size, ctx->resample_out);
+}
+
+static const BenchCase g_cases[] = {
+    {"fft",                       BINS_HALF,     run_fft},
+    {"ifft",                      BINS_HALF,     run_ifft},
+    {"rfft",                      BINS_SPECTRUM, run_rfft},
+    {"irfft",                     BINS_SPECTRUM, run_irfft},
+    {"psychoacoustic_compress",   BINS_HALF,     run_psycho_compress},
+    {"psychoacoustic_decompress", BINS_HALF,     run_psycho_decompress},
+    {"phone_band_compress",       BINS_PHONE,    run_phone_compress},
+    {"phone_band_decompress",     BINS_PHONE,    run_phone_decompress},
+    {"mdct_forward",              BINS_HALF,     run_mdct_forward},
+    {"mdct_inverse",              BINS_HALF,     run_mdct_inverse},
+    {"mdct_compress",             BINS_HALF,     run_mdct_compress},
+    {"mdct_decompress",           BINS_HALF,     run_mdct_decompress},
+    {"plc_update",                BINS_SPECTRUM, run_plc_update},
+    {"plc_conceal",               BINS_SPECTRUM, run_plc_conceal},
+    {"resample_capture",          BINS_FRAME,    run_resample_capture},
+    {"resample_playout",          BINS_FRAME,    run_resample_playout},
+};
+#define NUM_CASES (int)(sizeof(g_cases) / sizeof(g_cases[0]))
+
+// --- 計測 ---
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned long long read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// 固定の合成フレーム (複数の正弦波 + 擬似乱数ノイズ) を作る
+static void make_synthetic_frame(BenchContext *ctx) {
+    const CodecPlan *plan = &ctx->plan;
+    const int N = plan->frame_size;
+    unsigned int seed = 12345;
+    for (int i = 0; i < N; i++) {
+        seed = seed * 1103515245u + 12345u;
+        float noise = (float)((seed >> 16) & 0x7FFF) / 32768.0f - 0.5f;
+        double t = (double)i / plan->sample_rate;
+        ctx->pcm[i] = (float)(6000.0 * sin(2.0 * PI * 220.0 * t)
+                              + 3000.0 * sin(2.0 * PI * 1330.0 * t)
+                              + 1500.0 * sin(2.0 * PI * 2900.0 * t))
+                      + 800.0f * noise;
+        ctx->cplx_re[i] = ctx->pcm[i];
+        ctx->cplx_im[i] = ctx->pcm[(i * 7) % N];
+    }
+    rfft(plan, ctx->pcm, &ctx->spectrum);
+    psychoacoustic_compress(plan, &ctx->spectrum, ctx->psycho_data, &ctx->psycho_size);
+    phone_band_compress(plan, &ctx->spectrum, ctx->phone_data, &ctx->phone_size);
+    mdct_forward(plan, ctx->pcm, ctx->mdct_coefs);
+    mdct_compress(plan, ctx->mdct_coefs, ctx->mdct_data, &ctx->mdct_size);
+    plc_init(&ctx->plc);
+    plc_update(plan, &ctx->plc, &ctx->spectrum);
+
+    // 標本化周波数変換の入力 (同じ信号を取り込みのレートでも作る)
+    for (int i = 0; i < N; i++) ctx->codec_pcm[i] = (short)ctx->pcm[i];
+    const int capture_rate = ctx->capture_resampler.in_rate;
+    ctx->capture_samples = (int)((long)N * capture_rate / plan->sample_rate);
+    for (int i = 0; i < ctx->capture_samples; i++) {
+        double t = (double)i / capture_rate;
+        ctx->capture_pcm[i] = (short)(6000.0 * sin(2.0 * PI * 220.0 * t) + 3000.0 * sin(2.0 * PI * 1330.0 * t));
+    }
+}
+
+int main(int argc, char **argv) {
+    int json = 0;
+    int iterations = 20000;
+    int capture_rate = 44100;
+    CodecOptions opts;
+    codec_default_options(&opts);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+        } else if (strcmp(argv[i], "--isa") == 0 && i + 1 < argc) {
+            opts.isa_name = argv[++i];
+            if (codec_isa_level(opts.isa_name) < 0) return 1;
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--frame-size") == 0 && i + 1 < argc) {
+            opts.frame_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sample-rate") == 0 && i + 1 < argc) {
+            opts.sample_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--generic") == 0) {
+            opts.generic_kernels = 1;
+        } else if (strcmp(argv[i], "--entropy") == 0) {
+            opts.entropy_coding = 1;
+        } else if (strcmp(argv[i], "--masking") == 0) {
+            opts.masking_model = 1;
+        } else if (strcmp(argv[i], "--bfp-bits") == 0 && i + 1 < argc) {
+            opts.bfp_bits = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--capture-rate") == 0 && i + 1 < argc) {
+            capture_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--band-layout") == 0 && i + 1 < argc) {
+            const char *layout = argv[++i];
+            opts.band_layout = (strcmp(layout, "bark") == 0) ? BAND_LAYOUT_BARK
+                             : (strcmp(layout, "erb") == 0) ? BAND_LAYOUT_ERB : BAND_LAYOUT_LINEAR;
+        } else {
+            fprintf(stderr, "Usage: %s [--json] [--isa <scalar|sse2|avx2|avx512>] [--iterations <n>]\n"
+                            "       [--frame-size <n>] [--sample-rate <hz>] [--generic] [--entropy] [--masking]\n"
+                            "       [--band-layout <linear|bark|erb>] [--bfp-bits <n>] [--capture-rate <hz>]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 1) iterations = 1;
+
+    static BenchContext ctx;
+    if (codec_plan_init(&ctx.plan, &opts) < 0) return 1;
+    if (capture_rate < ctx.plan.sample_rate / 16 || capture_rate > ctx.plan.sample_rate * 16) {
+        fprintf(stderr, "Capture rate %d Hz must be within 16 times the codec rate %d Hz\n",
+                capture_rate, ctx.plan.sample_rate);
+        return 1;
+    }
+    if (resampler_init(&ctx.capture_resampler, &ctx.plan, capture_rate, ctx.plan.sample_rate) < 0) return 1;
+    if (resampler_init(&ctx.playout_resampler, &ctx.plan, ctx.plan.sample_rate, capture_rate) < 0) return 1;
+    make_synthetic_frame(&ctx);
+
+    const CodecPlan *plan = &ctx.plan;
+    const char *kernels = plan->specialized ? "specialized" : "generic";
+    if (json) {
+        printf("{\n  \"frame_size\": %d,\n  \"sample_rate\": %d,\n  \"isa\": \"%s\",\n"
+               "  \"kernels\": \"%s\",\n  \"entropy\": %d,\n  \"masking\": %d,\n  \"bfp_bits\": %d,\n  \"iterations\": %d,\n  \"results\": [\n",
+               plan->frame_size, plan->sample_rate, plan->isa_name, kernels, plan->entropy_coding,
+               plan->masking_model, plan->bfp_bits, iterations);
+    } else {
+        printf("frame_size=%d sample_rate=%d isa=%s kernels=%s entropy=%d masking=%d bfp_bits=%d iterations=%d\n",
+               plan->frame_size, plan->sample_rate, plan->isa_name, kernels, plan->entropy_coding,
+               plan->masking_model, plan->bfp_bits, iterations);
+        printf("%-28s %12s %14s %12s\n", "kernel", "ns/frame", "frames/s/core", "cycles/bin");
+    }
+
+    for (int c = 0; c < NUM_CASES; c++) {
+        const BenchCase *bc = &g_cases[c];
+        int bins = (bc->bins == BINS_HALF) ? plan->frame_size / 2
+                 : (bc->bins == BINS_SPECTRUM) ? plan->spectrum_bins
+                 : (bc->bins == BINS_FRAME) ? plan->frame_size
+                 : plan->phone_high_bin - plan->phone_low_bin + 1;
+
+        // ウォームアップ
+        for (int i = 0; i < iterations / 10 + 1; i++) bc->run(&ctx);
+
+        double best_ns = 1e300;
+        double best_cycles = 1e300;
+        for (int r = 0; r < REPEATS; r++) {
+            double t0 = now_ns();
+            unsigned long long c0 = read_cycles();
+            for (int i = 0; i < iterations; i++) bc->run(&ctx);
+            unsigned long long c1 = read_cycles();
+            double t1 = now_ns();
+            if ((t1 - t0) / iterations < best_ns) {
+                best_ns = (t1 - t0) / iterations;
+                best_cycles = (double)(c1 - c0) / iterations;
+            }
+        }
+
+        double frames_per_sec = 1e9 / best_ns;
+        double cycles_per_bin = best_cycles / bins;
+        if (json) {
+            printf("    {\"name\": \"%s\", \"bins\": %d, \"ns_per_frame\": %.1f, "
+                   "\"frames_per_sec\": %.0f, \"cycles_per_bin\": %.2f}%s\n",
+                   bc->name, bins, best_ns, frames_per_sec, cycles_per_bin,
+                   c + 1 < NUM_CASES ? "," : "");
+        } else {
+            printf("%-28s %12.1f %14.0f %12.2f\n", bc->name, best_ns, frames_per_sec, cycles_per_bin);
+        }
+    }
+
+    if (json) printf("  ]\n}\n");
+    return 0;
+}
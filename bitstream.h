@@ -0,0 +1,94 @@
+// 可変ビット長の値を詰めて読み書きするビットストリーム
+// 値は下位ビットから順に詰める (LSB first)。書き込みは 64bit の溜めから 32bit 単位で書き出し、
+// 読み出しは現在位置を含む 8byte をまとめて読んでシフトとマスクだけで取り出す (分岐なし)
+//
+// 読み出し側のバッファはデータの後ろに BITSTREAM_PADDING byte の読み出し可能な領域を持つこと
+// (末尾付近でも 8byte 単位で読むため。余りの領域の内容は結果に影響しない)
+
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define BITSTREAM_PADDING 8   // 読み出しバッファの末尾に必要な余白 (byte)
+#define BITSTREAM_MAX_BITS 25 // 1回で読み書きできる最大ビット数
+
+typedef struct {
+    unsigned char *data;
+    int pos;          // 書き出し済みのバイト数
+    uint64_t acc;     // まだ書き出していないビット
+    int nbits;        // acc 内のビット数
+} BitWriter;
+
+typedef struct {
+    const unsigned char *data;
+    int bit_pos;      // 読み出し位置 (ビット)
+    int bit_len;      // データ長 (ビット)
+} BitReader;
+
+// 8byte をリトルエンディアンとして読む
+static inline uint64_t bitstream_load64(const unsigned char *p) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+
+static inline void bit_writer_init(BitWriter *bw, unsigned char *data) {
+    bw->data = data;
+    bw->pos = 0;
+    bw->acc = 0;
+    bw->nbits = 0;
+}
+
+// value の下位 bits ビットを書く (bits <= BITSTREAM_MAX_BITS、value は bits ビットに収まること)
+static inline void bit_writer_put(BitWriter *bw, unsigned int value, int bits) {
+    bw->acc |= (uint64_t)value << bw->nbits;
+    bw->nbits += bits;
+    if (bw->nbits >= 32) {
+        uint32_t word = (uint32_t)bw->acc;
+        bw->data[bw->pos]     = (unsigned char)word;
+        bw->data[bw->pos + 1] = (unsigned char)(word >> 8);
+        bw->data[bw->pos + 2] = (unsigned char)(word >> 16);
+        bw->data[bw->pos + 3] = (unsigned char)(word >> 24);
+        bw->pos += 4;
+        bw->acc >>= 32;
+        bw->nbits -= 32;
+    }
+}
+
+// 残りのビットを書き出し、全体のバイト数を返す (最後のバイトの余りは 0)
+static inline int bit_writer_finish(BitWriter *bw) {
+    while (bw->nbits > 0) {
+        bw->data[bw->pos++] = (unsigned char)bw->acc;
+        bw->acc >>= 8;
+        bw->nbits -= 8;
+    }
+    bw->nbits = 0;
+    return bw->pos;
+}
+
+static inline void bit_reader_init(BitReader *br, const unsigned char *data, int size) {
+    br->data = data;
+    br->bit_pos = 0;
+    br->bit_len = size * 8;
+}
+
+// 残りのビット数
+static inline int bit_reader_remaining(const BitReader *br) {
+    return br->bit_len - br->bit_pos;
+}
+
+// bits ビット読む (bits <= BITSTREAM_MAX_BITS)
+// 残りを超えて読んだ場合の値は不定なので、呼び出し側で bit_reader_remaining を確認しておくこと
+static inline unsigned int bit_reader_get(BitReader *br, int bits) {
+    uint64_t w = bitstream_load64(br->data + (br->bit_pos >> 3));
+    unsigned int value = (unsigned int)(w >> (br->bit_pos & 7)) & ((1u << bits) - 1);
+    br->bit_pos += bits;
+    return value;
+}
+
+#endif
@@ -0,0 +1,274 @@
+// 1つのプロセスで標準入力・ソケット・標準出力を待つイベントループ (epoll)
+// 送信と受信を別々のプロセスに fork すると、プロセスごとにコーデックの状態を複製し、
+// 通話1つにつき待つだけのプロセスが3つ動く。ここでは記述子をすべて非ブロッキングにして1つの epoll で待ち、
+// 読めた分・書ける分だけを処理する (符号化・復号もその場で行う)
+//   入力: ev_read で EvBuffer に読めるだけ読み、呼び出し側が揃ったフレームから取り出す
+//   出力: ev_write で書けるだけ書き、書けなかった分は EvBuffer に溜めて EPOLLOUT で書き足す
+//   出力が EV_HIGH_WATER byte 以上溜まっている間は、その出力に流し込む入力を待たない (相手に背圧をかける)
+// 通常のファイルは epoll に登録できないので、いつでも読み書きできるものとして扱う
+// 相手が閉じたソケットへの書き込みでプロセスごと止まらないよう、SIGPIPE は無視して EPIPE で知る
+// SIGINT / SIGTERM のハンドラから exit する前には ev_restore_on_exit で記述子のフラグを戻す
+// phone / i1i2i3_phone / i3_phone / i3_phone_fft から使う (ヘッダのみ)
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+
+#define EV_MAX_WATCHES 4              // 待つ記述子の数 (標準入力・ソケット・標準出力)
+#define EV_READ_BYTES 65536           // 1回の ev_read で読む最大
+#define EV_HIGH_WATER (256 * 1024)    // これ以上溜まった出力があれば入力を待たない
+#define EV_AGAIN -2                   // ev_read: まだ何も届いていない
+
+typedef struct {
+    int fd;
+    uint32_t events;     // 待っているイベント (EPOLLIN / EPOLLOUT、0 なら待たない)
+    uint32_t ready;      // 直前の ev_wait で起きたイベント
+    int always_ready;    // 通常のファイル (epoll に登録できない)
+    int saved_flags;     // 元のファイル状態フラグ (ev_free で戻す)
+} EventWatch;
+
+typedef struct {
+    int epfd;
+    int count;
+    EventWatch watches[EV_MAX_WATCHES];
+} EventLoop;
+
+// 入力の溜め置き・書ききれなかった出力
+typedef struct {
+    unsigned char *data;
+    int start, end;      // まだ使っていない範囲
+    int capacity;
+} EvBuffer;
+
+// ev_init から ev_free までの間のループ (シグナルハンドラから記述子のフラグを戻すため)
+static EventLoop *volatile ev_current = NULL;
+
+static inline int ev_init(EventLoop *loop) {
+    memset(loop, 0, sizeof(*loop));
+    signal(SIGPIPE, SIG_IGN);
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    ev_current = loop;
+    return (loop->epfd < 0) ? -1 : 0;
+}
+
+static inline EventWatch *ev_find(EventLoop *loop, int fd) {
+    for (int i = 0; i < loop->count; i++) {
+        if (loop->watches[i].fd == fd) return &loop->watches[i];
+    }
+    return NULL;
+}
+
+// fd を非ブロッキングにして登録する (events は最初に待つイベント)
+// 登録できなければフラグを元に戻して -1
+static inline int ev_add(EventLoop *loop, int fd, uint32_t events) {
+    if (loop->count == EV_MAX_WATCHES) return -1;
+    EventWatch *w = &loop->watches[loop->count];
+    memset(w, 0, sizeof(*w));
+    w->fd = fd;
+    w->events = events;
+    w->saved_flags = fcntl(fd, F_GETFL);
+    if (w->saved_flags < 0) return -1;
+    loop->count++;  // 非ブロッキングにする前に数えて、シグナルハンドラからも戻せるようにする
+    struct epoll_event e = {events, {.u32 = (uint32_t)(loop->count - 1)}};
+    if (fcntl(fd, F_SETFL, w->saved_flags | O_NONBLOCK) < 0) {
+        loop->count--;
+        return -1;
+    }
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &e) < 0) {
+        if (errno != EPERM) {
+            fcntl(fd, F_SETFL, w->saved_flags);
+            loop->count--;
+            return -1;
+        }
+        w->always_ready = 1;
+    } else if (!events) {
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, &e);
+    }
+    return 0;
+}
+
+// 待つイベントを変える
+// 何も待たない記述子は epoll から外す (登録したままだとエラーや切断を知らせ続けて ev_wait が空回りする)
+static inline void ev_set_events(EventLoop *loop, int fd, uint32_t events) {
+    EventWatch *w = ev_find(loop, fd);
+    if (!w || w->events == events) return;
+    if (!w->always_ready) {
+        struct epoll_event e = {events, {.u32 = (uint32_t)(w - loop->watches)}};
+        int op = !events ? EPOLL_CTL_DEL : !w->events ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        epoll_ctl(loop->epfd, op, fd, &e);
+    }
+    w->events = events;
+}
+
+// 直前の ev_wait で fd に起きたイベント (エラーや切断は読み書きできるものとして返す)
+static inline uint32_t ev_ready(EventLoop *loop, int fd) {
+    EventWatch *w = ev_find(loop, fd);
+    if (!w) return 0;
+    return (w->ready & (EPOLLERR | EPOLLHUP)) ? (w->events & (EPOLLIN | EPOLLOUT)) : w->ready;
+}
+
+// 何かの記述子が読み書きできるか timeout_ms が過ぎるまで待つ (-1 なら無期限)
+static inline int ev_wait(EventLoop *loop, int timeout_ms) {
+    struct epoll_event events[EV_MAX_WATCHES];
+    for (int i = 0; i < loop->count; i++) {
+        EventWatch *w = &loop->watches[i];
+        w->ready = 0;
+        if (w->always_ready && w->events) timeout_ms = 0;
+    }
+    int n = epoll_wait(loop->epfd, events, EV_MAX_WATCHES, timeout_ms);
+    if (n < 0) return (errno == EINTR) ? 0 : -1;
+    for (int i = 0; i < n; i++) loop->watches[events[i].data.u32].ready = events[i].events;
+    for (int i = 0; i < loop->count; i++) {
+        EventWatch *w = &loop->watches[i];
+        if (w->always_ready) w->ready = w->events;
+    }
+    return n;
+}
+
+// 記述子のフラグを元に戻す (端末やパイプの相手を非ブロッキングのまま残さない)
+// 標準入力と標準出力が同じ端末やソケットなら後から登録した方は非ブロッキングにした後のフラグを覚えているので、
+// 登録の逆順に戻して最初に覚えたフラグを最後に書く
+static inline void ev_restore_flags(EventLoop *loop) {
+    for (int i = loop->count - 1; i >= 0; i--) fcntl(loop->watches[i].fd, F_SETFL, loop->watches[i].saved_flags);
+}
+
+static inline void ev_free(EventLoop *loop) {
+    ev_restore_flags(loop);
+    if (loop->epfd >= 0) close(loop->epfd);
+    loop->count = 0;
+    if (ev_current == loop) ev_current = NULL;
+}
+
+// シグナルハンドラで exit する前に呼ぶ (動いているループがあれば記述子のフラグを戻す。fcntl だけなので安全)
+static inline void ev_restore_on_exit(void) {
+    EventLoop *loop = ev_current;
+    if (loop) ev_restore_flags(loop);
+}
+
+// --- 溜め置き ---
+
+static inline int ev_buffer_init(EvBuffer *b, int capacity) {
+    memset(b, 0, sizeof(*b));
+    b->capacity = capacity;
+    b->data = (unsigned char *)malloc(capacity);
+    return b->data ? 0 : -1;
+}
+
+static inline void ev_buffer_free(EvBuffer *b) {
+    free(b->data);
+    b->data = NULL;
+}
+
+static inline int ev_buffered(const EvBuffer *b) {
+    return b->end - b->start;
+}
+
+static inline unsigned char *ev_peek(const EvBuffer *b) {
+    return b->data + b->start;
+}
+
+// 先頭の n byte を使い終えた
+static inline void ev_consume(EvBuffer *b, int n) {
+    b->start += n;
+    if (b->start == b->end) b->start = b->end = 0;
+}
+
+// 末尾に n byte の空きを作る (前に寄せ、足りなければ広げる)
+static inline int ev_reserve(EvBuffer *b, int n) {
+    if (b->capacity - b->end >= n) return 0;
+    if (b->start > 0) {
+        memmove(b->data, b->data + b->start, b->end - b->start);
+        b->end -= b->start;
+        b->start = 0;
+    }
+    if (b->capacity - b->end >= n) return 0;
+    int capacity = b->capacity;
+    while (capacity - b->end < n) capacity *= 2;
+    unsigned char *data = (unsigned char *)realloc(b->data, capacity);
+    if (!data) return -1;
+    b->data = data;
+    b->capacity = capacity;
+    return 0;
+}
+
+static inline int ev_append(EvBuffer *b, const void *p, int n) {
+    if (ev_reserve(b, n) < 0) return -1;
+    memcpy(b->data + b->end, p, n);
+    b->end += n;
+    return 0;
+}
+
+// fd から読めるだけ読んで後ろに足す (読んだ byte 数、0 = 入力の終わり、EV_AGAIN = まだ無い、-1 = エラー)
+static inline int ev_read(EvBuffer *b, int fd) {
+    if (ev_reserve(b, EV_READ_BYTES) < 0) return -1;
+    while (1) {
+        ssize_t r = read(fd, b->data + b->end, EV_READ_BYTES);
+        if (r > 0) b->end += (int)r;
+        if (r >= 0) return (int)r;
+        if (errno == EINTR) continue;
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? EV_AGAIN : -1;
+    }
+}
+
+// 溜めた出力を書けるだけ書く (-1 = エラー)
+static inline int ev_flush(EvBuffer *b, int fd) {
+    while (ev_buffered(b) > 0) {
+        ssize_t w = write(fd, ev_peek(b), ev_buffered(b));
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (w <= 0) return -1;
+        ev_consume(b, (int)w);
+    }
+    return 0;
+}
+
+// fd へ書く。前に書ききれなかった分が無ければ書けるだけ書き、残りは溜めて EPOLLOUT で書き足す (-1 = エラー)
+static inline int ev_write(EvBuffer *b, int fd, const void *p, int n) {
+    if (ev_buffered(b) == 0) {
+        while (n > 0) {
+            ssize_t w = write(fd, p, n);
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (w <= 0) return -1;
+            p = (const char *)p + w;
+            n -= (int)w;
+        }
+    }
+    return (n > 0) ? ev_append(b, p, n) : 0;
+}
+
+// ev_write の writev 版 (見出しとペイロードを1回で書く)
+static inline int ev_writev(EvBuffer *b, int fd, struct iovec *iov, int count) {
+    if (ev_buffered(b) == 0) {
+        while (count > 0) {
+            ssize_t w = writev(fd, iov, count);
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (w <= 0) return -1;
+            while (count > 0 && (size_t)w >= iov->iov_len) {
+                w -= iov->iov_len;
+                iov++;
+                count--;
+            }
+            if (count > 0) {
+                iov->iov_base = (char *)iov->iov_base + w;
+                iov->iov_len -= w;
+            }
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (ev_append(b, iov[i].iov_base, (int)iov[i].iov_len) < 0) return -1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,190 @@
+// 前方誤り訂正 (--fec K): K フレームごとに XOR のパリティを1つ送り、グループ内の1フレームの欠落を再送なしで復元する
+// 送信量は約 1/K 増える (パリティはグループで最も長いフレームの長さ + 見出し)
+//
+// フレームには番号 (タイムスタンプ / 1フレームのサンプル数) を付け、番号 / K が同じフレームを1グループとする
+// パリティの中身
+//   [K (1byte)] [グループの先頭フレームの番号 (4byte)]
+//   [種類の XOR (1byte)] [長さの XOR (2byte)] [中身の XOR (グループで最も長いフレームの長さ、短いものは0で埋める)]
+// 受信側はグループごとに届いたフレームとパリティの XOR を重ねていき、K-1 フレームとパリティが揃えば
+// 残りの1フレームの種類・長さ・中身がそのまま現れる (フレームの写しは持たない)
+// 種類は呼び出し側が決める (i3_phone_fft では無音フレームか)
+// i3_phone_fft から使う (ヘッダのみ)
+
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FEC_MAX_K 16                // グループのフレーム数の上限
+#define FEC_GROUPS 4                // 受信側で同時に復元を待つグループ数
+#define FEC_HEADER_BYTES 3          // 種類 (1byte) + 長さ (2byte) の XOR
+#define FEC_PARITY_HEADER_BYTES 5   // K (1byte) + 先頭フレームの番号 (4byte)
+
+// 送信側
+typedef struct {
+    int k;
+    uint32_t group;          // 今のグループの番号
+    int count;               // 今のグループに加えたフレーム数
+    int max_len;             // 今のグループで最も長いフレームの長さ
+    unsigned char *parity;   // FEC_PARITY_HEADER_BYTES + FEC_HEADER_BYTES + max_payload
+} FecEncoder;
+
+// 受信側のグループ
+typedef struct {
+    int used;
+    uint32_t group;
+    uint32_t received;       // 届いたフレームのビットマスク
+    int count;               // 届いたフレーム数
+    int have_parity;
+    int done;                // 復元済み (または復元の必要がない)
+    int max_len;             // パリティの中身の長さ
+    unsigned char *acc;      // FEC_HEADER_BYTES + max_payload (パリティと届いたフレームの XOR)
+} FecGroup;
+
+typedef struct {
+    int k, max_payload;
+    FecGroup groups[FEC_GROUPS];
+    unsigned char *pool;
+} FecDecoder;
+
+// 復元したフレーム (data は次に fec_decoder_* を呼ぶまで有効)
+// 追い越されただけのフレームも、パリティが先に届けば復元される (後から届いた方は重複になる)
+typedef struct {
+    uint32_t frame;
+    int type;
+    int len;
+    unsigned char *data;
+} FecFrame;
+
+static inline void fec_xor_header(unsigned char *acc, int type, int len) {
+    acc[0] ^= (unsigned char)type;
+    acc[1] ^= (unsigned char)(len >> 8);
+    acc[2] ^= (unsigned char)len;
+}
+
+static inline void fec_xor(unsigned char *acc, const unsigned char *data, int len) {
+    for (int i = 0; i < len; i++) acc[i] ^= data[i];
+}
+
+// --- 送信側 ---
+
+static inline int fec_encoder_init(FecEncoder *enc, int k, int max_payload) {
+    memset(enc, 0, sizeof(*enc));
+    enc->k = k;
+    enc->parity = (unsigned char *)calloc(FEC_PARITY_HEADER_BYTES + FEC_HEADER_BYTES + max_payload, 1);
+    return enc->parity ? 0 : -1;
+}
+
+static inline void fec_encoder_free(FecEncoder *enc) {
+    free(enc->parity);
+    enc->parity = NULL;
+}
+
+// 送ったフレームを加える。グループが揃えばパリティを out に書いてその長さを返す (揃わなければ 0)
+static inline int fec_encoder_add(FecEncoder *enc, uint32_t frame, int type, const unsigned char *data, int len,
+                                  unsigned char *out) {
+    unsigned char *acc = enc->parity + FEC_PARITY_HEADER_BYTES;
+    uint32_t group = frame / enc->k;
+    if (enc->count == 0 || group != enc->group) {
+        memset(acc, 0, FEC_HEADER_BYTES + enc->max_len);
+        enc->group = group;
+        enc->count = 0;
+        enc->max_len = 0;
+    }
+    fec_xor_header(acc, type, len);
+    fec_xor(acc + FEC_HEADER_BYTES, data, len);
+    if (len > enc->max_len) enc->max_len = len;
+    if (++enc->count < enc->k) return 0;
+
+    uint32_t first = group * enc->k;
+    enc->parity[0] = (unsigned char)enc->k;
+    enc->parity[1] = (unsigned char)(first >> 24);
+    enc->parity[2] = (unsigned char)(first >> 16);
+    enc->parity[3] = (unsigned char)(first >> 8);
+    enc->parity[4] = (unsigned char)first;
+    int bytes = FEC_PARITY_HEADER_BYTES + FEC_HEADER_BYTES + enc->max_len;
+    memcpy(out, enc->parity, bytes);
+    enc->count = 0;
+    return bytes;
+}
+
+// --- 受信側 ---
+
+static inline int fec_decoder_init(FecDecoder *dec, int k, int max_payload) {
+    memset(dec, 0, sizeof(*dec));
+    dec->k = k;
+    dec->max_payload = max_payload;
+    dec->pool = (unsigned char *)malloc((size_t)FEC_GROUPS * (FEC_HEADER_BYTES + max_payload));
+    if (!dec->pool) return -1;
+    for (int i = 0; i < FEC_GROUPS; i++) dec->groups[i].acc = dec->pool + (size_t)i * (FEC_HEADER_BYTES + max_payload);
+    return 0;
+}
+
+static inline void fec_decoder_free(FecDecoder *dec) {
+    free(dec->pool);
+    dec->pool = NULL;
+}
+
+// グループ番号の置き場所を返す (古いグループの置き場所なら新しいグループ用に空ける。もう捨てたグループなら NULL)
+static inline FecGroup *fec_decoder_group(FecDecoder *dec, uint32_t group) {
+    FecGroup *g = &dec->groups[group % FEC_GROUPS];
+    if (g->used && g->group == group) return g;
+    if (g->used && (int32_t)(group - g->group) < 0) return NULL;
+    memset(g->acc, 0, FEC_HEADER_BYTES + dec->max_payload);
+    g->used = 1;
+    g->group = group;
+    g->received = 0;
+    g->count = 0;
+    g->have_parity = 0;
+    g->done = 0;
+    g->max_len = 0;
+    return g;
+}
+
+// K-1 フレームとパリティが揃っていれば残りの1フレームを out に返す
+static inline int fec_decoder_recover(FecDecoder *dec, FecGroup *g, FecFrame *out) {
+    if (g->done || !g->have_parity || g->count != dec->k - 1) return 0;
+    g->done = 1;
+    int missing = 0;
+    while (g->received & (1u << missing)) missing++;
+    int len = (g->acc[1] << 8) | g->acc[2];
+    if (len > g->max_len) return 0;  // 壊れたパリティ
+    out->frame = g->group * dec->k + missing;
+    out->type = g->acc[0];
+    out->len = len;
+    out->data = g->acc + FEC_HEADER_BYTES;
+    return 1;
+}
+
+// 届いたフレームを加える。これで欠落したフレームを復元できれば 1 を返して out に入れる
+static inline int fec_decoder_add_frame(FecDecoder *dec, uint32_t frame, int type, const unsigned char *data, int len,
+                                        FecFrame *out) {
+    FecGroup *g = fec_decoder_group(dec, frame / dec->k);
+    uint32_t bit = 1u << (frame % dec->k);
+    if (!g || (g->received & bit) || len > dec->max_payload) return 0;
+    g->received |= bit;
+    g->count++;
+    if (g->count == dec->k) g->done = 1;
+    if (g->done) return 0;
+    fec_xor_header(g->acc, type, len);
+    fec_xor(g->acc + FEC_HEADER_BYTES, data, len);
+    return fec_decoder_recover(dec, g, out);
+}
+
+// 届いたパリティを加える。これで欠落したフレームを復元できれば 1 を返して out に入れる
+static inline int fec_decoder_add_parity(FecDecoder *dec, const unsigned char *parity, int len, FecFrame *out) {
+    int bytes = len - FEC_PARITY_HEADER_BYTES - FEC_HEADER_BYTES;
+    if (bytes < 0 || bytes > dec->max_payload || parity[0] != dec->k) return 0;
+    uint32_t first = ((uint32_t)parity[1] << 24) | ((uint32_t)parity[2] << 16) |
+                     ((uint32_t)parity[3] << 8) | parity[4];
+    FecGroup *g = fec_decoder_group(dec, first / dec->k);
+    if (!g || g->have_parity || g->done) return 0;
+    g->have_parity = 1;
+    g->max_len = bytes;
+    fec_xor(g->acc, parity + FEC_PARITY_HEADER_BYTES, FEC_HEADER_BYTES + bytes);
+    return fec_decoder_recover(dec, g, out);
+}
+
+#endif
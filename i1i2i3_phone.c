@@ -1,57 +1,75 @@
 // インターネット電話プログラム（パイプライン対応版）
 // サーバー: rec ... | ./i1i2i3_phone 50000 | play ...
 // クライアント: rec ... | ./i1i2i3_phone <ip> 50000 | play ...
+// --dtx を付けると無音区間は雑音記述子だけを送り、受信側で快適雑音を合成する (16bit モノラル PCM、両端で指定)
+// --udp を付けると TCP の代わりに UDP で1フレームずつ RTP 形式のパケットにして送る (両端で指定)
+// --jitter-buffer を付けると受信したパケットをジッタバッファで並べ直し、--sample-rate の間隔で再生する (--udp のみ)
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
-#include <sys/wait.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
 
-#define BUFFER_SIZE 1024
+#include "vad.h"
+#include "rtp.h"
+#include "pcm_call.h"
+
+#define PCM_SAMPLE_RATE 44100  // --sample-rate の既定値 (rec / play の -r と合わせる)
 
 int socket_fd = -1;
 int server_socket = -1;
-pid_t sender_pid = -1;
-pid_t receiver_pid = -1;
+int g_dtx = 0;  // --dtx が指定されたか
+int g_udp = 0;  // --udp が指定されたか
+int g_jitter_buffer = 0;  // --jitter-buffer が指定されたか
+int g_sample_rate = PCM_SAMPLE_RATE;  // ジッタバッファの再生のサンプリングレート
 
 // クリーンアップ
 void cleanup() {
-    if (sender_pid > 0) kill(sender_pid, SIGTERM);
-    if (receiver_pid > 0) kill(receiver_pid, SIGTERM);
     if (socket_fd >= 0) close(socket_fd);
     if (server_socket >= 0) close(server_socket);
 }
 
 void signal_handler(int sig) {
+    ev_restore_on_exit();  // 標準入出力を非ブロッキングのまま残さない
     cleanup();
     exit(0);
 }
 
-// 送信プロセス: 標準入力 → ソケット
-void audio_sender(int sock_fd) {
-    unsigned char buffer[BUFFER_SIZE];
-    ssize_t bytes_read;
-    
-    while ((bytes_read = read(STDIN_FILENO, buffer, BUFFER_SIZE)) > 0) {
-        write(sock_fd, buffer, bytes_read);
+// 通話: 標準入力 → ソケット と ソケット → 標準出力 を1つのプロセスで同時に回す (pcm_call.h)
+int run_call(int sock_fd) {
+    EventLoop loop;
+    PcmCallResult res;
+    JitterBuffer jb;
+    if (g_jitter_buffer && jb_init(&jb, DTX_FRAME_SAMPLES, g_sample_rate, DTX_FRAME_SAMPLES * sizeof(short)) < 0) {
+        perror("jitter buffer");
+        return 1;
+    }
+    if (pcm_call_run(&loop, sock_fd, g_dtx, g_udp, g_jitter_buffer ? &jb : NULL, &res) < 0) {
+        perror("event loop");
+        return 1;
     }
-    exit(0);
-}
 
-// 受信プロセス: ソケット → 標準出力
-void audio_receiver(int sock_fd) {
-    unsigned char buffer[BUFFER_SIZE];
-    ssize_t bytes_read;
-    
-    while ((bytes_read = read(sock_fd, buffer, BUFFER_SIZE)) > 0) {
-        write(STDOUT_FILENO, buffer, bytes_read);
+    if (res.errors & PCM_CALL_INPUT_ERROR) fprintf(stderr, "Send stopped: error reading stdin\n");
+    if (res.errors & PCM_CALL_SEND_ERROR) fprintf(stderr, "Send stopped: peer closed the connection\n");
+    if (res.errors & PCM_CALL_RECEIVE_ERROR) fprintf(stderr, "Receive stopped: socket error\n");
+    if (res.errors & PCM_CALL_OUTPUT_ERROR) fprintf(stderr, "Receive stopped: error writing stdout\n");
+    if (g_dtx || g_udp) fprintf(stderr, "DTX: %ld of %ld frames sent as silence\n", res.silent_frames, res.frames);
+    if (g_udp) {
+        fprintf(stderr, "UDP: received %ld packets, %ld lost, %ld late\n",
+                res.stats.received, res.stats.lost, res.stats.late);
     }
-    exit(0);
+    if (g_jitter_buffer) {
+        fprintf(stderr, "Jitter buffer: delay %.0f ms (target %.0f ms, jitter %.1f ms), "
+                "%ld concealed, %ld too late, %ld stretched, %ld skipped\n",
+                jb_delay_ms(&jb), jb_target_ms(&jb), jb_jitter_ms(&jb),
+                jb.concealed, jb.late, jb.stretched, jb.skipped);
+        jb_free(&jb);
+    }
+    return 0;
 }
 
 int run_server(int port) {
@@ -103,32 +121,46 @@ int main(int argc, char **argv) {
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
-    if (argc == 2) {
-        int port = atoi(argv[1]);
-        run_server(port);
-    }else if (argc == 3) {
-        const char *ip_str = argv[1];
-        int port = atoi(argv[2]);
-        run_client(ip_str, port);
-    }else {
-        fprintf(stderr, "Usage:\n");
-        fprintf(stderr, "  Server: %s <port>\n", argv[0]);
-        fprintf(stderr, "  Client: %s <ip> <port>\n", argv[0]);
+    int arg_start = 1;
+    while (arg_start < argc && strncmp(argv[arg_start], "--", 2) == 0) {
+        if (strcmp(argv[arg_start], "--dtx") == 0) g_dtx = 1;
+        else if (strcmp(argv[arg_start], "--udp") == 0) g_udp = 1;
+        else if (strcmp(argv[arg_start], "--jitter-buffer") == 0) g_jitter_buffer = 1;
+        else if (strcmp(argv[arg_start], "--sample-rate") == 0 && arg_start + 1 < argc) g_sample_rate = atoi(argv[++arg_start]);
+        else break;
+        arg_start++;
+    }
+    if (g_jitter_buffer && (!g_udp || g_sample_rate <= 0)) {
+        fprintf(stderr, "--jitter-buffer needs --udp and a positive --sample-rate\n");
         return 1;
     }
 
-    sender_pid = fork();
-    if (sender_pid == 0) {
-        audio_sender(socket_fd);
+    if (argc - arg_start == 1) {
+        int port = atoi(argv[arg_start]);
+        if (g_udp) socket_fd = rtp_udp_server(port);
+        else run_server(port);
+    }else if (argc - arg_start == 2) {
+        const char *ip_str = argv[arg_start];
+        int port = atoi(argv[arg_start + 1]);
+        if (g_udp) socket_fd = rtp_udp_client(ip_str, port);
+        else run_client(ip_str, port);
+    }else {
+        fprintf(stderr, "Usage:\n");
+        fprintf(stderr, "  Server: %s [options] <port>\n", argv[0]);
+        fprintf(stderr, "  Client: %s [options] <ip> <port>\n", argv[0]);
+        fprintf(stderr, "  --dtx  Send comfort-noise descriptors instead of silent frames (16-bit mono PCM)\n");
+        fprintf(stderr, "  --udp  Send one RTP packet per frame over UDP instead of a TCP stream\n");
+        fprintf(stderr, "  --jitter-buffer  Reorder received packets and play them out on a jitter-adaptive delay (with --udp)\n");
+        fprintf(stderr, "  --sample-rate <hz>  Playout rate of the jitter buffer (default: %d)\n", PCM_SAMPLE_RATE);
+        return 1;
     }
-
-    receiver_pid = fork();
-    if (receiver_pid == 0) {
-        audio_receiver(socket_fd);
+    if (socket_fd < 0) {
+        perror("UDP socket");
+        return 1;
     }
 
-    wait(NULL);
+    int status = run_call(socket_fd);
     cleanup();
 
-    return 0;
+    return status;
 }
\ No newline at end of file
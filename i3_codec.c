@@ -0,0 +1,2484 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "i3_codec.h"
+
+// --- 電話帯域制限機能 ---
+
+// 電話帯域のビン番号を計算
+static void init_phone_band_bins(CodecPlan *plan) {
+    plan->phone_low_bin = (int)((float)plan->phone_low_hz * plan->frame_size / plan->sample_rate);
+    plan->phone_high_bin = (int)((float)plan->phone_high_hz * plan->frame_size / plan->sample_rate);
+    
+    // 範囲チェック
+    if (plan->phone_low_bin < 0) plan->phone_low_bin = 0;
+    if (plan->phone_high_bin >= plan->frame_size/2) plan->phone_high_bin = plan->frame_size/2 - 1;
+}
+
+// 電話帯域制限を適用
+void apply_phone_band_filter(const CodecPlan *plan, Spectrum *fft_data) {
+    // 低周波成分を0にする
+    for (int i = 0; i < plan->phone_low_bin; i++) {
+        fft_data->re[i] = 0.0f;
+        fft_data->im[i] = 0.0f;
+    }
+    
+    // 高周波成分を0にする
+    for (int i = plan->phone_high_bin + 1; i < plan->spectrum_bins; i++) {
+        fft_data->re[i] = 0.0f;
+        fft_data->im[i] = 0.0f;
+    }
+}
+
+// --- 電話帯域のブロック浮動小数点 ---
+// 電話帯域を BFP_BLOCK_BINS ビンずつのブロックに分け、ブロックごとに
+//   指数 e (int8, ブロック内の最大振幅 < 2^e) 1byte
+//   実部の仮数 16個、虚部の仮数 16個 (bits ビットの符号付き整数、値 = 仮数 * 2^(e - (bits-1)))
+// を並べる。仮数は下位 8bit を 1byte ずつ並べた列と、残りの上位 (bits-8) bit を詰めた列に分けて置く
+// (ビット単位の詰め込みをせずに済み、詰める・取り出すループがそのままベクトル化される)
+// 全ビンが 0 のブロックは指数 BFP_SILENT_EXP だけを送る。最後のブロックの余りのビンは 0 として送る
+
+#define BFP_SILENT_EXP (-128)   // 全ビンが 0 のブロック (仮数を送らない)
+#define BFP_MIN_EXP (-100)      // これより小さいブロックは 0 とみなす (スケールの桁あふれ防止)
+#define BFP_MAX_EXP 127
+
+// 2^k (BFP_MIN_EXP - 16 <= k <= BFP_MAX_EXP の範囲で、指数部を直接組み立てる)
+static inline float bfp_pow2(int k) {
+    uint32_t b = (uint32_t)(k + 127) << 23;
+    float f;
+    memcpy(&f, &b, sizeof(f));
+    return f;
+}
+
+// bits ビットの仮数の上位ビットを詰めたバイト数 (ブロックの片側分)
+static inline int bfp_high_bytes(int bits) {
+    return (bits - 8) * BFP_BLOCK_BINS / 8;
+}
+
+// 仮数を詰める。上位ビットは 8/h 個を1byteにまとめ、j 番目のバイトに
+// 仮数 j, j + nbytes, j + 2*nbytes, ... を入れる (連続した読み出しで済む並び)
+// bits は定数で呼ぶこと (インライン展開後に定数になってループが固定長になり、ベクトル化される)
+// シフトは 16bit 幅で行う (SSE2 には 8bit 単位のシフトが無く、バイトのままだとベクトル化されない)
+__attribute__((always_inline))
+static inline unsigned char *bfp_pack(const int16_t *q, unsigned char *restrict out, int bits) {
+    const int h = bits - 8;
+    for (int k = 0; k < BFP_BLOCK_BINS; k++) out[k] = (unsigned char)q[k];
+    out += BFP_BLOCK_BINS;
+    if (h == 0) return out;
+
+    const int per_byte = 8 / h;
+    const int nbytes = BFP_BLOCK_BINS / per_byte;
+    for (int j = 0; j < nbytes; j++) out[j] = 0;
+#pragma GCC unroll 8
+    for (int t = 0; t < per_byte; t++) {
+        const unsigned int mask = ((1u << h) - 1) << (t * h);
+        for (int j = 0; j < nbytes; j++) {
+            out[j] |= (unsigned char)(((uint16_t)q[j + t * nbytes] >> (8 - t * h)) & mask);
+        }
+    }
+    return out + nbytes;
+}
+
+__attribute__((always_inline))
+static inline const unsigned char *bfp_unpack(const unsigned char *in, int16_t *restrict q, int bits) {
+    const int h = bits - 8;
+    if (h == 0) {
+        for (int k = 0; k < BFP_BLOCK_BINS; k++) q[k] = (int16_t)(signed char)in[k];
+        return in + BFP_BLOCK_BINS;
+    }
+
+    const unsigned char *hi = in + BFP_BLOCK_BINS;
+    const int per_byte = 8 / h;
+    const int nbytes = BFP_BLOCK_BINS / per_byte;
+    const unsigned int mask = ((1u << h) - 1) << 8;
+#pragma GCC unroll 8
+    for (int t = 0; t < per_byte; t++) {
+        for (int j = 0; j < nbytes; j++) {
+            int k = j + t * nbytes;
+            unsigned int v = in[k] | (((unsigned int)hi[j] << (8 - t * h)) & mask);
+            // bits ビットの2の補数を符号拡張
+            q[k] = (int16_t)((int16_t)(v << (16 - bits)) >> (16 - bits));
+        }
+    }
+    return hi + nbytes;
+}
+
+// 1ブロックを量子化して書き、書いた後の位置を返す
+__attribute__((always_inline))
+static inline unsigned char *bfp_encode_block(const float *re, const float *im, int count,
+                                              unsigned char *out, int bits) {
+    // 余りのビンを 0 にした作業用のコピー
+    // (電話帯域の上限は N/2-1 以下なので、ブロック全体を読んでもスペクトル配列 (SPECTRUM_STRIDE) に収まる)
+    float bre[BFP_BLOCK_BINS], bim[BFP_BLOCK_BINS];
+    for (int k = 0; k < BFP_BLOCK_BINS; k++) {
+        float r = re[k], m = im[k];
+        bre[k] = (k < count) ? r : 0.0f;
+        bim[k] = (k < count) ? m : 0.0f;
+    }
+
+    // 最大振幅 (符号ビットを落としたビット列は、int32 として比べても非負の float と同じ順に並ぶ)
+    int32_t bits_re[BFP_BLOCK_BINS], bits_im[BFP_BLOCK_BINS];
+    memcpy(bits_re, bre, sizeof(bits_re));
+    memcpy(bits_im, bim, sizeof(bits_im));
+    int32_t max_bits = 0;
+    for (int k = 0; k < BFP_BLOCK_BINS; k++) {
+        int32_t a = bits_re[k] & 0x7FFFFFFF, b = bits_im[k] & 0x7FFFFFFF;
+        int32_t m = a > b ? a : b;
+        max_bits = m > max_bits ? m : max_bits;
+    }
+
+    // 最大振幅 = 1.f * 2^(指数部 - 127) < 2^e (非正規化数は BFP_MIN_EXP より小さいので 0 とみなす)
+    int e = (int)(max_bits >> 23) - 126;
+    if (e < BFP_MIN_EXP) {
+        *out++ = (unsigned char)(signed char)BFP_SILENT_EXP;
+        return out;
+    }
+    if (e > BFP_MAX_EXP) e = BFP_MAX_EXP;
+    *out++ = (unsigned char)(signed char)e;
+
+    const float scale = bfp_pow2(bits - 1 - e);
+    const int limit = (1 << (bits - 1)) - 1;
+    int16_t qre[BFP_BLOCK_BINS], qim[BFP_BLOCK_BINS];
+    for (int k = 0; k < BFP_BLOCK_BINS; k++) {
+        float vr = bre[k] * scale, vi = bim[k] * scale;
+        int ir = (int)(vr + (vr >= 0.0f ? 0.5f : -0.5f));
+        int ii = (int)(vi + (vi >= 0.0f ? 0.5f : -0.5f));
+        ir = ir > limit ? limit : (ir < -limit ? -limit : ir);
+        ii = ii > limit ? limit : (ii < -limit ? -limit : ii);
+        qre[k] = (int16_t)ir;
+        qim[k] = (int16_t)ii;
+    }
+    out = bfp_pack(qre, out, bits);
+    return bfp_pack(qim, out, bits);
+}
+
+// 1ブロックを読んで count ビン分を書き戻す。データが足りなければ NULL を返す
+__attribute__((always_inline))
+static inline const unsigned char *bfp_decode_block(const unsigned char *in, const unsigned char *end,
+                                                    float *re, float *im, int count, int bits) {
+    if (in >= end) return NULL;
+    int e = (signed char)*in++;
+    if (e == BFP_SILENT_EXP) return in;   // 展開先は 0 で初期化済み
+    if (e < BFP_MIN_EXP) e = BFP_MIN_EXP;  // 壊れたデータでもスケールを作れる範囲に収める
+    if (end - in < 2 * (BFP_BLOCK_BINS + bfp_high_bytes(bits))) return NULL;
+
+    int16_t qre[BFP_BLOCK_BINS], qim[BFP_BLOCK_BINS];
+    in = bfp_unpack(in, qre, bits);
+    in = bfp_unpack(in, qim, bits);
+
+    const float scale = bfp_pow2(e - (bits - 1));
+    if (count == BFP_BLOCK_BINS) {
+        // 固定長のループで直接書く (ブロックの大半はこちら)
+        for (int k = 0; k < BFP_BLOCK_BINS; k++) {
+            re[k] = (float)qre[k] * scale;
+            im[k] = (float)qim[k] * scale;
+        }
+    } else {
+        // 電話帯域の最後の端数ブロック (帯域外のビンには書かない)
+        for (int k = 0; k < count; k++) {
+            re[k] = (float)qre[k] * scale;
+            im[k] = (float)qim[k] * scale;
+        }
+    }
+    return in;
+}
+
+// 仮数のビット数ごとに展開した本体 (ブロック内のループを固定長にするため)
+#define DEFINE_BFP_CODEC(BITS)                                                              \
+static int bfp_compress_##BITS(const CodecPlan *plan, const Spectrum *spec,               \
+                               unsigned char *out) {                                       \
+    unsigned char *p = out;                                                                 \
+    for (int i = plan->phone_low_bin; i <= plan->phone_high_bin; i += BFP_BLOCK_BINS) {    \
+        int count = plan->phone_high_bin - i + 1;                                           \
+        if (count > BFP_BLOCK_BINS) count = BFP_BLOCK_BINS;                                 \
+        p = bfp_encode_block(spec->re + i, spec->im + i, count, p, BITS);                   \
+    }                                                                                       \
+    return (int)(p - out);                                                                  \
+}                                                                                           \
+static void bfp_decompress_##BITS(const CodecPlan *plan, const unsigned char *in, int size, \
+                                  Spectrum *spec) {                                         \
+    const unsigned char *end = in + size;                                                   \
+    for (int i = plan->phone_low_bin; i <= plan->phone_high_bin && in; i += BFP_BLOCK_BINS) { \
+        int count = plan->phone_high_bin - i + 1;                                           \
+        if (count > BFP_BLOCK_BINS) count = BFP_BLOCK_BINS;                                 \
+        in = bfp_decode_block(in, end, spec->re + i, spec->im + i, count, BITS);            \
+    }                                                                                       \
+}
+
+DEFINE_BFP_CODEC(8)
+DEFINE_BFP_CODEC(9)
+DEFINE_BFP_CODEC(10)
+DEFINE_BFP_CODEC(12)
+DEFINE_BFP_CODEC(16)
+
+// 仮数のビット数として使える値か
+static int bfp_bits_supported(int bits) {
+    return bits == 8 || bits == 9 || bits == 10 || bits == 12 || bits == 16;
+}
+
+// 1フレームの最大バイト数
+static int bfp_max_bytes(const CodecPlan *plan, int bits) {
+    int bins = plan->phone_high_bin - plan->phone_low_bin + 1;
+    int blocks = (bins + BFP_BLOCK_BINS - 1) / BFP_BLOCK_BINS;
+    return blocks * (1 + 2 * (BFP_BLOCK_BINS + bfp_high_bytes(bits)));
+}
+
+static int bfp_compress(const CodecPlan *plan, const Spectrum *spec, unsigned char *out) {
+    switch (plan->bfp_bits) {
+    case 8:  return bfp_compress_8(plan, spec, out);
+    case 9:  return bfp_compress_9(plan, spec, out);
+    case 10: return bfp_compress_10(plan, spec, out);
+    case 12: return bfp_compress_12(plan, spec, out);
+    default: return bfp_compress_16(plan, spec, out);
+    }
+}
+
+static void bfp_decompress(const CodecPlan *plan, const unsigned char *in, int size, Spectrum *spec) {
+    switch (plan->bfp_bits) {
+    case 8:  bfp_decompress_8(plan, in, size, spec); break;
+    case 9:  bfp_decompress_9(plan, in, size, spec); break;
+    case 10: bfp_decompress_10(plan, in, size, spec); break;
+    case 12: bfp_decompress_12(plan, in, size, spec); break;
+    default: bfp_decompress_16(plan, in, size, spec); break;
+    }
+}
+
+// 電話帯域データの圧縮（有効な帯域のみ送信）
+// bfp_bits が 0 なら各ビンの実部・虚部を float のまま、それ以外はブロック浮動小数点で送る
+void phone_band_compress(const CodecPlan *plan, const Spectrum *fft_data,
+                         unsigned char *compressed_data, int *compressed_size) {
+    if (plan->bfp_bits) {
+        *compressed_size = bfp_compress(plan, fft_data, compressed_data);
+        return;
+    }
+
+    int write_pos = 0;
+    
+    // 有効な帯域のみを圧縮データに格納
+    for (int i = plan->phone_low_bin; i <= plan->phone_high_bin; i++) {
+        // 実部と虚部を float として格納
+        float real_part = fft_data->re[i];
+        float imag_part = fft_data->im[i];
+        
+        memcpy(&compressed_data[write_pos], &real_part, sizeof(float));
+        write_pos += sizeof(float);
+        memcpy(&compressed_data[write_pos], &imag_part, sizeof(float));
+        write_pos += sizeof(float);
+    }
+    
+    *compressed_size = write_pos;
+}
+
+// 電話帯域データの展開
+void phone_band_decompress(const CodecPlan *plan, unsigned char *compressed_data,
+                           Spectrum *fft_data, int compressed_size) {
+    // FFTバッファを初期化 (使うビンのみ)
+    memset(fft_data->re, 0, plan->spectrum_bins * sizeof(float));
+    memset(fft_data->im, 0, plan->spectrum_bins * sizeof(float));
+
+    if (plan->bfp_bits) {
+        bfp_decompress(plan, compressed_data, compressed_size, fft_data);
+        return;
+    }
+    
+    int read_pos = 0;
+    
+    // 有効な帯域のデータを復元
+    for (int i = plan->phone_low_bin; i <= plan->phone_high_bin && read_pos < compressed_size; i++) {
+        if (read_pos + sizeof(float) * 2 > compressed_size) break;
+        
+        float real_part, imag_part;
+        memcpy(&real_part, &compressed_data[read_pos], sizeof(float));
+        read_pos += sizeof(float);
+        memcpy(&imag_part, &compressed_data[read_pos], sizeof(float));
+        read_pos += sizeof(float);
+        
+        fft_data->re[i] = real_part;
+        fft_data->im[i] = imag_part;
+    }
+}
+
+// --- 心理音響モデル ---
+
+// 周波数を Bark 尺度に変換 (Zwicker の近似式)
+static float hz_to_bark(float freq_hz) {
+    return 13.0f * atanf(0.00076f * freq_hz) + 3.5f * atanf(powf(freq_hz / 7500.0f, 2));
+}
+
+// 絶対聴覚閾値の近似式
+float absolute_threshold_db(float freq_hz) {
+    if (freq_hz < 20) return 80.0f;
+    if (freq_hz > 16000) return 60.0f;
+    
+    // 簡略化された絶対聴覚閾値曲線
+    float threshold = 3.64f * pow(freq_hz / 1000.0f, -0.8f) 
+                     - 6.5f * exp(-0.6f * pow(freq_hz / 1000.0f - 3.3f, 2)) 
+                     + 0.001f * pow(freq_hz / 1000.0f, 4);
+    
+    // 低周波と高周波でのペナルティ
+    if (freq_hz < 500) threshold += 20.0f;
+    if (freq_hz > 8000) threshold += 10.0f;
+    
+    return threshold;
+}
+
+// 周波数を ERB 尺度に変換 (Glasberg & Moore の ERB-rate)
+static float hz_to_erb(float freq_hz) {
+    return 21.4f * log10f(1.0f + 0.00437f * freq_hz);
+}
+
+// 帯域の分け方の尺度での周波数
+static float band_scale(BandLayout layout, float freq_hz) {
+    if (layout == BAND_LAYOUT_BARK) return hz_to_bark(freq_hz);
+    if (layout == BAND_LAYOUT_ERB) return hz_to_erb(freq_hz);
+    return freq_hz;
+}
+
+// 帯域の分け方に合わせた既定の帯域数 (臨界帯域なら尺度の 1 単位に 1 帯域)
+static int default_num_bands(BandLayout layout, int sample_rate) {
+    if (layout == BAND_LAYOUT_LINEAR) return DEFAULT_NUM_BANDS;
+    return (int)ceilf(band_scale(layout, sample_rate / 2.0f));
+}
+
+// 帯域の境界を決める
+// 0 〜 ナイキスト周波数を帯域の分け方の尺度で等分し、各帯域はその区間に中心が入るビンを持つ
+// 低域で区間がビン幅より狭くなる帯域は 1 ビンにし、残りを後ろへずらす
+static void init_band_edges(CodecPlan *plan) {
+    const int N = plan->frame_size, num_bands = plan->num_bands, bins = N / 2;
+    BandConfig *bands = plan->bands;
+
+    if (plan->band_layout == BAND_LAYOUT_LINEAR) {
+        int bins_per_band = bins / num_bands;
+        for (int i = 0; i < num_bands; i++) {
+            bands[i].start_bin = i * bins_per_band;
+            bands[i].end_bin = (i + 1) * bins_per_band - 1;
+        }
+    } else {
+        float top = band_scale(plan->band_layout, plan->sample_rate / 2.0f);
+        int k = 0;
+        for (int i = 0; i < num_bands; i++) {
+            float edge = top * i / num_bands;
+            while (k < bins && band_scale(plan->band_layout, (float)k * plan->sample_rate / N) < edge) k++;
+            // 前の帯域より後ろ、かつ残りの帯域に 1 ビンずつ残る位置
+            int start = k;
+            if (i > 0 && start <= bands[i - 1].start_bin) start = bands[i - 1].start_bin + 1;
+            if (start > bins - (num_bands - i)) start = bins - (num_bands - i);
+            if (i == 0) start = 0;
+            bands[i].start_bin = start;
+            if (i > 0) bands[i - 1].end_bin = start - 1;
+        }
+    }
+    bands[num_bands - 1].end_bin = bins - 1;
+}
+
+// 周波数帯域の設定を初期化
+static void init_band_config(CodecPlan *plan) {
+    const int N = plan->frame_size, num_bands = plan->num_bands;
+    BandConfig *bands = plan->bands;
+
+    init_band_edges(plan);
+    for (int i = 0; i < num_bands; i++) {
+        // 中心周波数を計算
+        float center_freq = ((float)(bands[i].start_bin + bands[i].end_bin) / 2.0f) 
+                           * plan->sample_rate / N;
+        
+        // 絶対聴覚閾値を取得
+        bands[i].threshold_db = absolute_threshold_db(center_freq);
+        
+        // 閾値に基づいてビット数を決定
+        if (bands[i].threshold_db > 40.0f) {
+            // 聞こえにくい帯域: 低ビット
+            bands[i].mag_bits = 3;
+            bands[i].phase_bits = 2;
+        } else if (bands[i].threshold_db > 20.0f) {
+            // 中程度の帯域: 中ビット
+            bands[i].mag_bits = 5;
+            bands[i].phase_bits = 3;
+        } else {
+            // 聞こえやすい帯域: 高ビット
+            bands[i].mag_bits = 7;
+            bands[i].phase_bits = 4;
+        }
+
+        // ビンごとの表に展開する
+        for (int k = bands[i].start_bin; k <= bands[i].end_bin; k++) {
+            plan->psy_threshold_db[k] = bands[i].threshold_db;
+            plan->psy_mag_levels[k] = (float)((1 << bands[i].mag_bits) - 1);
+            plan->psy_phase_levels[k] = (float)((1 << bands[i].phase_bits) - 1);
+        }
+
+        // 展開用の逆量子化表 (全ビット数分。マスキングモデルではフレームごとにビット数が変わる)
+        float mag_min = bands[i].threshold_db - 30.0f;
+        float mag_max = mag_min + 60.0f;
+        for (int b = 1; b <= MAX_MAG_BITS; b++) {
+            for (int q = 0; q < (1 << b); q++) {
+                float magnitude_db = dequantize_value(q, b, mag_min, mag_max);
+                plan->psy_mag_lut[i][(1 << b) + q] = powf(10.0f, magnitude_db / 20.0f);
+            }
+        }
+    }
+
+    for (int b = 1; b <= MAX_PHASE_BITS; b++) {
+        for (int q = 0; q < (1 << b); q++) {
+            float phase = dequantize_value(q, b, 0.0f, 2.0f * (float)PI) - (float)PI;
+            plan->psy_cos_lut[(1 << b) + q] = cosf(phase);
+            plan->psy_sin_lut[(1 << b) + q] = sinf(phase);
+        }
+    }
+}
+
+// 帯域設定を表示
+void print_band_config(const CodecPlan *plan) {
+    const BandConfig *bands = plan->bands;
+    for (int i = 0; i < plan->num_bands; i++) {
+        fprintf(stderr, "Band %d: %.1f-%.1f Hz, Threshold: %.1f dB, Bits: %d/%d\n",
+                i, 
+                bands[i].start_bin * (float)plan->sample_rate / plan->frame_size,
+                bands[i].end_bin * (float)plan->sample_rate / plan->frame_size,
+                bands[i].threshold_db,
+                bands[i].mag_bits, bands[i].phase_bits);
+    }
+}
+
+// 量子化関数
+unsigned char quantize_value(float value, int bits, float min_val, float max_val) {
+    int levels = (1 << bits) - 1;  // 2^bits - 1
+    float normalized = (value - min_val) / (max_val - min_val);
+    normalized = fmaxf(0.0f, fminf(1.0f, normalized));  // クランプ
+    return (unsigned char)(normalized * levels);
+}
+
+// 逆量子化関数
+float dequantize_value(unsigned char quantized, int bits, float min_val, float max_val) {
+    int levels = (1 << bits) - 1;  // 2^bits - 1
+    float normalized = (float)quantized / levels;
+    return min_val + normalized * (max_val - min_val);
+}
+
+// --- 振幅・位相の量子化 (心理音響圧縮の解析段) ---
+// 全ビンの振幅 (dB) と位相を量子化値まで求める。ビンごとの閾値 (psy_threshold_db) と
+// 段数 (mag_levels, phase_levels) を表で受け取るので、帯域の境界を気にせず全ビンをまとめてベクトル化できる
+// 段数が 0 のビンの量子化値は 0 になる
+// log10 と atan2 は多項式で近似する。どちらも誤差は量子化幅よりずっと小さい
+// (log2: 指数部 + 仮数部の5次多項式、誤差 5e-5 dB / atan: [0,1] の9次奇多項式と象限の折り返し、誤差 1.2e-5 rad)
+// 量子化値が変わるのは量子化の境界のごく近くにあるビンだけ
+
+#define DB_PER_LOG2 3.01029996f   // 10*log10(2): パワーの log2 から dB へ
+#define MIN_POWER 1e-20f          // -200dB (振幅 1e-10 に相当)
+#define LOG2_C1 1.44187990f       // log2(1+t) ≈ t*(C1 + t*(C2 + ...)) (0 <= t < 1)
+#define LOG2_C2 -0.70886522f
+#define LOG2_C3 0.41524556f
+#define LOG2_C4 -0.19351652f
+#define LOG2_C5 0.04526829f
+#define ATAN_C1 0.9998660f        // atan(a) ≈ a*(C1 + a^2*(C3 + ...)) (0 <= a <= 1)
+#define ATAN_C3 -0.3302995f
+#define ATAN_C5 0.1801410f
+#define ATAN_C7 -0.0851330f
+#define ATAN_C9 0.0208351f
+
+// log2(x) = 指数部 + log2(仮数部) (x は正の正規化数)
+static inline float fast_log2(float x) {
+    unsigned int bits;
+    memcpy(&bits, &x, sizeof(bits));
+    float e = (float)((int)(bits >> 23) - 127);
+    unsigned int mbits = (bits & 0x007FFFFFu) | 0x3F800000u;
+    float t;
+    memcpy(&t, &mbits, sizeof(t));
+    t -= 1.0f;
+    return e + t * (LOG2_C1 + t * (LOG2_C2 + t * (LOG2_C3 + t * (LOG2_C4 + t * LOG2_C5))));
+}
+
+// 1ビン分 (各命令セット版の端数の処理にも使う)
+__attribute__((always_inline))
+static inline void analyze_bin_scalar(const CodecPlan *plan, const Spectrum *spec, int k,
+                                      const float *mag_levels, const float *phase_levels,
+                                      unsigned char *q_mag, unsigned char *q_phase) {
+    float re = spec->re[k], im = spec->im[k];
+
+    float log2p = fast_log2(fmaxf(re * re + im * im, MIN_POWER));
+
+    // 閾値以下は閾値 -20dB、量子化範囲は閾値 -30dB から 60dB
+    float d = DB_PER_LOG2 * log2p - plan->psy_threshold_db[k];
+    d = (d < 0.0f) ? -20.0f : fminf(d, 30.0f);
+    q_mag[k] = (unsigned char)((d + 30.0f) * (1.0f / 60.0f) * mag_levels[k]);
+
+    // 位相: |re|, |im| の小さい方/大きい方の atan を象限に折り返す
+    float ax = fabsf(re), ay = fabsf(im);
+    float a = fminf(ax, ay) / fmaxf(fmaxf(ax, ay), MIN_POWER);
+    float s = a * a;
+    float r = a * (ATAN_C1 + s * (ATAN_C3 + s * (ATAN_C5 + s * (ATAN_C7 + s * ATAN_C9))));
+    if (ay > ax) r = 0.5f * (float)PI - r;
+    if (re < 0.0f) r = (float)PI - r;
+    if (signbit(im)) r = -r;
+    float n = fminf(fmaxf((r + (float)PI) * (float)(0.5 / PI), 0.0f), 1.0f);
+    q_phase[k] = (unsigned char)(n * phase_levels[k]);
+}
+
+static void analyze_scalar(const CodecPlan *plan, const Spectrum *spec,
+                           const float *mag_levels, const float *phase_levels,
+                           unsigned char *q_mag, unsigned char *q_phase) {
+    for (int k = 0; k < plan->frame_size / 2; k++) analyze_bin_scalar(plan, spec, k, mag_levels, phase_levels, q_mag, q_phase);
+}
+
+#ifdef HAVE_X86_SIMD
+// SSE2版: 4ビンずつ (比較結果のマスクで選択する)
+#define SSE2_SELECT(mask, a, b) _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b))
+
+__attribute__((target("sse2")))
+static void analyze_sse2(const CodecPlan *plan, const Spectrum *spec,
+                         const float *mag_levels, const float *phase_levels,
+                         unsigned char *q_mag, unsigned char *q_phase) {
+    const int bins = plan->frame_size / 2;
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    const __m128 pi = _mm_set1_ps((float)PI), zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    int k = 0;
+    for (; k + 4 <= bins; k += 4) {
+        __m128 re = _mm_loadu_ps(spec->re + k), im = _mm_loadu_ps(spec->im + k);
+
+        __m128 power = _mm_max_ps(_mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im)), _mm_set1_ps(MIN_POWER));
+        __m128i bits = _mm_castps_si128(power);
+        __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+        __m128 t = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)),
+                                                             _mm_set1_epi32(0x3F800000))), one);
+        __m128 poly = _mm_add_ps(_mm_set1_ps(LOG2_C4), _mm_mul_ps(t, _mm_set1_ps(LOG2_C5)));
+        poly = _mm_add_ps(_mm_set1_ps(LOG2_C3), _mm_mul_ps(t, poly));
+        poly = _mm_add_ps(_mm_set1_ps(LOG2_C2), _mm_mul_ps(t, poly));
+        poly = _mm_add_ps(_mm_set1_ps(LOG2_C1), _mm_mul_ps(t, poly));
+        __m128 log2p = _mm_add_ps(e, _mm_mul_ps(t, poly));
+
+        __m128 d = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(DB_PER_LOG2), log2p), _mm_loadu_ps(plan->psy_threshold_db + k));
+        d = SSE2_SELECT(_mm_cmplt_ps(d, zero), _mm_set1_ps(-20.0f), _mm_min_ps(d, _mm_set1_ps(30.0f)));
+        __m128 qm = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(d, _mm_set1_ps(30.0f)), _mm_set1_ps(1.0f / 60.0f)),
+                               _mm_loadu_ps(mag_levels + k));
+
+        __m128 ax = _mm_andnot_ps(sign_mask, re), ay = _mm_andnot_ps(sign_mask, im);
+        __m128 a = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(MIN_POWER)));
+        __m128 s = _mm_mul_ps(a, a);
+        __m128 r = _mm_add_ps(_mm_set1_ps(ATAN_C7), _mm_mul_ps(s, _mm_set1_ps(ATAN_C9)));
+        r = _mm_add_ps(_mm_set1_ps(ATAN_C5), _mm_mul_ps(s, r));
+        r = _mm_add_ps(_mm_set1_ps(ATAN_C3), _mm_mul_ps(s, r));
+        r = _mm_mul_ps(a, _mm_add_ps(_mm_set1_ps(ATAN_C1), _mm_mul_ps(s, r)));
+        r = SSE2_SELECT(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(0.5f * (float)PI), r), r);
+        r = SSE2_SELECT(_mm_cmplt_ps(re, zero), _mm_sub_ps(pi, r), r);
+        r = _mm_xor_ps(r, _mm_and_ps(im, sign_mask));
+        __m128 n = _mm_mul_ps(_mm_add_ps(r, pi), _mm_set1_ps((float)(0.5 / PI)));
+        n = _mm_min_ps(_mm_max_ps(n, zero), one);
+        __m128 qp = _mm_mul_ps(n, _mm_loadu_ps(phase_levels + k));
+
+        // 32bit 整数から 8bit に詰めて4ビン分を書く
+        __m128i qm8 = _mm_packus_epi16(_mm_packs_epi32(_mm_cvttps_epi32(qm), _mm_setzero_si128()), _mm_setzero_si128());
+        __m128i qp8 = _mm_packus_epi16(_mm_packs_epi32(_mm_cvttps_epi32(qp), _mm_setzero_si128()), _mm_setzero_si128());
+        int wm = _mm_cvtsi128_si32(qm8), wp = _mm_cvtsi128_si32(qp8);
+        memcpy(q_mag + k, &wm, 4);
+        memcpy(q_phase + k, &wp, 4);
+    }
+    for (; k < bins; k++) analyze_bin_scalar(plan, spec, k, mag_levels, phase_levels, q_mag, q_phase);
+}
+
+// AVX2版: 8ビンずつ (FMAで多項式を評価する)
+__attribute__((target("avx2,fma")))
+static void analyze_avx2(const CodecPlan *plan, const Spectrum *spec,
+                         const float *mag_levels, const float *phase_levels,
+                         unsigned char *q_mag, unsigned char *q_phase) {
+    const int bins = plan->frame_size / 2;
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    const __m256 pi = _mm256_set1_ps((float)PI), zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    int k = 0;
+    for (; k + 8 <= bins; k += 8) {
+        __m256 re = _mm256_loadu_ps(spec->re + k), im = _mm256_loadu_ps(spec->im + k);
+
+        __m256 power = _mm256_max_ps(_mm256_fmadd_ps(re, re, _mm256_mul_ps(im, im)), _mm256_set1_ps(MIN_POWER));
+        __m256i bits = _mm256_castps_si256(power);
+        __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+        __m256 t = _mm256_sub_ps(_mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)),
+                                                                      _mm256_set1_epi32(0x3F800000))), one);
+        __m256 poly = _mm256_fmadd_ps(t, _mm256_set1_ps(LOG2_C5), _mm256_set1_ps(LOG2_C4));
+        poly = _mm256_fmadd_ps(t, poly, _mm256_set1_ps(LOG2_C3));
+        poly = _mm256_fmadd_ps(t, poly, _mm256_set1_ps(LOG2_C2));
+        poly = _mm256_fmadd_ps(t, poly, _mm256_set1_ps(LOG2_C1));
+        __m256 log2p = _mm256_fmadd_ps(t, poly, e);
+
+        __m256 d = _mm256_fmsub_ps(_mm256_set1_ps(DB_PER_LOG2), log2p, _mm256_loadu_ps(plan->psy_threshold_db + k));
+        d = _mm256_blendv_ps(_mm256_min_ps(d, _mm256_set1_ps(30.0f)), _mm256_set1_ps(-20.0f),
+                             _mm256_cmp_ps(d, zero, _CMP_LT_OQ));
+        __m256 qm = _mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(d, _mm256_set1_ps(30.0f)), _mm256_set1_ps(1.0f / 60.0f)),
+                                  _mm256_loadu_ps(mag_levels + k));
+
+        __m256 ax = _mm256_andnot_ps(sign_mask, re), ay = _mm256_andnot_ps(sign_mask, im);
+        __m256 a = _mm256_div_ps(_mm256_min_ps(ax, ay), _mm256_max_ps(_mm256_max_ps(ax, ay), _mm256_set1_ps(MIN_POWER)));
+        __m256 s = _mm256_mul_ps(a, a);
+        __m256 r = _mm256_fmadd_ps(s, _mm256_set1_ps(ATAN_C9), _mm256_set1_ps(ATAN_C7));
+        r = _mm256_fmadd_ps(s, r, _mm256_set1_ps(ATAN_C5));
+        r = _mm256_fmadd_ps(s, r, _mm256_set1_ps(ATAN_C3));
+        r = _mm256_mul_ps(a, _mm256_fmadd_ps(s, r, _mm256_set1_ps(ATAN_C1)));
+        r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(0.5f * (float)PI), r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+        r = _mm256_blendv_ps(r, _mm256_sub_ps(pi, r), _mm256_cmp_ps(re, zero, _CMP_LT_OQ));
+        r = _mm256_xor_ps(r, _mm256_and_ps(im, sign_mask));
+        __m256 n = _mm256_mul_ps(_mm256_add_ps(r, pi), _mm256_set1_ps((float)(0.5 / PI)));
+        n = _mm256_min_ps(_mm256_max_ps(n, zero), one);
+        __m256 qp = _mm256_mul_ps(n, _mm256_loadu_ps(phase_levels + k));
+
+        // 32bit 整数から 8bit に詰めて8ビン分を書く (128bit 単位で詰める)
+        __m256i qmi = _mm256_cvttps_epi32(qm), qpi = _mm256_cvttps_epi32(qp);
+        __m128i qm16 = _mm_packs_epi32(_mm256_castsi256_si128(qmi), _mm256_extracti128_si256(qmi, 1));
+        __m128i qp16 = _mm_packs_epi32(_mm256_castsi256_si128(qpi), _mm256_extracti128_si256(qpi, 1));
+        _mm_storel_epi64((__m128i *)(q_mag + k), _mm_packus_epi16(qm16, qm16));
+        _mm_storel_epi64((__m128i *)(q_phase + k), _mm_packus_epi16(qp16, qp16));
+    }
+    for (; k < bins; k++) analyze_bin_scalar(plan, spec, k, mag_levels, phase_levels, q_mag, q_phase);
+}
+
+// AVX-512版: 16ビンずつ
+__attribute__((target("avx512f")))
+static void analyze_avx512(const CodecPlan *plan, const Spectrum *spec,
+                           const float *mag_levels, const float *phase_levels,
+                           unsigned char *q_mag, unsigned char *q_phase) {
+    const int bins = plan->frame_size / 2;
+    const __m512i sign_mask = _mm512_set1_epi32((int)0x80000000u);
+    const __m512 pi = _mm512_set1_ps((float)PI), zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.0f);
+    int k = 0;
+    for (; k + 16 <= bins; k += 16) {
+        __m512 re = _mm512_loadu_ps(spec->re + k), im = _mm512_loadu_ps(spec->im + k);
+
+        __m512 power = _mm512_max_ps(_mm512_fmadd_ps(re, re, _mm512_mul_ps(im, im)), _mm512_set1_ps(MIN_POWER));
+        __m512i bits = _mm512_castps_si512(power);
+        __m512 e = _mm512_cvtepi32_ps(_mm512_sub_epi32(_mm512_srli_epi32(bits, 23), _mm512_set1_epi32(127)));
+        __m512 t = _mm512_sub_ps(_mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x007FFFFF)),
+                                                                      _mm512_set1_epi32(0x3F800000))), one);
+        __m512 poly = _mm512_fmadd_ps(t, _mm512_set1_ps(LOG2_C5), _mm512_set1_ps(LOG2_C4));
+        poly = _mm512_fmadd_ps(t, poly, _mm512_set1_ps(LOG2_C3));
+        poly = _mm512_fmadd_ps(t, poly, _mm512_set1_ps(LOG2_C2));
+        poly = _mm512_fmadd_ps(t, poly, _mm512_set1_ps(LOG2_C1));
+        __m512 log2p = _mm512_fmadd_ps(t, poly, e);
+
+        __m512 d = _mm512_fmsub_ps(_mm512_set1_ps(DB_PER_LOG2), log2p, _mm512_loadu_ps(plan->psy_threshold_db + k));
+        d = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(d, zero, _CMP_LT_OQ),
+                                 _mm512_min_ps(d, _mm512_set1_ps(30.0f)), _mm512_set1_ps(-20.0f));
+        __m512 qm = _mm512_mul_ps(_mm512_mul_ps(_mm512_add_ps(d, _mm512_set1_ps(30.0f)), _mm512_set1_ps(1.0f / 60.0f)),
+                                  _mm512_loadu_ps(mag_levels + k));
+
+        __m512 ax = _mm512_abs_ps(re), ay = _mm512_abs_ps(im);
+        __m512 a = _mm512_div_ps(_mm512_min_ps(ax, ay), _mm512_max_ps(_mm512_max_ps(ax, ay), _mm512_set1_ps(MIN_POWER)));
+        __m512 s = _mm512_mul_ps(a, a);
+        __m512 r = _mm512_fmadd_ps(s, _mm512_set1_ps(ATAN_C9), _mm512_set1_ps(ATAN_C7));
+        r = _mm512_fmadd_ps(s, r, _mm512_set1_ps(ATAN_C5));
+        r = _mm512_fmadd_ps(s, r, _mm512_set1_ps(ATAN_C3));
+        r = _mm512_mul_ps(a, _mm512_fmadd_ps(s, r, _mm512_set1_ps(ATAN_C1)));
+        r = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(ay, ax, _CMP_GT_OQ), r, _mm512_sub_ps(_mm512_set1_ps(0.5f * (float)PI), r));
+        r = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(re, zero, _CMP_LT_OQ), r, _mm512_sub_ps(pi, r));
+        r = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(r),
+                                                 _mm512_and_si512(_mm512_castps_si512(im), sign_mask)));
+        __m512 n = _mm512_mul_ps(_mm512_add_ps(r, pi), _mm512_set1_ps((float)(0.5 / PI)));
+        n = _mm512_min_ps(_mm512_max_ps(n, zero), one);
+        __m512 qp = _mm512_mul_ps(n, _mm512_loadu_ps(phase_levels + k));
+
+        _mm_storeu_si128((__m128i *)(q_mag + k), _mm512_cvtusepi32_epi8(_mm512_cvttps_epi32(qm)));
+        _mm_storeu_si128((__m128i *)(q_phase + k), _mm512_cvtusepi32_epi8(_mm512_cvttps_epi32(qp)));
+    }
+    for (; k < bins; k++) analyze_bin_scalar(plan, spec, k, mag_levels, phase_levels, q_mag, q_phase);
+}
+#endif
+
+// 命令セットごとの解析カーネル (添字は g_butterfly_kernels と同じ)
+static const PlanAnalyzeFunc g_analyze_kernels[] = {
+    analyze_scalar,
+#ifdef HAVE_X86_SIMD
+    analyze_sse2,
+    analyze_avx2,
+    analyze_avx512,
+#endif
+};
+
+// --- フレームごとのマスキングモデル ---
+// 帯域ごとのエネルギーを Bark 尺度の拡散関数 (Schroeder) で周りの帯域に広げてマスキング閾値を求め、
+// 信号対マスク比 (SMR) に応じて帯域の振幅のビット数を決める。マスクされた帯域は 0 ビット (送らない)
+// マスキング閾値の下げ幅は帯域の調性で変える (純音的: 14.5 + Bark、雑音的: 5.5 dB)
+// 調性はスペクトル平坦度 (幾何平均/算術平均、-60dB で完全に純音とみなす) から推定する
+
+#define SFM_TONAL_DB -60.0f     // この平坦度 (dB) 以下を純音とみなす
+#define NOISE_MASK_DB 5.5f      // 雑音的なマスカーの閾値の下げ幅
+#define MASKING_DB_PER_BIT 6.0f // SMR がこれだけ増えるごとに振幅を1ビット増やす
+#define MASKING_MIN_BITS 3      // マスクされていない帯域に割り当てる最小ビット数
+
+// 振幅のビット数に対応する位相のビット数 (固定の帯域設定と同じ組み合わせ)
+static const unsigned char g_phase_bits[MAX_MAG_BITS + 1] = {0, 2, 2, 2, 2, 3, 3, 4};
+
+// 帯域の Bark 値と帯域間の拡散の表を作る (init_band_config の後に呼ぶ)
+static void init_masking_model(CodecPlan *plan) {
+    const BandConfig *bands = plan->bands;
+    for (int b = 0; b < plan->num_bands; b++) {
+        float center_freq = ((float)(bands[b].start_bin + bands[b].end_bin) / 2.0f)
+                           * plan->sample_rate / plan->frame_size;
+        plan->band_bark[b] = hz_to_bark(center_freq);
+    }
+    for (int b = 0; b < plan->num_bands; b++) {
+        // 拡散関数は Bark あたりのエネルギーを与えるので、帯域の Bark 幅を掛けて帯域内のマスク量にする
+        // (1 Bark より広い帯域は 1 Bark 分とし、中心から離れたビンのマスクを多めに見積もらない)
+        float bin_hz = (float)plan->sample_rate / plan->frame_size;
+        float low_hz = fmaxf((bands[b].start_bin - 0.5f) * bin_hz, 0.0f);
+        float width = hz_to_bark((bands[b].end_bin + 0.5f) * bin_hz) - hz_to_bark(low_hz);
+        for (int j = 0; j < plan->num_bands; j++) {
+            // 拡散関数 (dB): マスカー j からマスキー b への Bark 差 dz で決まる
+            float dz = plan->band_bark[b] - plan->band_bark[j] + 0.474f;
+            float spread_db = 15.81f + 7.5f * dz - 17.5f * sqrtf(1.0f + dz * dz);
+            plan->band_spread[j][b] = powf(10.0f, spread_db / 10.0f) * fminf(width, 1.0f);
+        }
+    }
+}
+
+// 帯域ごとの信号対マスク比 (SMR, dB) をこのフレームのスペクトルから求める
+static void masking_band_smr(const CodecPlan *plan, const Spectrum *spec, float *smr) {
+    const BandConfig *bands = plan->bands;
+    const int last_bin = plan->frame_size/2 - 1;
+    float energy[MAX_BANDS], tonality[MAX_BANDS];
+    int bins[MAX_BANDS];
+
+    // 帯域のエネルギーと調性
+    for (int b = 0; b < plan->num_bands; b++) {
+        float sum = 0.0f, sum_log2 = 0.0f;
+        int end = bands[b].end_bin < last_bin ? bands[b].end_bin : last_bin;
+        for (int k = bands[b].start_bin; k <= end; k++) {
+            float power = fmaxf(spec->re[k] * spec->re[k] + spec->im[k] * spec->im[k], MIN_POWER);
+            sum += power;
+            sum_log2 += fast_log2(power);
+        }
+        bins[b] = end - bands[b].start_bin + 1;
+        energy[b] = sum;
+        float flatness_db = DB_PER_LOG2 * (sum_log2 / bins[b] - fast_log2(fmaxf(sum / bins[b], MIN_POWER)));
+        tonality[b] = fminf(flatness_db / SFM_TONAL_DB, 1.0f);
+    }
+
+    for (int b = 0; b < plan->num_bands; b++) {
+        // 周りの帯域から広がってきたエネルギー
+        float spread = 0.0f;
+        for (int j = 0; j < plan->num_bands; j++) spread += plan->band_spread[j][b] * energy[j];
+
+        // ビンあたりのマスキング閾値 (最小可聴値より下にはしない) と信号の比
+        float offset_db = tonality[b] * (14.5f + plan->band_bark[b]) + (1.0f - tonality[b]) * NOISE_MASK_DB;
+        float mask_db = DB_PER_LOG2 * fast_log2(fmaxf(spread / bins[b], MIN_POWER)) - offset_db;
+        mask_db = fmaxf(mask_db, bands[b].threshold_db);
+        float signal_db = DB_PER_LOG2 * fast_log2(fmaxf(energy[b] / bins[b], MIN_POWER));
+        smr[b] = signal_db - mask_db;
+    }
+}
+
+// SMR から帯域の振幅のビット数を決める
+// offset_db はマスキング閾値の上げ幅 (レート制御の量子化ステップ。正なら粗く、負なら細かくなる)
+static void masking_bits_from_smr(const CodecPlan *plan, const float *smr, float offset_db,
+                                  unsigned char *mag_bits) {
+    for (int b = 0; b < plan->num_bands; b++) {
+        float margin = smr[b] - offset_db;
+        int bits = 0;
+        if (margin > 0.0f) bits = MASKING_MIN_BITS + (int)(margin / MASKING_DB_PER_BIT);
+        mag_bits[b] = (unsigned char)(bits < MAX_MAG_BITS ? bits : MAX_MAG_BITS);
+    }
+}
+
+// 帯域ごとのビット数で本体をビットストリームで送るときのバイト数
+static int psycho_raw_bytes(const CodecPlan *plan, const unsigned char *mag_bits) {
+    const int last_bin = plan->frame_size/2 - 1;
+    int total_bits = 0;
+    for (int b = 0; b < plan->num_bands; b++) {
+        int end = plan->bands[b].end_bin < last_bin ? plan->bands[b].end_bin : last_bin;
+        total_bits += (end - plan->bands[b].start_bin + 1) * (mag_bits[b] + g_phase_bits[mag_bits[b]]);
+    }
+    return (total_bits + 7) / 8;
+}
+
+// --- エントロピー符号化 ---
+// 振幅の量子化値はビット数ごとの適応モデルでレンジ符号化する
+// (直前のビンの振幅でモデルを分けても、この程度の記号数では学習が追いつかず小さくならなかった)
+// モデルはフレームごとに初期化するので、フレームの欠落があっても次のフレームから復号できる
+// 位相・符号・スケールファクタはほぼ一様に分布するので等確率のビットとして送る
+//
+// レンジ符号化しても小さくならないフレームはそのままのビットストリームで送る
+// どちらで送ったかは本体の先頭の1byte (ENTROPY_MODE_*) で示す。復号側はモードごとに長さを確かめ、
+// ビットストリームなら帯域のビット数で決まる長さ (psycho_raw_bytes / mdct_raw_bytes) ちょうど、
+// レンジ符号ならそれより短くなければ壊れたフレームとして捨てる
+// (レンジ符号は末尾の 0 を送らないので、すべて 0 の記号のフレームは本体が 0byte になる。これも正しいフレーム)
+
+#define ENTROPY_MAX_BITS 8   // 適応モデルで扱う振幅の最大ビット数
+#define ENTROPY_MODE_RAW 0   // 本体はそのままのビットストリーム
+#define ENTROPY_MODE_RANGE 1 // 本体はレンジ符号
+
+// 本体の先頭のモードの byte 数 (エントロピー符号化が無効なら付けない)
+static inline int entropy_mode_bytes(const CodecPlan *plan) {
+    return plan->entropy_coding ? 1 : 0;
+}
+
+// モードの byte を読んで、本体がレンジ符号かを返す (長さがモードに合わなければ -1)
+// 成功すれば data と size をモードの byte の後ろに進める
+static int entropy_read_mode(const CodecPlan *plan, unsigned char **data, int *size, int raw_bytes) {
+    if (!plan->entropy_coding) return 0;
+    if (*size < 1) return -1;
+    int mode = (*data)[0];
+    (*data)++;
+    (*size)--;
+    if (mode == ENTROPY_MODE_RAW) return (*size == raw_bytes) ? 0 : -1;
+    if (mode == ENTROPY_MODE_RANGE) return (*size < raw_bytes) ? 1 : -1;
+    return -1;
+}
+
+typedef struct {
+    AdaptiveModel models[ENTROPY_MAX_BITS + 1];
+    unsigned char ready[ENTROPY_MAX_BITS + 1];  // このフレームで初期化済みか
+} EntropyState;
+
+static void entropy_reset(EntropyState *es) {
+    memset(es->ready, 0, sizeof(es->ready));
+}
+
+// bits ビットの振幅の記号用モデル (フレーム内で初めて使うときに初期化する)
+static AdaptiveModel *entropy_model(EntropyState *es, int bits) {
+    if (!es->ready[bits]) {
+        model_init(&es->models[bits], 1 << bits);
+        es->ready[bits] = 1;
+    }
+    return &es->models[bits];
+}
+
+// 帯域ごとのビット数 mag_bits で1フレームを符号化し、全体のバイト数を返す
+// 各ビンの振幅と位相を帯域の mag_bits + phase_bits ビットだけでビットストリームに詰める
+// (エントロピー符号化が有効なら振幅を適応モデルでレンジ符号化する)
+// マスキングモデルが有効ならビット数を帯域ごとに ALLOC_BITS ビットの副情報として先頭に置く
+static int psycho_encode(const CodecPlan *plan, const Spectrum *fft_data, const unsigned char *mag_bits,
+                         unsigned char *compressed_data) {
+    const BandConfig *bands = plan->bands;
+    const int last_bin = plan->frame_size/2 - 1;
+    unsigned char q_mag[MAX_SPECTRUM_BINS], q_phase[MAX_SPECTRUM_BINS];
+    _Alignas(CACHE_LINE) float frame_mag_levels[MAX_SPECTRUM_BINS];
+    _Alignas(CACHE_LINE) float frame_phase_levels[MAX_SPECTRUM_BINS];
+    const float *mag_levels = plan->psy_mag_levels, *phase_levels = plan->psy_phase_levels;
+
+    if (plan->masking_model) {
+        BitWriter side;
+        bit_writer_init(&side, compressed_data);
+        for (int band = 0; band < plan->num_bands; band++) {
+            bit_writer_put(&side, mag_bits[band], ALLOC_BITS);
+            for (int bin = bands[band].start_bin; bin <= bands[band].end_bin; bin++) {
+                frame_mag_levels[bin] = (float)((1 << mag_bits[band]) - 1);
+                frame_phase_levels[bin] = (float)((1 << g_phase_bits[mag_bits[band]]) - 1);
+            }
+        }
+        bit_writer_finish(&side);
+        mag_levels = frame_mag_levels;
+        phase_levels = frame_phase_levels;
+    }
+    unsigned char *body = compressed_data + plan->psycho_side_bytes;
+    const int header_bytes = plan->psycho_side_bytes + entropy_mode_bytes(plan);
+
+    // 全ビンの振幅と位相を量子化
+    plan->analyze(plan, fft_data, mag_levels, phase_levels, q_mag, q_phase);
+
+    // レンジ符号化
+    if (plan->entropy_coding) {
+        RangeEncoder rc;
+        EntropyState es;
+        range_encoder_init(&rc, body + 1);
+        entropy_reset(&es);
+        for (int band = 0; band < plan->num_bands; band++) {
+            if (mag_bits[band] == 0) continue;
+            AdaptiveModel *model = entropy_model(&es, mag_bits[band]);
+            for (int bin = bands[band].start_bin; bin <= bands[band].end_bin && bin <= last_bin; bin++) {
+                range_encode_symbol(&rc, model, q_mag[bin]);
+                range_encode_bits(&rc, q_phase[bin], g_phase_bits[mag_bits[band]]);
+            }
+        }
+        int size = range_encoder_finish(&rc);
+        if (size < psycho_raw_bytes(plan, mag_bits)) {
+            body[0] = ENTROPY_MODE_RANGE;
+            return header_bytes + size;
+        }
+        body[0] = ENTROPY_MODE_RAW;
+    }
+
+    // 圧縮データに書き込み
+    BitWriter bw;
+    bit_writer_init(&bw, compressed_data + header_bytes);
+    for (int band = 0; band < plan->num_bands; band++) {
+        if (mag_bits[band] == 0) continue;
+        for (int bin = bands[band].start_bin; bin <= bands[band].end_bin && bin <= last_bin; bin++) {
+            bit_writer_put(&bw, q_mag[bin], mag_bits[band]);
+            bit_writer_put(&bw, q_phase[bin], g_phase_bits[mag_bits[band]]);
+        }
+    }
+    return header_bytes + bit_writer_finish(&bw);
+}
+
+// 心理音響圧縮
+// マスキングモデルが有効ならビット数をフレームごとに決め、無効なら帯域設定の固定のビット数を使う
+void psychoacoustic_compress(const CodecPlan *plan, const Spectrum *fft_data,
+                             unsigned char *compressed_data, int *compressed_size) {
+    unsigned char mag_bits[MAX_BANDS];
+    if (plan->masking_model) {
+        float smr[MAX_BANDS];
+        masking_band_smr(plan, fft_data, smr);
+        masking_bits_from_smr(plan, smr, 0.0f, mag_bits);
+    } else {
+        for (int band = 0; band < plan->num_bands; band++) mag_bits[band] = plan->bands[band].mag_bits;
+    }
+    *compressed_size = psycho_encode(plan, fft_data, mag_bits, compressed_data);
+}
+
+// --- レート制御 ---
+// 目標ビットレートから1フレームあたりの平均の予算を決め、使い残しをビットリザーバに溜める
+// 各フレームは「平均 + 蓄え」(上限は peak_bytes) に収まる最も細かい量子化ステップを二分探索で選ぶ
+// 量子化ステップはマスキング閾値の上げ幅 (RATE_STEP_DB 刻み) で、帯域のビット数は副情報で送られるので
+// 展開側は通常の psychoacoustic_decompress のままでよい
+//
+// 蓄えの上限を peak_bytes - 平均 にしているので、フレームの大きさは peak_bytes を超えず、
+// 任意の区間の合計は「平均 x フレーム数 + 蓄えの上限」を超えない
+// (平均は最も粗いステップのフレーム (副情報とエントロピー符号化のモード) より大きくさせるので、
+// 予算はいつもそのフレームが収まる大きさになり、蓄えは負にならない)
+
+#define RATE_STEP_DB 1.5f   // 量子化ステップ1段あたりのマスキング閾値の上げ幅 (dB)
+#define RATE_MIN_STEP -24   // 最も細かいステップ (-36dB、ほぼ全帯域が上限のビット数になる)
+#define RATE_MAX_STEP 112   // 最も粗いステップ (+168dB、全帯域がマスクされ副情報だけになる)
+
+// 目標ビットレートのレート制御を初期化する (不正な設定なら理由を表示して -1 を返す)
+// overhead_bytes はフレームごとに圧縮データの外に付く分 (長さの欄など)。ビットレートにはこれも含める
+int rate_control_init(RateControl *rc, const CodecPlan *plan, float kbps, int peak_bytes, int overhead_bytes) {
+    if (!plan->masking_model) {
+        fprintf(stderr, "Rate control needs the per-frame masking model\n");
+        return -1;
+    }
+    // 最も粗いステップでも副情報とモードの byte は送る
+    const int min_bytes = plan->psycho_side_bytes + entropy_mode_bytes(plan);
+    double frame_bits = (double)kbps * 1000.0 * plan->frame_size / plan->sample_rate - overhead_bytes * 8.0;
+    if (!(frame_bits > min_bytes * 8.0)) {
+        fprintf(stderr, "Bitrate %.1f kbps is too low (at least %.1f kbps for %d-sample frames)\n", kbps,
+                (min_bytes + overhead_bytes + 1) * 8.0 * plan->sample_rate / plan->frame_size / 1000.0,
+                plan->frame_size);
+        return -1;
+    }
+    rc->frame_bits = frame_bits < plan->max_payload * 8.0 ? (int)frame_bits : plan->max_payload * 8;
+
+    // 上限の既定値は平均の2倍
+    if (peak_bytes <= 0) peak_bytes = 2 * ((rc->frame_bits + 7) / 8);
+    if (peak_bytes > plan->max_payload) peak_bytes = plan->max_payload;
+    if (peak_bytes * 8 < rc->frame_bits) {
+        fprintf(stderr, "Peak frame size %d bytes is below the average frame size %d bytes\n",
+                peak_bytes, (rc->frame_bits + 7) / 8);
+        return -1;
+    }
+    rc->peak_bytes = peak_bytes;
+    rc->reservoir_bits = 0;
+    rc->reservoir_max_bits = peak_bytes * 8 - rc->frame_bits;
+    rc->step = 0;
+    return 0;
+}
+
+// 量子化ステップ step で1フレームを符号化し、バイト数を返す
+static int rate_encode_step(const CodecPlan *plan, const float *smr, const Spectrum *fft_data, int step,
+                            unsigned char *compressed_data) {
+    unsigned char mag_bits[MAX_BANDS];
+    masking_bits_from_smr(plan, smr, step * RATE_STEP_DB, mag_bits);
+    return psycho_encode(plan, fft_data, mag_bits, compressed_data);
+}
+
+// 目標ビットレートに合わせた心理音響圧縮
+void psychoacoustic_compress_rate(const CodecPlan *plan, RateControl *rc, const Spectrum *fft_data,
+                                  unsigned char *compressed_data, int *compressed_size) {
+    float smr[MAX_BANDS];
+    masking_band_smr(plan, fft_data, smr);
+
+    // このフレームの予算
+    int budget_bits = rc->frame_bits + rc->reservoir_bits;
+    if (budget_bits > rc->peak_bytes * 8) budget_bits = rc->peak_bytes * 8;
+    const int budget = budget_bits / 8;
+
+    // 予算に収まる最も細かいステップを探す (ステップを粗くするほどサイズは小さくなる)
+    // 隣り合うフレームのステップは近いので、直前のステップから幅を倍々に広げて範囲を挟み、その中を二分探索する
+    // 最も粗いステップは副情報だけなので、予算が足りないときもこれで送る
+    int lo, hi;  // 答えは [lo, hi] にある (hi は収まることを確認済み、または RATE_MAX_STEP)
+    int encoded_step = rc->step;  // 最後に compressed_data に書いたステップ
+    int size = rate_encode_step(plan, smr, fft_data, encoded_step, compressed_data);
+    if (size <= budget) {
+        lo = hi = encoded_step;
+        for (int width = 1; lo > RATE_MIN_STEP; width *= 2) {
+            int next = hi - width > RATE_MIN_STEP ? hi - width : RATE_MIN_STEP;
+            size = rate_encode_step(plan, smr, fft_data, next, compressed_data);
+            encoded_step = next;
+            if (size > budget) {
+                lo = next + 1;
+                break;
+            }
+            lo = hi = next;
+        }
+    } else {
+        lo = encoded_step + 1;
+        hi = RATE_MAX_STEP;
+        for (int width = 1; lo < RATE_MAX_STEP; width *= 2) {
+            int next = lo + width < RATE_MAX_STEP ? lo + width : RATE_MAX_STEP;
+            size = rate_encode_step(plan, smr, fft_data, next, compressed_data);
+            encoded_step = next;
+            if (size <= budget) {
+                hi = next;
+                break;
+            }
+            lo = next + 1;
+        }
+        if (lo > hi) lo = hi;
+    }
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        size = rate_encode_step(plan, smr, fft_data, mid, compressed_data);
+        encoded_step = mid;
+        if (size <= budget) hi = mid;
+        else lo = mid + 1;
+    }
+    if (encoded_step != lo) size = rate_encode_step(plan, smr, fft_data, lo, compressed_data);
+
+    // 使い残しを蓄える (予算を超えたフレームの分は次のフレームから差し引く)
+    rc->step = lo;
+    rc->reservoir_bits += rc->frame_bits - size * 8;
+    if (rc->reservoir_bits > rc->reservoir_max_bits) rc->reservoir_bits = rc->reservoir_max_bits;
+    if (rc->reservoir_bits < 0) rc->reservoir_bits = 0;
+    *compressed_size = size;
+}
+
+// 心理音響展開
+// compressed_data の後ろには BITSTREAM_PADDING byte の読み出し可能な余白が必要
+// 副情報が欠けているか、長さがエントロピー符号化のモードに合わなければ無音にして -1 を返す
+int psychoacoustic_decompress(const CodecPlan *plan, unsigned char *compressed_data,
+                              Spectrum *fft_data, int compressed_size) {
+    const BandConfig *bands = plan->bands;
+    unsigned char mag_bits[MAX_BANDS];
+
+    // FFTバッファを初期化 (使うビンのみ)
+    memset(fft_data->re, 0, plan->spectrum_bins * sizeof(float));
+    memset(fft_data->im, 0, plan->spectrum_bins * sizeof(float));
+
+    // 帯域ごとのビット数
+    if (plan->masking_model) {
+        if (compressed_size < plan->psycho_side_bytes) return -1;
+        BitReader side;
+        bit_reader_init(&side, compressed_data, plan->psycho_side_bytes);
+        for (int band = 0; band < plan->num_bands; band++) mag_bits[band] = bit_reader_get(&side, ALLOC_BITS);
+        compressed_data += plan->psycho_side_bytes;
+        compressed_size -= plan->psycho_side_bytes;
+    } else {
+        for (int band = 0; band < plan->num_bands; band++) mag_bits[band] = bands[band].mag_bits;
+    }
+
+    const int ranged = entropy_read_mode(plan, &compressed_data, &compressed_size, psycho_raw_bytes(plan, mag_bits));
+    if (ranged < 0) return -1;
+    BitReader br;
+    RangeDecoder rc;
+    EntropyState es;
+    bit_reader_init(&br, compressed_data, compressed_size);
+    range_decoder_init(&rc, compressed_data, compressed_size);
+    entropy_reset(&es);
+    
+    for (int band = 0; band < plan->num_bands; band++) {
+        int bits = mag_bits[band], phase_bits = g_phase_bits[bits];
+        int end = bands[band].end_bin < plan->frame_size/2 - 1 ? bands[band].end_bin : plan->frame_size/2 - 1;
+        if (bits == 0) continue;
+
+        // データが途中で切れていれば読める分だけ復元する
+        // (レンジ符号は途中で切れたかを判定できないので全ビンを復号する)
+        if (!ranged) {
+            int available = bit_reader_remaining(&br) / (bits + phase_bits);
+            if (end - bands[band].start_bin + 1 > available) end = bands[band].start_bin + available - 1;
+        }
+        AdaptiveModel *model = ranged ? entropy_model(&es, bits) : NULL;
+
+        // 逆量子化は表を引くだけ
+        const float *mag_lut = plan->psy_mag_lut[band] + (1 << bits);
+        const float *cos_lut = plan->psy_cos_lut + (1 << phase_bits);
+        const float *sin_lut = plan->psy_sin_lut + (1 << phase_bits);
+
+        for (int bin = bands[band].start_bin; bin <= end; bin++) {
+            // 圧縮データから読み取り
+            unsigned char q_mag, q_phase;
+            if (ranged) {
+                q_mag = range_decode_symbol(&rc, model);
+                q_phase = range_decode_bits(&rc, phase_bits);
+            } else {
+                q_mag = bit_reader_get(&br, bits);
+                q_phase = bit_reader_get(&br, phase_bits);
+            }
+            
+            // 複素数に変換
+            float magnitude = mag_lut[q_mag];
+            fft_data->re[bin] = magnitude * cos_lut[q_phase];
+            fft_data->im[bin] = magnitude * sin_lut[q_phase];
+        }
+    }
+    return 0;
+}
+
+// --- FFT / IFFT 実装 ---
+
+// 回転因子表とビット反転表を計算する (フレーム長の検査は codec_plan_init で済んでいること)
+static void init_fft_tables(CodecPlan *plan) {
+    const int N = plan->frame_size;
+
+    for (int k = 0; k < N; k++) {
+        double angle = -2.0 * PI * k / N;
+        plan->twiddle_re[k] = (float)cos(angle);
+        plan->twiddle_im[k] = (float)sin(angle);
+    }
+
+    // 以下は2のべき乗のフレーム長でのみ使う
+    plan->fft_log2 = -1;
+    if ((N & (N - 1)) != 0) return;
+    plan->fft_log2 = __builtin_ctz(N);
+
+    // SIMDカーネルが連続ロードできるように段ごとの回転因子を詰めて持つ
+    for (int half = 1; half < N; half <<= 1) {
+        int stride = N / (2 * half);
+        for (int k = 0; k < half; k++) {
+            plan->stage_twiddle_re[half + k] = plan->twiddle_re[k * stride];
+            plan->stage_twiddle_im[half + k] = plan->twiddle_im[k * stride];
+        }
+    }
+
+    for (int i = 0; i < N; i++) {
+        int r = 0;
+        for (int b = 0; b < plan->fft_log2; b++) {
+            if (i & (1 << b)) r |= 1 << (plan->fft_log2 - 1 - b);
+        }
+        plan->bitrev[i] = r;
+    }
+}
+
+// --- バタフライ演算カーネル ---
+// 半長 half の基数2段を N 点全体に適用する (wr, wi は段の回転因子)
+// 基数4の段は半長 half と 2*half の基数2段を続けて行う。4点ずつ読んで2段分を計算してから書くので、
+// 配列を読み書きする回数が半分になる (wr, wi は半長 half の段の回転因子で、その後ろに次の段の回転因子が続く)
+// 2段目の回転因子も -i 倍で作らずに表から読み、基数2のカーネルと同じ順で複素乗算する
+// (scalar/sse2 の結果は基数2段を2回行ったものとビット単位で同じ。AVX2以上では半長8の段を
+//  半長4の段と一緒に SSE2 のカーネルで行うので、その段だけ FMA を使わない丸めになる)
+// 起動時に CPUID で最適な命令セットを選び、段ごとにレーン数が half 以下のカーネルを使う
+
+typedef void (*ButterflyStageFunc)(float *re, float *im, int N, int half,
+                                   const float *wr, const float *wi);
+
+// 各カーネルは特殊化版 FFT に展開されるよう always_inline にしている (表からはアドレスで呼ぶ)
+
+// スカラー版 (全環境で動作し、正しさの基準となる)
+__attribute__((always_inline))
+static inline void butterfly_stage_scalar(float *re, float *im, int N, int half,
+                                          const float *wr, const float *wi) {
+    for (int start = 0; start < N; start += 2 * half) {
+        float *ar = re + start, *ai = im + start;
+        float *br = ar + half, *bi = ai + half;
+        for (int k = 0; k < half; k++) {
+            float tr = wr[k] * br[k] - wi[k] * bi[k];
+            float ti = wr[k] * bi[k] + wi[k] * br[k];
+            br[k] = ar[k] - tr;
+            bi[k] = ai[k] - ti;
+            ar[k] = ar[k] + tr;
+            ai[k] = ai[k] + ti;
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// SSE2版: 1レジスタに4ビン
+__attribute__((target("sse2"), always_inline))
+static inline void butterfly_stage_sse2(float *re, float *im, int N, int half,
+                                        const float *wr, const float *wi) {
+    for (int start = 0; start < N; start += 2 * half) {
+        float *ar = re + start, *ai = im + start;
+        float *br = ar + half, *bi = ai + half;
+        for (int k = 0; k < half; k += 4) {
+            __m128 vwr = _mm_loadu_ps(wr + k), vwi = _mm_loadu_ps(wi + k);
+            __m128 vbr = _mm_loadu_ps(br + k), vbi = _mm_loadu_ps(bi + k);
+            __m128 var = _mm_loadu_ps(ar + k), vai = _mm_loadu_ps(ai + k);
+            __m128 tr = _mm_sub_ps(_mm_mul_ps(vwr, vbr), _mm_mul_ps(vwi, vbi));
+            __m128 ti = _mm_add_ps(_mm_mul_ps(vwr, vbi), _mm_mul_ps(vwi, vbr));
+            _mm_storeu_ps(br + k, _mm_sub_ps(var, tr));
+            _mm_storeu_ps(bi + k, _mm_sub_ps(vai, ti));
+            _mm_storeu_ps(ar + k, _mm_add_ps(var, tr));
+            _mm_storeu_ps(ai + k, _mm_add_ps(vai, ti));
+        }
+    }
+}
+
+// AVX2版: 1レジスタに8ビン (FMAで複素乗算)
+__attribute__((target("avx2,fma"), always_inline))
+static inline void butterfly_stage_avx2(float *re, float *im, int N, int half,
+                                        const float *wr, const float *wi) {
+    for (int start = 0; start < N; start += 2 * half) {
+        float *ar = re + start, *ai = im + start;
+        float *br = ar + half, *bi = ai + half;
+        for (int k = 0; k < half; k += 8) {
+            __m256 vwr = _mm256_loadu_ps(wr + k), vwi = _mm256_loadu_ps(wi + k);
+            __m256 vbr = _mm256_loadu_ps(br + k), vbi = _mm256_loadu_ps(bi + k);
+            __m256 var = _mm256_loadu_ps(ar + k), vai = _mm256_loadu_ps(ai + k);
+            __m256 tr = _mm256_fmsub_ps(vwr, vbr, _mm256_mul_ps(vwi, vbi));
+            __m256 ti = _mm256_fmadd_ps(vwr, vbi, _mm256_mul_ps(vwi, vbr));
+            _mm256_storeu_ps(br + k, _mm256_sub_ps(var, tr));
+            _mm256_storeu_ps(bi + k, _mm256_sub_ps(vai, ti));
+            _mm256_storeu_ps(ar + k, _mm256_add_ps(var, tr));
+            _mm256_storeu_ps(ai + k, _mm256_add_ps(vai, ti));
+        }
+    }
+}
+
+// AVX-512版: 1レジスタに16ビン
+__attribute__((target("avx512f"), always_inline))
+static inline void butterfly_stage_avx512(float *re, float *im, int N, int half,
+                                          const float *wr, const float *wi) {
+    for (int start = 0; start < N; start += 2 * half) {
+        float *ar = re + start, *ai = im + start;
+        float *br = ar + half, *bi = ai + half;
+        for (int k = 0; k < half; k += 16) {
+            __m512 vwr = _mm512_loadu_ps(wr + k), vwi = _mm512_loadu_ps(wi + k);
+            __m512 vbr = _mm512_loadu_ps(br + k), vbi = _mm512_loadu_ps(bi + k);
+            __m512 var = _mm512_loadu_ps(ar + k), vai = _mm512_loadu_ps(ai + k);
+            __m512 tr = _mm512_fmsub_ps(vwr, vbr, _mm512_mul_ps(vwi, vbi));
+            __m512 ti = _mm512_fmadd_ps(vwr, vbi, _mm512_mul_ps(vwi, vbr));
+            _mm512_storeu_ps(br + k, _mm512_sub_ps(var, tr));
+            _mm512_storeu_ps(bi + k, _mm512_sub_ps(vai, ti));
+            _mm512_storeu_ps(ar + k, _mm512_add_ps(var, tr));
+            _mm512_storeu_ps(ai + k, _mm512_add_ps(vai, ti));
+        }
+    }
+}
+#endif
+
+// 基数4の段 (スカラー版)
+__attribute__((always_inline))
+static inline void radix4_stage_scalar(float *re, float *im, int N, int half,
+                                       const float *wr, const float *wi) {
+    const float *w2r = wr + half, *w2i = wi + half;   // 半長 2*half の段の回転因子 (前半)
+    const float *w3r = w2r + half, *w3i = w2i + half; // 同 (後半)
+    for (int start = 0; start < N; start += 4 * half) {
+        float *r0 = re + start, *i0 = im + start;
+        float *r1 = r0 + half, *i1 = i0 + half;
+        float *r2 = r1 + half, *i2 = i1 + half;
+        float *r3 = r2 + half, *i3 = i2 + half;
+        for (int k = 0; k < half; k++) {
+            // 1段目: (0, 1) と (2, 3)
+            float t1r = wr[k] * r1[k] - wi[k] * i1[k], t1i = wr[k] * i1[k] + wi[k] * r1[k];
+            float t3r = wr[k] * r3[k] - wi[k] * i3[k], t3i = wr[k] * i3[k] + wi[k] * r3[k];
+            float y0r = r0[k] + t1r, y0i = i0[k] + t1i, y1r = r0[k] - t1r, y1i = i0[k] - t1i;
+            float y2r = r2[k] + t3r, y2i = i2[k] + t3i, y3r = r2[k] - t3r, y3i = i2[k] - t3i;
+            // 2段目: (0, 2) と (1, 3)
+            float t2r = w2r[k] * y2r - w2i[k] * y2i, t2i = w2r[k] * y2i + w2i[k] * y2r;
+            float u3r = w3r[k] * y3r - w3i[k] * y3i, u3i = w3r[k] * y3i + w3i[k] * y3r;
+            r0[k] = y0r + t2r; i0[k] = y0i + t2i;
+            r2[k] = y0r - t2r; i2[k] = y0i - t2i;
+            r1[k] = y1r + u3r; i1[k] = y1i + u3i;
+            r3[k] = y1r - u3r; i3[k] = y1i - u3i;
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// 基数4の段の SIMD 版は、命令セットごとの複素乗算 CMUL だけを差し替えて同じ本体を使う
+#define RADIX4_STAGE_BODY(VEC, LANES, LOAD, STORE, ADD, SUB, CMUL)                        \
+    const float *w2r = wr + half, *w2i = wi + half;                                       \
+    const float *w3r = w2r + half, *w3i = w2i + half;                                     \
+    for (int start = 0; start < N; start += 4 * half) {                                   \
+        float *r0 = re + start, *i0 = im + start;                                         \
+        float *r1 = r0 + half, *i1 = i0 + half;                                           \
+        float *r2 = r1 + half, *i2 = i1 + half;                                           \
+        float *r3 = r2 + half, *i3 = i2 + half;                                           \
+        for (int k = 0; k < half; k += LANES) {                                           \
+            VEC vwr = LOAD(wr + k), vwi = LOAD(wi + k);                                   \
+            VEC t1r, t1i, t3r, t3i, t2r, t2i, u3r, u3i;                                   \
+            CMUL(vwr, vwi, LOAD(r1 + k), LOAD(i1 + k), t1r, t1i);                         \
+            CMUL(vwr, vwi, LOAD(r3 + k), LOAD(i3 + k), t3r, t3i);                         \
+            VEC x0r = LOAD(r0 + k), x0i = LOAD(i0 + k), x2r = LOAD(r2 + k), x2i = LOAD(i2 + k); \
+            VEC y0r = ADD(x0r, t1r), y0i = ADD(x0i, t1i), y1r = SUB(x0r, t1r), y1i = SUB(x0i, t1i); \
+            VEC y2r = ADD(x2r, t3r), y2i = ADD(x2i, t3i), y3r = SUB(x2r, t3r), y3i = SUB(x2i, t3i); \
+            CMUL(LOAD(w2r + k), LOAD(w2i + k), y2r, y2i, t2r, t2i);                       \
+            CMUL(LOAD(w3r + k), LOAD(w3i + k), y3r, y3i, u3r, u3i);                       \
+            STORE(r0 + k, ADD(y0r, t2r)); STORE(i0 + k, ADD(y0i, t2i));                   \
+            STORE(r2 + k, SUB(y0r, t2r)); STORE(i2 + k, SUB(y0i, t2i));                   \
+            STORE(r1 + k, ADD(y1r, u3r)); STORE(i1 + k, ADD(y1i, u3i));                   \
+            STORE(r3 + k, SUB(y1r, u3r)); STORE(i3 + k, SUB(y1i, u3i));                   \
+        }                                                                                 \
+    }
+
+// (tr, ti) = (wr + i wi)(br + i bi)
+#define CMUL_SSE2(vwr, vwi, vbr, vbi, tr, ti) do {                                        \
+        __m128 br_ = (vbr), bi_ = (vbi);                                                  \
+        tr = _mm_sub_ps(_mm_mul_ps(vwr, br_), _mm_mul_ps(vwi, bi_));                      \
+        ti = _mm_add_ps(_mm_mul_ps(vwr, bi_), _mm_mul_ps(vwi, br_));                      \
+    } while (0)
+#define CMUL_AVX2(vwr, vwi, vbr, vbi, tr, ti) do {                                        \
+        __m256 br_ = (vbr), bi_ = (vbi);                                                  \
+        tr = _mm256_fmsub_ps(vwr, br_, _mm256_mul_ps(vwi, bi_));                          \
+        ti = _mm256_fmadd_ps(vwr, bi_, _mm256_mul_ps(vwi, br_));                          \
+    } while (0)
+#define CMUL_AVX512(vwr, vwi, vbr, vbi, tr, ti) do {                                      \
+        __m512 br_ = (vbr), bi_ = (vbi);                                                  \
+        tr = _mm512_fmsub_ps(vwr, br_, _mm512_mul_ps(vwi, bi_));                          \
+        ti = _mm512_fmadd_ps(vwr, bi_, _mm512_mul_ps(vwi, br_));                          \
+    } while (0)
+
+__attribute__((target("sse2"), always_inline))
+static inline void radix4_stage_sse2(float *re, float *im, int N, int half,
+                                     const float *wr, const float *wi) {
+    RADIX4_STAGE_BODY(__m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_add_ps, _mm_sub_ps, CMUL_SSE2)
+}
+
+__attribute__((target("avx2,fma"), always_inline))
+static inline void radix4_stage_avx2(float *re, float *im, int N, int half,
+                                     const float *wr, const float *wi) {
+    RADIX4_STAGE_BODY(__m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps, _mm256_sub_ps, CMUL_AVX2)
+}
+
+__attribute__((target("avx512f"), always_inline))
+static inline void radix4_stage_avx512(float *re, float *im, int N, int half,
+                                       const float *wr, const float *wi) {
+    RADIX4_STAGE_BODY(__m512, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_add_ps, _mm512_sub_ps, CMUL_AVX512)
+}
+#endif
+
+// 命令セットごとのカーネル (レーン数の昇順)
+typedef struct {
+    const char *name;
+    int lanes;
+    ButterflyStageFunc stage;    // 基数2の段
+    ButterflyStageFunc radix4;   // 基数4の段 (基数2の2段分)
+} ButterflyKernel;
+
+static const ButterflyKernel g_butterfly_kernels[] = {
+    {"scalar", 1, butterfly_stage_scalar, radix4_stage_scalar},
+#ifdef HAVE_X86_SIMD
+    {"sse2", 4, butterfly_stage_sse2, radix4_stage_sse2},
+    {"avx2", 8, butterfly_stage_avx2, radix4_stage_avx2},
+    {"avx512", 16, butterfly_stage_avx512, radix4_stage_avx512},
+#endif
+};
+
+// CPU が対応する最良の命令セットの番号
+static int detect_isa_level(void) {
+    int max_level = 0;
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    max_level = 1;  // x86-64 では SSE2 は常に使える
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) max_level = 2;
+    if (max_level == 2 && __builtin_cpu_supports("avx512f")) max_level = 3;
+#endif
+    return max_level;
+}
+
+// 命令セットの名前から番号を求める (isa_name が NULL なら CPU が対応する最良のもの)
+// 知らない名前か CPU が対応していなければ理由を表示して -1 を返す
+// (スカラー版との比較や試験で、別のカーネルに黙って置き換わらないように)
+int codec_isa_level(const char *isa_name) {
+    const int num_kernels = (int)(sizeof(g_butterfly_kernels) / sizeof(g_butterfly_kernels[0]));
+    int max_level = detect_isa_level();
+    if (isa_name == NULL) return max_level;
+
+    int level = -1;
+    for (int i = 0; i < num_kernels; i++) {
+        if (strcmp(isa_name, g_butterfly_kernels[i].name) == 0) level = i;
+    }
+    if (level < 0) {
+        fprintf(stderr, "Unknown FFT kernel '%s' (this build has:", isa_name);
+        for (int i = 0; i < num_kernels; i++) fprintf(stderr, " %s", g_butterfly_kernels[i].name);
+        fprintf(stderr, ")\n");
+        return -1;
+    }
+    if (level > max_level) {
+        fprintf(stderr, "FFT kernel %s is not supported by this CPU (best available: %s)\n",
+                isa_name, g_butterfly_kernels[max_level].name);
+        return -1;
+    }
+    return level;
+}
+
+// 命令セットを選択する (選べなければ -1)
+static int select_fft_kernels(CodecPlan *plan, const char *isa_name) {
+    plan->isa_level = codec_isa_level(isa_name);
+    if (plan->isa_level < 0) return -1;
+    plan->isa_name = g_butterfly_kernels[plan->isa_level].name;
+    return 0;
+}
+
+// --- 混合基数 FFT (基数 2/3/4/5) ---
+// N/2 が2のべき乗でないフレーム長 (160, 320, 480, 960 など) で使う
+// 自動整列型 (Stockham) の構成で、段ごとに作業領域と入出力を入れ替える
+// 部分問題 c の要素 i は A[i*l + c] に置かれ、最内ループは c について連続なのでベクトル化される
+// 作業領域は呼び出しごとにスタックに取る (同じプランを複数のスレッドから使えるように)
+
+// 基数2の段: l 個の部分問題 (長さ 2*m) を 2l 個 (長さ m) に分ける
+static void mixed_radix_pass2(const CodecPlan *plan, int l, int m, int tw_step,
+                              const float *restrict ar, const float *restrict ai,
+                              float *restrict br, float *restrict bi) {
+    for (int n1 = 0; n1 < m; n1++) {
+        float w1r = plan->twiddle_re[n1 * tw_step], w1i = plan->twiddle_im[n1 * tw_step];
+        const float *a0r = ar + n1 * l, *a0i = ai + n1 * l;
+        const float *a1r = a0r + m * l, *a1i = a0i + m * l;
+        float *b0r = br + n1 * l * 2, *b0i = bi + n1 * l * 2;
+        float *b1r = b0r + l, *b1i = b0i + l;
+        for (int c = 0; c < l; c++) {
+            float dr = a0r[c] - a1r[c], di = a0i[c] - a1i[c];
+            b0r[c] = a0r[c] + a1r[c];
+            b0i[c] = a0i[c] + a1i[c];
+            b1r[c] = dr * w1r - di * w1i;
+            b1i[c] = dr * w1i + di * w1r;
+        }
+    }
+}
+
+// 基数3の段
+static void mixed_radix_pass3(const CodecPlan *plan, int l, int m, int tw_step,
+                              const float *restrict ar, const float *restrict ai,
+                              float *restrict br, float *restrict bi) {
+    const float s3 = 0.86602540378443864676f;  // sin(2π/3)
+    for (int n1 = 0; n1 < m; n1++) {
+        float w1r = plan->twiddle_re[n1 * tw_step],     w1i = plan->twiddle_im[n1 * tw_step];
+        float w2r = plan->twiddle_re[2 * n1 * tw_step], w2i = plan->twiddle_im[2 * n1 * tw_step];
+        const float *a0r = ar + n1 * l, *a0i = ai + n1 * l;
+        const float *a1r = a0r + m * l, *a1i = a0i + m * l;
+        const float *a2r = a1r + m * l, *a2i = a1i + m * l;
+        float *b0r = br + n1 * l * 3, *b0i = bi + n1 * l * 3;
+        float *b1r = b0r + l, *b1i = b0i + l;
+        float *b2r = b1r + l, *b2i = b1i + l;
+        for (int c = 0; c < l; c++) {
+            float t1r = a1r[c] + a2r[c], t1i = a1i[c] + a2i[c];
+            float t2r = a0r[c] - 0.5f * t1r, t2i = a0i[c] - 0.5f * t1i;
+            float t3r = s3 * (a1i[c] - a2i[c]), t3i = -s3 * (a1r[c] - a2r[c]);  // -i sin(2π/3) (a1 - a2)
+            float y1r = t2r + t3r, y1i = t2i + t3i;
+            float y2r = t2r - t3r, y2i = t2i - t3i;
+            b0r[c] = a0r[c] + t1r;
+            b0i[c] = a0i[c] + t1i;
+            b1r[c] = y1r * w1r - y1i * w1i;
+            b1i[c] = y1r * w1i + y1i * w1r;
+            b2r[c] = y2r * w2r - y2i * w2i;
+            b2i[c] = y2r * w2i + y2i * w2r;
+        }
+    }
+}
+
+// 基数4の段
+static void mixed_radix_pass4(const CodecPlan *plan, int l, int m, int tw_step,
+                              const float *restrict ar, const float *restrict ai,
+                              float *restrict br, float *restrict bi) {
+    for (int n1 = 0; n1 < m; n1++) {
+        float w1r = plan->twiddle_re[n1 * tw_step],     w1i = plan->twiddle_im[n1 * tw_step];
+        float w2r = plan->twiddle_re[2 * n1 * tw_step], w2i = plan->twiddle_im[2 * n1 * tw_step];
+        float w3r = plan->twiddle_re[3 * n1 * tw_step], w3i = plan->twiddle_im[3 * n1 * tw_step];
+        const float *a0r = ar + n1 * l, *a0i = ai + n1 * l;
+        const float *a1r = a0r + m * l, *a1i = a0i + m * l;
+        const float *a2r = a1r + m * l, *a2i = a1i + m * l;
+        const float *a3r = a2r + m * l, *a3i = a2i + m * l;
+        float *b0r = br + n1 * l * 4, *b0i = bi + n1 * l * 4;
+        float *b1r = b0r + l, *b1i = b0i + l;
+        float *b2r = b1r + l, *b2i = b1i + l;
+        float *b3r = b2r + l, *b3i = b2i + l;
+        for (int c = 0; c < l; c++) {
+            float s0r = a0r[c] + a2r[c], s0i = a0i[c] + a2i[c];
+            float d0r = a0r[c] - a2r[c], d0i = a0i[c] - a2i[c];
+            float s1r = a1r[c] + a3r[c], s1i = a1i[c] + a3i[c];
+            float d1r = a1r[c] - a3r[c], d1i = a1i[c] - a3i[c];
+            float y1r = d0r + d1i, y1i = d0i - d1r;  // d0 - i d1
+            float y2r = s0r - s1r, y2i = s0i - s1i;
+            float y3r = d0r - d1i, y3i = d0i + d1r;  // d0 + i d1
+            b0r[c] = s0r + s1r;
+            b0i[c] = s0i + s1i;
+            b1r[c] = y1r * w1r - y1i * w1i;
+            b1i[c] = y1r * w1i + y1i * w1r;
+            b2r[c] = y2r * w2r - y2i * w2i;
+            b2i[c] = y2r * w2i + y2i * w2r;
+            b3r[c] = y3r * w3r - y3i * w3i;
+            b3i[c] = y3r * w3i + y3i * w3r;
+        }
+    }
+}
+
+// 基数5の段
+static void mixed_radix_pass5(const CodecPlan *plan, int l, int m, int tw_step,
+                              const float *restrict ar, const float *restrict ai,
+                              float *restrict br, float *restrict bi) {
+    const float c1 = 0.30901699437494742410f;   // cos(2π/5)
+    const float c2 = -0.80901699437494742410f;  // cos(4π/5)
+    const float s1 = 0.95105651629515357212f;   // sin(2π/5)
+    const float s2 = 0.58778525229247312917f;   // sin(4π/5)
+    for (int n1 = 0; n1 < m; n1++) {
+        float w1r = plan->twiddle_re[n1 * tw_step],     w1i = plan->twiddle_im[n1 * tw_step];
+        float w2r = plan->twiddle_re[2 * n1 * tw_step], w2i = plan->twiddle_im[2 * n1 * tw_step];
+        float w3r = plan->twiddle_re[3 * n1 * tw_step], w3i = plan->twiddle_im[3 * n1 * tw_step];
+        float w4r = plan->twiddle_re[4 * n1 * tw_step], w4i = plan->twiddle_im[4 * n1 * tw_step];
+        const float *a0r = ar + n1 * l, *a0i = ai + n1 * l;
+        const float *a1r = a0r + m * l, *a1i = a0i + m * l;
+        const float *a2r = a1r + m * l, *a2i = a1i + m * l;
+        const float *a3r = a2r + m * l, *a3i = a2i + m * l;
+        const float *a4r = a3r + m * l, *a4i = a3i + m * l;
+        float *b0r = br + n1 * l * 5, *b0i = bi + n1 * l * 5;
+        float *b1r = b0r + l, *b1i = b0i + l;
+        float *b2r = b1r + l, *b2i = b1i + l;
+        float *b3r = b2r + l, *b3i = b2i + l;
+        float *b4r = b3r + l, *b4i = b3i + l;
+        for (int c = 0; c < l; c++) {
+            float t1r = a1r[c] + a4r[c], t1i = a1i[c] + a4i[c];
+            float t2r = a2r[c] + a3r[c], t2i = a2i[c] + a3i[c];
+            float t3r = a1r[c] - a4r[c], t3i = a1i[c] - a4i[c];
+            float t4r = a2r[c] - a3r[c], t4i = a2i[c] - a3i[c];
+            float p1r = a0r[c] + c1 * t1r + c2 * t2r, p1i = a0i[c] + c1 * t1i + c2 * t2i;
+            float p2r = a0r[c] + c2 * t1r + c1 * t2r, p2i = a0i[c] + c2 * t1i + c1 * t2i;
+            // e1 = -i (s1 t3 + s2 t4), e2 = -i (s2 t3 - s1 t4)
+            float e1r = s1 * t3i + s2 * t4i, e1i = -(s1 * t3r + s2 * t4r);
+            float e2r = s2 * t3i - s1 * t4i, e2i = -(s2 * t3r - s1 * t4r);
+            float y1r = p1r + e1r, y1i = p1i + e1i;
+            float y4r = p1r - e1r, y4i = p1i - e1i;
+            float y2r = p2r + e2r, y2i = p2i + e2i;
+            float y3r = p2r - e2r, y3i = p2i - e2i;
+            b0r[c] = a0r[c] + t1r + t2r;
+            b0i[c] = a0i[c] + t1i + t2i;
+            b1r[c] = y1r * w1r - y1i * w1i;
+            b1i[c] = y1r * w1i + y1i * w1r;
+            b2r[c] = y2r * w2r - y2i * w2i;
+            b2i[c] = y2r * w2i + y2i * w2r;
+            b3r[c] = y3r * w3r - y3i * w3i;
+            b3i[c] = y3r * w3i + y3i * w3r;
+            b4r[c] = y4r * w4r - y4i * w4i;
+            b4i[c] = y4r * w4i + y4i * w4r;
+        }
+    }
+}
+
+// 混合基数 FFT 本体 (N はフレームサイズを割り切り、2, 3, 5 のみを素因数に持つこと)
+static void fft_mixed_radix(const CodecPlan *plan, float *re, float *im, int N) {
+    _Alignas(CACHE_LINE) float work_re[MAX_FRAME_SIZE];
+    _Alignas(CACHE_LINE) float work_im[MAX_FRAME_SIZE];
+    float *src_re = re, *src_im = im;
+    float *dst_re = work_re, *dst_im = work_im;
+    int l = 1;  // 部分問題の数 (処理済みの基数の積)
+    int m = N;  // 部分問題の長さ
+
+    while (m > 1) {
+        int p = (m % 4 == 0) ? 4 : (m % 2 == 0) ? 2 : (m % 3 == 0) ? 3 : 5;
+        int tw_step = plan->frame_size / m;  // W_m = W_F^(F/m), F = フレームサイズ
+        switch (p) {
+        case 2: mixed_radix_pass2(plan, l, m / 2, tw_step, src_re, src_im, dst_re, dst_im); break;
+        case 3: mixed_radix_pass3(plan, l, m / 3, tw_step, src_re, src_im, dst_re, dst_im); break;
+        case 4: mixed_radix_pass4(plan, l, m / 4, tw_step, src_re, src_im, dst_re, dst_im); break;
+        default: mixed_radix_pass5(plan, l, m / 5, tw_step, src_re, src_im, dst_re, dst_im); break;
+        }
+
+        float *tmp_re = src_re, *tmp_im = src_im;
+        src_re = dst_re; src_im = dst_im;
+        dst_re = tmp_re; dst_im = tmp_im;
+        l *= p;
+        m /= p;
+    }
+
+    // 結果が作業領域側に残った場合は書き戻す
+    if (src_re != re) {
+        memcpy(re, src_re, N * sizeof(float));
+        memcpy(im, src_im, N * sizeof(float));
+    }
+}
+
+// 2のべき乗長の反復型 FFT の前半 (ビット反転と最初の2段、N はフレームサイズを割り切る4以上の長さ)
+// 特殊化版では N が定数になり、ループの回数が確定する
+__attribute__((always_inline))
+static inline void fft_pow2_first_stages(const CodecPlan *plan, float *re, float *im, int N) {
+    int shift = plan->fft_log2 - __builtin_ctz(N);
+
+    // ビット反転順に並べ替え
+    for (int i = 0; i < N; i++) {
+        int j = plan->bitrev[i] >> shift;
+        if (i < j) {
+            float tr = re[i], ti = im[i];
+            re[i] = re[j]; im[i] = im[j];
+            re[j] = tr;    im[j] = ti;
+        }
+    }
+
+    // 最初の2段は回転因子が ±1, -i のみなので基数4で乗算なしに処理する
+    for (int i = 0; i < N; i += 4) {
+        float s0r = re[i] + re[i+1],   s0i = im[i] + im[i+1];
+        float d0r = re[i] - re[i+1],   d0i = im[i] - im[i+1];
+        float s1r = re[i+2] + re[i+3], s1i = im[i+2] + im[i+3];
+        float d1r = re[i+2] - re[i+3], d1i = im[i+2] - im[i+3];
+        re[i]   = s0r + s1r; im[i]   = s0i + s1i;
+        re[i+2] = s0r - s1r; im[i+2] = s0i - s1i;
+        re[i+1] = d0r + d1i; im[i+1] = d0i - d1r;  // d0 + (-i)d1
+        re[i+3] = d0r - d1i; im[i+3] = d0i + d1r;  // d0 - (-i)d1
+    }
+}
+
+// 2のべき乗長の FFT (汎用版: 段ごとに表からカーネルを選ぶ)
+static void fft_pow2(const CodecPlan *plan, float *re, float *im, int N) {
+    if (N == 2) {
+        float ar = re[0], ai = im[0];
+        re[0] = ar + re[1]; im[0] = ai + im[1];
+        re[1] = ar - re[1]; im[1] = ai - im[1];
+        return;
+    }
+
+    fft_pow2_first_stages(plan, re, im, N);
+
+    // 残りの段は選択されたSIMDカーネルで処理 (レーン数が半長を超えない範囲で最大のもの)
+    // 2段ずつ基数4で進め、段数が奇数なら最後の1段だけ基数2で行う
+    for (int half = 4; half < N; half *= (half * 4 <= N) ? 4 : 2) {
+        int level = plan->isa_level;
+        while (g_butterfly_kernels[level].lanes > half) level--;
+        const ButterflyKernel *kernel = &g_butterfly_kernels[level];
+        (half * 4 <= N ? kernel->radix4 : kernel->stage)(re, im, N, half, &plan->stage_twiddle_re[half],
+                                                         &plan->stage_twiddle_im[half]);
+    }
+}
+
+// 任意長の汎用 FFT
+// N が2のべき乗なら反復型の基数2 (SIMDカーネル)、それ以外は混合基数で処理する
+static void fft_generic(const CodecPlan *plan, float *re, float *im, int N) {
+    if (N <= 1) return;
+    if (plan->fft_log2 < 0 || (N & (N - 1)) != 0) {
+        fft_mixed_radix(plan, re, im, N);
+        return;
+    }
+    fft_pow2(plan, re, im, N);
+}
+
+static void fft_half_generic(const CodecPlan *plan, float *re, float *im) {
+    fft_generic(plan, re, im, plan->frame_size / 2);
+}
+
+static void fft_quarter_generic(const CodecPlan *plan, float *re, float *im) {
+    fft_generic(plan, re, im, plan->frame_size / 4);
+}
+
+// --- フレームサイズ特殊化カーネル ---
+// よく使うフレームサイズ (256, 512, 1024) の rfft/irfft と、その内部の N/2, N/4 点FFT を
+// 長さと命令セットを定数にして個別にコンパイルする。段のループは展開され、各段の長さも定数になる
+// サンプリングレートは帯域設定の表にしか影響しないため、特殊化はフレームサイズ単位で行う
+
+// 半長 4, 8, 16以上 の段にそれぞれ K4, K8, K16 の命令セットのカーネルを直接呼ぶ
+// (fft_pow2 と同じく2段ずつ基数4で進め、段数が奇数なら最後の1段は基数2)
+// 段のループを展開させることで、各段の半長と繰り返し回数が定数になる
+#define FIXED_FFT_STAGE(N, K4, K8, K16, half, wr, wi) \
+    if ((half) * 4 <= (N)) { \
+        if ((half) >= 16) radix4_stage_##K16(re, im, N, half, wr, wi); \
+        else if ((half) >= 8) radix4_stage_##K8(re, im, N, half, wr, wi); \
+        else radix4_stage_##K4(re, im, N, half, wr, wi); \
+    } else { \
+        if ((half) >= 16) butterfly_stage_##K16(re, im, N, half, wr, wi); \
+        else if ((half) >= 8) butterfly_stage_##K8(re, im, N, half, wr, wi); \
+        else butterfly_stage_##K4(re, im, N, half, wr, wi); \
+    }
+#define DEFINE_FIXED_FFT(N, ISA, TARGET, K4, K8, K16) \
+    TARGET static void fft_##N##_##ISA(const CodecPlan *plan, float *re, float *im) { \
+        fft_pow2_first_stages(plan, re, im, N); \
+        _Pragma("GCC unroll 16") \
+        for (int half = 4; half < N; half *= (half * 4 <= N) ? 4 : 2) { \
+            const float *wr = &plan->stage_twiddle_re[half], *wi = &plan->stage_twiddle_im[half]; \
+            FIXED_FFT_STAGE(N, K4, K8, K16, half, wr, wi) \
+        } \
+    }
+
+#ifdef HAVE_X86_SIMD
+#define DEFINE_FIXED_FFT_ALL(N) \
+    DEFINE_FIXED_FFT(N, scalar, , scalar, scalar, scalar) \
+    DEFINE_FIXED_FFT(N, sse2, __attribute__((target("sse2"))), sse2, sse2, sse2) \
+    DEFINE_FIXED_FFT(N, avx2, __attribute__((target("avx2,fma"))), sse2, avx2, avx2) \
+    DEFINE_FIXED_FFT(N, avx512, __attribute__((target("avx512f,avx2,fma"))), sse2, avx2, avx512)
+#define FIXED_FFT_ENTRY(N) {N, {fft_##N##_scalar, fft_##N##_sse2, fft_##N##_avx2, fft_##N##_avx512}}
+#else
+#define DEFINE_FIXED_FFT_ALL(N) \
+    DEFINE_FIXED_FFT(N, scalar, , scalar, scalar, scalar)
+#define FIXED_FFT_ENTRY(N) {N, {fft_##N##_scalar}}
+#endif
+
+DEFINE_FIXED_FFT_ALL(64)
+DEFINE_FIXED_FFT_ALL(128)
+DEFINE_FIXED_FFT_ALL(256)
+DEFINE_FIXED_FFT_ALL(512)
+
+// 長さごとの特殊化FFT (命令セットの添字は g_butterfly_kernels と同じ)
+typedef struct {
+    int n;
+    PlanFftFunc fft[4];
+} FixedFft;
+
+static const FixedFft g_fixed_ffts[] = {
+    FIXED_FFT_ENTRY(64),
+    FIXED_FFT_ENTRY(128),
+    FIXED_FFT_ENTRY(256),
+    FIXED_FFT_ENTRY(512),
+};
+
+// 長さ n の特殊化FFT (無ければ NULL)
+static PlanFftFunc find_fixed_fft(int n, int level) {
+    for (size_t i = 0; i < sizeof(g_fixed_ffts) / sizeof(g_fixed_ffts[0]); i++) {
+        if (g_fixed_ffts[i].n == n) return g_fixed_ffts[i].fft[level];
+    }
+    return NULL;
+}
+
+// インプレースの FFT (N はフレームサイズを割り切る長さ)
+// 実部と虚部を別配列で持つ分離形式 (SoA) で計算する
+// プランが持つ N/2, N/4 点の長さならそのカーネル (特殊化版があればそれ) を使う
+void fft(const CodecPlan *plan, float *re, float *im, int N) {
+    if (N == plan->frame_size / 2) {
+        plan->fft_half(plan, re, im);
+    } else if (N == plan->frame_size / 4) {
+        plan->fft_quarter(plan, re, im);
+    } else {
+        fft_generic(plan, re, im, N);
+    }
+}
+
+void ifft(const CodecPlan *plan, float *re, float *im, int N) {
+    for (int i = 0; i < N; i++) {
+        im[i] = -im[i];
+    }
+
+    fft(plan, re, im, N);
+
+    float scale = 1.0f / N;
+    for (int i = 0; i < N; i++) {
+        re[i] = re[i] * scale;
+        im[i] = -im[i] * scale;
+    }
+}
+
+// 実数入力FFTの本体: N点の実数列 in から N/2+1 個の独立なビンを out に求める (N はフレームサイズ)
+// 偶数・奇数サンプルを実部・虚部に詰めた N/2 点の複素FFTと後段の回転で計算する
+static inline __attribute__((always_inline))
+void rfft_body(const CodecPlan *plan, const float *in, Spectrum *out, int N) {
+    const int M = N / 2;
+    float *re = out->re, *im = out->im;
+
+    for (int n = 0; n < M; n++) {
+        re[n] = in[2*n];
+        im[n] = in[2*n+1];
+    }
+    plan->fft_half(plan, re, im);
+
+    // 直流とナイキスト周波数
+    float z0r = re[0], z0i = im[0];
+    re[0] = z0r + z0i; im[0] = 0.0f;
+    re[M] = z0r - z0i; im[M] = 0.0f;
+
+    // X[k] = Fe + W^k Fo, X[M-k] = conj(Fe - W^k Fo) を対で計算
+    for (int k = 1; k <= M / 2; k++) {
+        float ar = re[k], ai = im[k];
+        float br = re[M-k], bi = -im[M-k];   // conj(Z[M-k])
+        float fer = (ar + br) * 0.5f, fei = (ai + bi) * 0.5f;
+        float for_ = (ai - bi) * 0.5f, foi = -(ar - br) * 0.5f;  // -i(A-B)/2
+        float wr = plan->twiddle_re[k], wi = plan->twiddle_im[k];
+        float tr = wr * for_ - wi * foi, ti = wr * foi + wi * for_;
+        re[k]   = fer + tr; im[k]   = fei + ti;
+        re[M-k] = fer - tr; im[M-k] = -(fei - ti);
+    }
+}
+
+// 実数出力IFFTの本体: N/2+1 個のビン in から N点の実数列 out を復元する (in は破壊される)
+// 直流とナイキスト周波数の虚部は無視する
+static inline __attribute__((always_inline))
+void irfft_body(const CodecPlan *plan, Spectrum *in, float *out, int N) {
+    const int M = N / 2;
+    float *re = in->re, *im = in->im;
+
+    float x0 = re[0], xm = re[M];
+    re[0] = (x0 + xm) * 0.5f;
+    im[0] = (x0 - xm) * 0.5f;
+
+    // Z[k] = Fe + i Fo, Z[M-k] = conj(Fe) + i conj(Fo) を対で計算
+    // 逆変換は共役をとった順変換で行うので、虚部の符号を反転して格納する
+    for (int k = 1; k <= M / 2; k++) {
+        float ar = re[k], ai = im[k];
+        float br = re[M-k], bi = -im[M-k];   // conj(X[M-k])
+        float fer = (ar + br) * 0.5f, fei = (ai + bi) * 0.5f;
+        float dr = (ar - br) * 0.5f, di = (ai - bi) * 0.5f;
+        float wr = plan->twiddle_re[k], wi = plan->twiddle_im[k];
+        float for_ = dr * wr + di * wi, foi = di * wr - dr * wi;  // d * conj(W^k)
+        re[k]   = fer - foi; im[k]   = -(fei + for_);
+        re[M-k] = fer + foi; im[M-k] = -(-fei + for_);
+    }
+    im[0] = -im[0];
+    plan->fft_half(plan, re, im);
+
+    const float scale = 1.0f / M;
+    for (int n = 0; n < M; n++) {
+        out[2*n]   = re[n] * scale;
+        out[2*n+1] = -im[n] * scale;
+    }
+}
+
+static void rfft_generic(const CodecPlan *plan, const float *in, Spectrum *out) {
+    rfft_body(plan, in, out, plan->frame_size);
+}
+
+static void irfft_generic(const CodecPlan *plan, Spectrum *in, float *out) {
+    irfft_body(plan, in, out, plan->frame_size);
+}
+
+#define DEFINE_FIXED_RFFT(N) \
+    static void rfft_##N(const CodecPlan *plan, const float *in, Spectrum *out) { \
+        rfft_body(plan, in, out, N); \
+    } \
+    static void irfft_##N(const CodecPlan *plan, Spectrum *in, float *out) { \
+        irfft_body(plan, in, out, N); \
+    }
+
+DEFINE_FIXED_RFFT(256)
+DEFINE_FIXED_RFFT(512)
+DEFINE_FIXED_RFFT(1024)
+
+// フレームサイズごとの特殊化 rfft/irfft
+typedef struct {
+    int n;
+    PlanRfftFunc rfft;
+    PlanIrfftFunc irfft;
+} FixedRfft;
+
+static const FixedRfft g_fixed_rffts[] = {
+    {256, rfft_256, irfft_256},
+    {512, rfft_512, irfft_512},
+    {1024, rfft_1024, irfft_1024},
+};
+
+// フレームサイズに合うカーネルを選ぶ (特殊化版が無ければ汎用版)
+static void select_transform_kernels(CodecPlan *plan, int generic_only) {
+    plan->fft_half = fft_half_generic;
+    plan->fft_quarter = fft_quarter_generic;
+    plan->rfft = rfft_generic;
+    plan->irfft = irfft_generic;
+    plan->specialized = 0;
+    if (generic_only || plan->fft_log2 < 0) return;
+
+    PlanFftFunc f;
+    if ((f = find_fixed_fft(plan->frame_size / 2, plan->isa_level)) != NULL) plan->fft_half = f;
+    if ((f = find_fixed_fft(plan->frame_size / 4, plan->isa_level)) != NULL) plan->fft_quarter = f;
+    for (size_t i = 0; i < sizeof(g_fixed_rffts) / sizeof(g_fixed_rffts[0]); i++) {
+        if (g_fixed_rffts[i].n == plan->frame_size) {
+            plan->rfft = g_fixed_rffts[i].rfft;
+            plan->irfft = g_fixed_rffts[i].irfft;
+            plan->specialized = 1;
+        }
+    }
+}
+
+// 実数入力FFT (N = フレームサイズ)
+void rfft(const CodecPlan *plan, const float *in, Spectrum *out) {
+    plan->rfft(plan, in, out);
+}
+
+// 実数出力IFFT (in は破壊される)
+void irfft(const CodecPlan *plan, Spectrum *in, float *out) {
+    plan->irfft(plan, in, out);
+}
+
+// --- MDCT (修正離散コサイン変換) 符号化 ---
+// 窓長 N (フレームサイズ)、ホップ長 N/2 (50%重なり) の臨界サンプリング変換
+// 1ホップあたり N/2 個の実数係数を送り、受信側は窓掛け後の重畳加算で時間領域エイリアスを打ち消す (TDAC)
+// 係数 k の中心周波数は (k + 1/2) * サンプリングレート / N なので、プランの帯域設定をそのまま使える
+
+// 0次の第1種変形ベッセル関数 (KBD窓の計算用)
+static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+    return sum;
+}
+
+// MDCT 用の窓と回転因子を計算する
+static void init_mdct_tables(CodecPlan *plan) {
+    const int N = plan->frame_size, M = N / 2, Q = N / 4;
+    float *w = plan->mdct_window_coefs;
+
+    if (plan->mdct_window == WINDOW_KBD) {
+        // Kaiser-Bessel 派生窓 (alpha = 4)
+        const double alpha = 4.0;
+        double total = 0.0, cumsum = 0.0;
+        for (int j = 0; j <= M; j++) {
+            double r = 2.0 * j / M - 1.0;
+            total += bessel_i0(PI * alpha * sqrt(1.0 - r * r));
+        }
+        for (int n = 0; n < M; n++) {
+            double r = 2.0 * n / M - 1.0;
+            cumsum += bessel_i0(PI * alpha * sqrt(1.0 - r * r));
+            w[n] = (float)sqrt(cumsum / total);
+            w[N - 1 - n] = w[n];
+        }
+    } else {
+        // 正弦窓
+        for (int n = 0; n < N; n++) {
+            w[n] = (float)sin(PI * (n + 0.5) / N);
+        }
+    }
+
+    for (int n = 0; n < Q; n++) {
+        double pre = -PI * (4 * n + 1) / (4.0 * M);
+        double post = -PI * n / M;
+        plan->mdct_pre_re[n] = (float)cos(pre);
+        plan->mdct_pre_im[n] = (float)sin(pre);
+        plan->mdct_post_re[n] = (float)cos(post);
+        plan->mdct_post_im[n] = (float)sin(post);
+    }
+}
+
+// 長さ M = N/2 の DCT-IV を N/4 点の複素FFTで計算する (in と out は別領域)
+static void dct4(const CodecPlan *plan, const float *in, float *out) {
+    const int M = plan->frame_size / 2, Q = plan->frame_size / 4;
+    _Alignas(CACHE_LINE) float zr[MAX_FRAME_SIZE / 4];
+    _Alignas(CACHE_LINE) float zi[MAX_FRAME_SIZE / 4];
+
+    for (int n = 0; n < Q; n++) {
+        float vr = in[2*n], vi = in[M - 1 - 2*n];
+        zr[n] = vr * plan->mdct_pre_re[n] - vi * plan->mdct_pre_im[n];
+        zi[n] = vr * plan->mdct_pre_im[n] + vi * plan->mdct_pre_re[n];
+    }
+    plan->fft_quarter(plan, zr, zi);
+    for (int k = 0; k < Q; k++) {
+        float yr = zr[k] * plan->mdct_post_re[k] - zi[k] * plan->mdct_post_im[k];
+        float yi = zr[k] * plan->mdct_post_im[k] + zi[k] * plan->mdct_post_re[k];
+        out[2*k] = yr;
+        out[M - 1 - 2*k] = -yi;
+    }
+}
+
+// 順MDCT: N サンプルの入力 x に窓を掛け、N/2 個の係数 X を求める
+// x = (a, b, c, d) を4分割すると MDCT(x) = DCT-IV(-c_r - d, a - b_r) (_r は逆順)
+void mdct_forward(const CodecPlan *plan, const float *x, float *X) {
+    const int Q = plan->frame_size / 4;
+    const float *w = plan->mdct_window_coefs;
+    _Alignas(CACHE_LINE) float v[MAX_MDCT_HOP];
+
+    for (int n = 0; n < Q; n++) {
+        v[n]     = -w[3*Q - 1 - n] * x[3*Q - 1 - n] - w[3*Q + n] * x[3*Q + n];
+        v[Q + n] =  w[n] * x[n] - w[2*Q - 1 - n] * x[2*Q - 1 - n];
+    }
+    dct4(plan, v, X);
+}
+
+// 逆MDCT: N/2 個の係数から窓掛け済みの N サンプルを求める
+// 前フレームの後半と重畳加算すると元の信号に戻る
+void mdct_inverse(const CodecPlan *plan, const float *X, float *y) {
+    const int M = plan->frame_size / 2, Q = plan->frame_size / 4;
+    const float *w = plan->mdct_window_coefs;
+    const float scale = 2.0f / M;
+    _Alignas(CACHE_LINE) float v[MAX_MDCT_HOP];
+
+    dct4(plan, X, v);
+    for (int n = 0; n < Q; n++) {
+        y[n]         =  w[n] * v[Q + n] * scale;
+        y[Q + n]     = -w[Q + n] * v[M - 1 - n] * scale;
+        y[2*Q + n]   = -w[2*Q + n] * v[Q - 1 - n] * scale;
+        y[3*Q + n]   = -w[3*Q + n] * v[n] * scale;
+    }
+}
+
+// MDCT係数の圧縮
+// 帯域ごとに最大振幅のスケールファクタ (1dB 単位、8bit) を送り、
+// 各係数は スケールファクタから MDCT_RANGE_DB 下までを mag_bits で量子化した振幅 + 符号1bit を詰めて送る
+// 最小可聴値またはその範囲を下回る係数は振幅 0 (無音) として送る
+// エントロピー符号化が有効なら振幅を適応モデルでレンジ符号化し、符号は振幅が 0 でない係数にだけ付ける
+void mdct_compress(const CodecPlan *plan, const float *coefs,
+                   unsigned char *compressed_data, int *compressed_size) {
+    const BandConfig *bands = plan->bands;
+    const int hop = plan->mdct_hop;
+    unsigned char scales[MAX_BANDS];
+    unsigned char q_mag[MAX_MDCT_HOP], sign[MAX_MDCT_HOP];
+
+    for (int band = 0; band < plan->num_bands; band++) {
+        int start = bands[band].start_bin;
+        int end = bands[band].end_bin < hop - 1 ? bands[band].end_bin : hop - 1;
+        int mag_bits = bands[band].mag_bits;
+
+        // スケールファクタ (帯域内の最大振幅を dB で切り上げ)
+        float peak = 0.0f;
+        for (int k = start; k <= end; k++) peak = fmaxf(peak, fabsf(coefs[k]));
+        float peak_db = ceilf(20.0f * log10f(fmaxf(peak, 1.0f)));
+        scales[band] = (unsigned char)fminf(peak_db, 255.0f);
+
+        float mag_max = (float)scales[band];
+        float mag_min = mag_max - MDCT_RANGE_DB;
+        for (int k = start; k <= end; k++) {
+            float magnitude_db = 20.0f * log10f(fmaxf(fabsf(coefs[k]), 1e-10f));
+            q_mag[k] = 0;
+            if (magnitude_db >= bands[band].threshold_db && magnitude_db >= mag_min) {
+                q_mag[k] = quantize_value(magnitude_db, mag_bits, mag_min, mag_max);
+                if (q_mag[k] == 0) q_mag[k] = 1;  // 0 は無音用に予約
+            }
+            sign[k] = (coefs[k] < 0.0f) ? 1 : 0;
+        }
+    }
+
+    // レンジ符号化
+    if (plan->entropy_coding) {
+        RangeEncoder rc;
+        EntropyState es;
+        range_encoder_init(&rc, compressed_data + 1);
+        entropy_reset(&es);
+        for (int band = 0; band < plan->num_bands; band++) {
+            int end = bands[band].end_bin < hop - 1 ? bands[band].end_bin : hop - 1;
+            AdaptiveModel *model = entropy_model(&es, bands[band].mag_bits);
+            range_encode_bits(&rc, scales[band], 8);
+            for (int k = bands[band].start_bin; k <= end; k++) {
+                range_encode_symbol(&rc, model, q_mag[k]);
+                if (q_mag[k] != 0) range_encode_bits(&rc, sign[k], 1);
+            }
+        }
+        int size = range_encoder_finish(&rc);
+        if (size < plan->mdct_raw_bytes) {
+            compressed_data[0] = ENTROPY_MODE_RANGE;
+            *compressed_size = 1 + size;
+            return;
+        }
+        compressed_data[0] = ENTROPY_MODE_RAW;
+    }
+
+    const int header_bytes = entropy_mode_bytes(plan);
+    BitWriter bw;
+    bit_writer_init(&bw, compressed_data + header_bytes);
+    for (int band = 0; band < plan->num_bands; band++) {
+        int end = bands[band].end_bin < hop - 1 ? bands[band].end_bin : hop - 1;
+        int mag_bits = bands[band].mag_bits;
+        bit_writer_put(&bw, scales[band], 8);
+        for (int k = bands[band].start_bin; k <= end; k++) {
+            bit_writer_put(&bw, q_mag[k] | (sign[k] << mag_bits), mag_bits + 1);
+        }
+    }
+    *compressed_size = header_bytes + bit_writer_finish(&bw);
+}
+
+// MDCT係数の展開 (量子化幅の中央値で復元する)
+// compressed_data の後ろには BITSTREAM_PADDING byte の読み出し可能な余白が必要
+// 長さがエントロピー符号化のモードに合わなければ無音にして -1 を返す
+int mdct_decompress(const CodecPlan *plan, unsigned char *compressed_data,
+                    float *coefs, int compressed_size) {
+    const BandConfig *bands = plan->bands;
+    const int hop = plan->mdct_hop;
+    memset(coefs, 0, hop * sizeof(float));
+    const int ranged = entropy_read_mode(plan, &compressed_data, &compressed_size, plan->mdct_raw_bytes);
+    if (ranged < 0) return -1;
+    BitReader br;
+    RangeDecoder rc;
+    EntropyState es;
+    bit_reader_init(&br, compressed_data, compressed_size);
+    range_decoder_init(&rc, compressed_data, compressed_size);
+    entropy_reset(&es);
+
+    for (int band = 0; band < plan->num_bands; band++) {
+        int start = bands[band].start_bin;
+        int end = bands[band].end_bin < hop - 1 ? bands[band].end_bin : hop - 1;
+        int mag_bits = bands[band].mag_bits;
+
+        if (!ranged && bit_reader_remaining(&br) < 8) break;
+        float mag_max = (float)(ranged ? range_decode_bits(&rc, 8) : bit_reader_get(&br, 8));
+        float mag_min = mag_max - MDCT_RANGE_DB;
+        float half_step = 0.5f * MDCT_RANGE_DB / ((1 << mag_bits) - 1);
+
+        // データが途中で切れていれば読める分だけ復元する
+        if (!ranged) {
+            int available = bit_reader_remaining(&br) / (mag_bits + 1);
+            if (end - start + 1 > available) end = start + available - 1;
+        }
+        AdaptiveModel *model = ranged ? entropy_model(&es, mag_bits) : NULL;
+
+        for (int k = start; k <= end; k++) {
+            unsigned int q_mag, sign = 0;
+            if (ranged) {
+                q_mag = range_decode_symbol(&rc, model);
+                if (q_mag != 0) sign = range_decode_bits(&rc, 1);
+            } else {
+                unsigned int q = bit_reader_get(&br, mag_bits + 1);
+                q_mag = q & ((1u << mag_bits) - 1);
+                sign = q >> mag_bits;
+            }
+            if (q_mag == 0) continue;
+
+            float magnitude_db = dequantize_value(q_mag, mag_bits, mag_min, mag_max) + half_step;
+            float magnitude = powf(10.0f, magnitude_db / 20.0f);
+            coefs[k] = sign ? -magnitude : magnitude;
+        }
+    }
+    return 0;
+}
+
+// --- 標本化周波数変換 (ポリフェーズ FIR) ---
+// 取り込み・再生のレート (44100 Hz, 48000 Hz など) とコーデックのレートを有理数比 L/M で変換する
+// L 倍に0を挿入 -> 低域通過 -> 1/M に間引く処理を、L 本の位相に分けた FIR で必要な出力だけ計算する
+// 低域通過の遮断周波数は低い方のナイキスト周波数の RESAMPLE_PASSBAND 倍 (Kaiser 窓付き sinc)
+
+#define RESAMPLE_ZERO_CROSSINGS 12  // sinc の片側の零点の数 (低い方のレートの標本間隔で数える)
+#define RESAMPLE_PASSBAND 0.9       // 遮断周波数 (低い方のナイキスト周波数に対する比)
+#define RESAMPLE_KAISER_BETA 8.0    // Kaiser 窓の形状 (阻止域の減衰 約80dB)
+
+static int gcd_int(int a, int b) {
+    while (b != 0) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// 積和のカーネル (n は16の倍数)
+static float resample_dot_scalar(const float *x, const float *h, int n) {
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++) sum += x[i] * h[i];
+    return sum;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static float resample_dot_sse2(const float *x, const float *h, int n) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    for (int i = 0; i < n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_load_ps(h + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_load_ps(h + i + 4)));
+    }
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    return _mm_cvtss_f32(acc0);
+}
+
+__attribute__((target("avx2,fma")))
+static float resample_dot_avx2(const float *x, const float *h, int n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    for (int i = 0; i < n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_load_ps(h + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_load_ps(h + i + 8), acc1);
+    }
+    acc0 = _mm256_add_ps(acc0, acc1);
+    __m128 v = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+__attribute__((target("avx512f")))
+static float resample_dot_avx512(const float *x, const float *h, int n) {
+    __m512 acc = _mm512_setzero_ps();
+    for (int i = 0; i < n; i += 16) {
+        acc = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_load_ps(h + i), acc);
+    }
+    return _mm512_reduce_add_ps(acc);
+}
+#endif
+
+// 命令セットの番号 (CodecPlan.isa_level) 順
+static const ResampleDotFunc g_resample_dot_kernels[] = {
+    resample_dot_scalar,
+#ifdef HAVE_X86_SIMD
+    resample_dot_sse2,
+    resample_dot_avx2,
+    resample_dot_avx512,
+#endif
+};
+
+// in_rate から out_rate への変換器を作る
+// 積和のカーネルはプランの命令セットに合わせる (plan が NULL なら CPU が対応する最良のもの)
+int resampler_init(Resampler *rs, const CodecPlan *plan, int in_rate, int out_rate) {
+    if (in_rate < 1000 || in_rate > 192000 || out_rate < 1000 || out_rate > 192000) {
+        fprintf(stderr, "Resampling %d Hz to %d Hz is not supported (rates must be 1000-192000 Hz)\n",
+                in_rate, out_rate);
+        return -1;
+    }
+    int g = gcd_int(in_rate, out_rate);
+    int up = out_rate / g, down = in_rate / g;
+
+    // 1位相のタップ数は、間引くときは sinc の零点の間隔が M/L 入力標本に広がる分だけ増やす
+    double spacing = (down > up) ? (double)down / up : 1.0;
+    int real_taps = (int)ceil(2.0 * RESAMPLE_ZERO_CROSSINGS * spacing);
+    int taps = (real_taps + 15) & ~15;
+    if (taps > MAX_RESAMPLE_TAPS || (long)up * taps > MAX_RESAMPLE_COEFS) {
+        fprintf(stderr, "Resampling %d Hz to %d Hz needs %d phases x %d taps (limit %d taps, %d coefficients)\n",
+                in_rate, out_rate, up, taps, MAX_RESAMPLE_TAPS, MAX_RESAMPLE_COEFS);
+        return -1;
+    }
+
+    rs->in_rate = in_rate;
+    rs->out_rate = out_rate;
+    rs->up = up;
+    rs->down = down;
+    rs->taps = taps;
+    rs->phase = 0;
+    rs->next_input = 0;
+    rs->dot = g_resample_dot_kernels[plan ? plan->isa_level : detect_isa_level()];
+    memset(rs->history, 0, sizeof(rs->history));
+
+    // 原型フィルタは L 倍のレートで長さ L*real_taps。位相 p のタップ t は h[p + t*L] で、入力 x[i - t] に掛かる
+    // 窓の先頭を最も古い入力にするため、位相ごとに時間の逆順で置く。各位相の和を 1 に正規化して直流の揺れを除く
+    int length = up * real_taps;
+    double center = (length - 1) / 2.0;
+    double cutoff = RESAMPLE_PASSBAND * 0.5 / (up * spacing);  // 原型のレートに対する遮断周波数
+    double i0_beta = bessel_i0(RESAMPLE_KAISER_BETA);
+    memset(rs->coefs, 0, sizeof(rs->coefs));
+    for (int p = 0; p < up; p++) {
+        float *coefs = rs->coefs + p * taps;
+        double sum = 0.0;
+        for (int t = 0; t < real_taps; t++) {
+            double n = p + (double)t * up - center;
+            double r = n / (center + 1.0);
+            double window = bessel_i0(RESAMPLE_KAISER_BETA * sqrt(fmax(0.0, 1.0 - r * r))) / i0_beta;
+            double x = 2.0 * cutoff * n;
+            double sinc = (fabs(x) < 1e-12) ? 1.0 : sin(PI * x) / (PI * x);
+            double h = 2.0 * cutoff * sinc * window;
+            coefs[real_taps - 1 - t] = (float)h;
+            sum += h;
+        }
+        for (int t = 0; t < real_taps; t++) coefs[t] = (float)(coefs[t] / sum);
+    }
+    return 0;
+}
+
+// n サンプルの入力から作られる出力の最大数
+int resampler_max_output(const Resampler *rs, int n) {
+    return (int)(((long)n * rs->up + rs->down - 1) / rs->down) + 1;
+}
+
+// n サンプルを変換して out に書き、出力したサンプル数を返す (前回の呼び出しの続きとして扱う)
+// 出力は入力の (実際のタップ数-1)/2 標本ぶん遅れる
+int resampler_process(Resampler *rs, const short *in, int n, short *out) {
+    const int taps = rs->taps, up = rs->up, down = rs->down;
+    int produced = 0;
+    while (n > 0) {
+        int block = (n < RESAMPLE_BLOCK) ? n : RESAMPLE_BLOCK;
+        float *x = rs->history + taps - 1;
+        for (int i = 0; i < block; i++) x[i] = (float)in[i];
+        int available = taps - 1 + block;
+
+        int pos = rs->next_input, phase = rs->phase;
+        while (pos + taps <= available) {
+            float sample = rs->dot(rs->history + pos, rs->coefs + phase * taps, taps);
+            out[produced++] = (short)fmaxf(fminf(roundf(sample), 32767.0f), -32768.0f);
+            phase += down;
+            pos += phase / up;
+            phase %= up;
+        }
+
+        // 次のブロックのために末尾 taps-1 個を先頭へ移す
+        memmove(rs->history, rs->history + block, (taps - 1) * sizeof(float));
+        rs->next_input = pos - block;
+        rs->phase = phase;
+        in += block;
+        n -= block;
+    }
+    return produced;
+}
+
+// --- パケット損失の補間 ---
+
+// 背景雑音のパワーの追い方 (下がるときは速く、上がるときはゆっくり追うのでパワーの下側に張り付く)
+#define PLC_NOISE_FALL 0.3f
+#define PLC_NOISE_RISE 0.01f
+
+// 補間の雑音の位相の表を計算する
+static void init_plc_tables(CodecPlan *plan) {
+    for (int i = 0; i < PLC_PHASES; i++) {
+        plan->plc_cos[i] = (float)cos(2.0 * PI * i / PLC_PHASES);
+        plan->plc_sin[i] = (float)sin(2.0 * PI * i / PLC_PHASES);
+    }
+}
+
+void plc_init(PlcState *plc) {
+    memset(plc, 0, sizeof(*plc));
+    plc->seed = 12345;
+    for (int k = 0; k < SPECTRUM_STRIDE; k++) plc->rot_re[k] = 1.0f;
+}
+
+static inline uint32_t plc_random(PlcState *plc) {
+    plc->seed = plc->seed * 1103515245u + 12345u;
+    return plc->seed >> 16;
+}
+
+static inline void plc_track_noise(PlcState *plc, int n, const float *re, const float *im) {
+    for (int k = 0; k < n; k++) {
+        float power = re[k] * re[k] + (im ? im[k] * im[k] : 0.0f);
+        if (!plc->valid) {
+            plc->noise[k] = power;
+            continue;
+        }
+        float rate = (power < plc->noise[k]) ? PLC_NOISE_FALL : PLC_NOISE_RISE;
+        plc->noise[k] += (power - plc->noise[k]) * rate;
+    }
+}
+
+// 失われたフレームの直前のスペクトルの重み (続けて失うほど減衰し、PLC_FADE_FRAMES で 0)
+static float plc_next_gain(PlcState *plc) {
+    plc->lost++;
+    if (plc->lost >= PLC_FADE_FRAMES) return 0.0f;
+    float gain = 1.0f;
+    for (int i = 0; i < plc->lost; i++) gain *= PLC_DECAY;
+    return gain * (float)(PLC_FADE_FRAMES - plc->lost) / (PLC_FADE_FRAMES - 1);
+}
+
+// 正常に復号したスペクトルを覚える
+void plc_update(const CodecPlan *plan, PlcState *plc, const Spectrum *spec) {
+    const int bins = plan->spectrum_bins;
+    memcpy(plc->prev_re, plc->re, bins * sizeof(float));
+    memcpy(plc->prev_im, plc->im, bins * sizeof(float));
+    memcpy(plc->re, spec->re, bins * sizeof(float));
+    memcpy(plc->im, spec->im, bins * sizeof(float));
+    plc_track_noise(plc, bins, spec->re, spec->im);
+    // 補間の直後は1つ前が外挿したスペクトルなので、2フレーム続けて届くまで位相の進みは測り直さない
+    plc->good = plc->lost ? 1 : plc->good + 1;
+    plc->valid = 1;
+    plc->lost = 0;
+}
+
+// 失われたフレームのスペクトルを作る
+// 直前のスペクトル x 減衰 (位相を進める) に、減衰した分だけ背景雑音 (位相は乱数) を足す
+void plc_conceal(const CodecPlan *plan, PlcState *plc, Spectrum *spec) {
+    const int last = plan->spectrum_bins - 1;
+    if (plc->lost == 0 && plc->good >= 2) {
+        // 位相の進み = 直前のフレーム x 1つ前のフレームの共役 の偏角 (測れなければ前に測った値を使う)
+        for (int k = 0; k <= last; k++) {
+            float r = plc->re[k] * plc->prev_re[k] + plc->im[k] * plc->prev_im[k];
+            float i = plc->im[k] * plc->prev_re[k] - plc->re[k] * plc->prev_im[k];
+            float norm = sqrtf(r * r + i * i);
+            plc->rot_re[k] = (norm > 0.0f) ? r / norm : 1.0f;
+            plc->rot_im[k] = (norm > 0.0f) ? i / norm : 0.0f;
+        }
+    }
+    float gain = plc_next_gain(plc);
+    for (int k = 0; k <= last; k++) {
+        float re = plc->re[k] * plc->rot_re[k] - plc->im[k] * plc->rot_im[k];
+        float im = plc->re[k] * plc->rot_im[k] + plc->im[k] * plc->rot_re[k];
+        plc->re[k] = re;
+        plc->im[k] = im;
+        int phase = plc_random(plc) % PLC_PHASES;
+        float noise = sqrtf(plc->noise[k]) * (1.0f - gain);
+        spec->re[k] = re * gain + noise * plan->plc_cos[phase];
+        spec->im[k] = im * gain + noise * plan->plc_sin[phase];
+    }
+    // 直流とナイキスト周波数のビンは実数
+    spec->re[0] = copysignf(hypotf(spec->re[0], spec->im[0]), spec->re[0]);
+    spec->im[0] = 0.0f;
+    spec->re[last] = copysignf(hypotf(spec->re[last], spec->im[last]), spec->re[last]);
+    spec->im[last] = 0.0f;
+}
+
+// MDCTモード: 正常に復号した係数を覚える
+void plc_update_mdct(const CodecPlan *plan, PlcState *plc, const float *coefs) {
+    memcpy(plc->re, coefs, plan->mdct_hop * sizeof(float));
+    plc_track_noise(plc, plan->mdct_hop, coefs, NULL);
+    plc->valid = 1;
+    plc->lost = 0;
+}
+
+// MDCTモード: 失われたフレームの係数を作る (重畳加算は呼び出し側がいつも通り行う)
+// 1フレーム目は直前の係数をそのまま減衰させ、2フレーム目からは符号を乱数にして周期的な響きを避ける
+void plc_conceal_mdct(const CodecPlan *plan, PlcState *plc, float *coefs) {
+    float gain = plc_next_gain(plc);
+    for (int k = 0; k < plan->mdct_hop; k++) {
+        uint32_t r = plc_random(plc);
+        float sign = (plc->lost > 1 && (r & 1)) ? -1.0f : 1.0f;
+        float noise_sign = (r & 2) ? -1.0f : 1.0f;
+        coefs[k] = sign * plc->re[k] * gain + noise_sign * sqrtf(plc->noise[k]) * (1.0f - gain);
+    }
+}
+
+// --- プラン ---
+
+// 既定の設定
+void codec_default_options(CodecOptions *opts) {
+    opts->frame_size = DEFAULT_FRAME_SIZE;
+    opts->sample_rate = DEFAULT_SAMPLE_RATE;
+    opts->num_bands = 0;
+    opts->band_layout = BAND_LAYOUT_LINEAR;
+    opts->phone_low_hz = PHONE_BAND_LOW_HZ;
+    opts->phone_high_hz = PHONE_BAND_HIGH_HZ;
+    opts->mdct_window = WINDOW_SINE;
+    opts->isa_name = NULL;
+    opts->generic_kernels = 0;
+    opts->entropy_coding = 0;
+    opts->masking_model = 0;
+    opts->bfp_bits = 0;
+}
+
+// 設定を検査してプランを作る (不正な設定なら理由を表示して -1 を返す)
+int codec_plan_init(CodecPlan *plan, const CodecOptions *opts) {
+    const int N = opts->frame_size;
+
+    // N/2 点の複素FFTを基数 2, 3, 5 に分解できるか確認
+    int m = N / 2;
+    if (m > 0) {
+        while (m % 2 == 0) m /= 2;
+        while (m % 3 == 0) m /= 3;
+        while (m % 5 == 0) m /= 5;
+    }
+    if (N < 8 || N > MAX_FRAME_SIZE || N % 4 != 0 || m != 1) {
+        fprintf(stderr, "Frame size %d is not supported (multiple of 4 up to %d, frame size/2 must factor into 2, 3 and 5)\n",
+                N, MAX_FRAME_SIZE);
+        return -1;
+    }
+    if (opts->sample_rate < 1000 || opts->sample_rate > 192000) {
+        fprintf(stderr, "Sample rate %d Hz is not supported (1000-192000)\n", opts->sample_rate);
+        return -1;
+    }
+    int num_bands = opts->num_bands;
+    if (num_bands == 0) {
+        num_bands = default_num_bands(opts->band_layout, opts->sample_rate);
+        if (num_bands > MAX_BANDS) num_bands = MAX_BANDS;
+        if (num_bands > N / 2) num_bands = N / 2;
+    }
+    if (num_bands < 1 || num_bands > MAX_BANDS || num_bands > N / 2) {
+        fprintf(stderr, "Number of bands %d is not supported (1-%d, at most frame size/2)\n",
+                num_bands, MAX_BANDS);
+        return -1;
+    }
+    if (opts->bfp_bits != 0 && !bfp_bits_supported(opts->bfp_bits)) {
+        fprintf(stderr, "Unsupported block floating point mantissa bits %d (must be 8, 9, 10, 12 or 16)\n",
+                opts->bfp_bits);
+        return -1;
+    }
+    if (opts->phone_low_hz < 0 || opts->phone_low_hz >= opts->phone_high_hz ||
+        opts->phone_high_hz > opts->sample_rate / 2) {
+        fprintf(stderr, "Invalid phone band %d-%d Hz (must satisfy 0 <= low < high <= %d)\n",
+                opts->phone_low_hz, opts->phone_high_hz, opts->sample_rate / 2);
+        return -1;
+    }
+
+    plan->frame_size = N;
+    plan->sample_rate = opts->sample_rate;
+    plan->num_bands = num_bands;
+    plan->band_layout = opts->band_layout;
+    plan->spectrum_bins = N / 2 + 1;
+    plan->mdct_hop = N / 2;
+    plan->phone_low_hz = opts->phone_low_hz;
+    plan->phone_high_hz = opts->phone_high_hz;
+    plan->mdct_window = opts->mdct_window;
+    plan->entropy_coding = opts->entropy_coding;
+    plan->masking_model = opts->masking_model;
+    plan->bfp_bits = opts->bfp_bits;
+    plan->psycho_side_bytes = opts->masking_model ? (plan->num_bands * ALLOC_BITS + 7) / 8 : 0;
+
+    init_phone_band_bins(plan);
+    init_band_config(plan);
+    init_masking_model(plan);
+    init_fft_tables(plan);
+    init_mdct_tables(plan);
+    init_plc_tables(plan);
+    if (select_fft_kernels(plan, opts->isa_name) < 0) return -1;
+    select_transform_kernels(plan, opts->generic_kernels);
+    plan->analyze = g_analyze_kernels[plan->isa_level];
+
+    // MDCT圧縮をビットストリームで送るときの長さ (心理音響圧縮はフレームごとに psycho_raw_bytes で求める)
+    int mdct_bits = 0;
+    for (int i = 0; i < plan->num_bands; i++) {
+        const BandConfig *b = &plan->bands[i];
+        int mdct_end = b->end_bin < plan->mdct_hop - 1 ? b->end_bin : plan->mdct_hop - 1;
+        mdct_bits += 8;
+        if (mdct_end >= b->start_bin) mdct_bits += (mdct_end - b->start_bin + 1) * (b->mag_bits + 1);
+    }
+    plan->mdct_raw_bytes = (mdct_bits + 7) / 8;
+
+    // 圧縮データの最大長 (心理音響: 2byte/ビン、MDCT: スケールファクタ + 1byte/係数、電話帯域: 8byte/ビン)
+    // レンジ符号の1記号は最悪で log2(RC_MAX_TOTAL) = 16bit になるので、符号化中のバッファは 3byte/ビン とする
+    // (エントロピー符号化ではどちらにもモードの1byte が付く)
+    int phone_bytes = plan->bfp_bits ? bfp_max_bytes(plan, plan->bfp_bits)
+                                     : (plan->phone_high_bin - plan->phone_low_bin + 1) * 2 * (int)sizeof(float);
+    int psycho_bytes = plan->psycho_side_bytes + entropy_mode_bytes(plan) + (plan->entropy_coding ? (N / 2) * 3 + 8 : N);
+    int mdct_bytes = entropy_mode_bytes(plan) + plan->num_bands + plan->mdct_hop * (plan->entropy_coding ? 3 : 1) + 8;
+    plan->max_payload = psycho_bytes;
+    if (mdct_bytes > plan->max_payload) plan->max_payload = mdct_bytes;
+    if (phone_bytes > plan->max_payload) plan->max_payload = phone_bytes;
+    return 0;
+}
@@ -0,0 +1,282 @@
+// i3_phone_fft の音声コーデック (変換エンジン・量子化・圧縮形式)
+// 送受信プログラム本体 (i3_phone_fft.c) とベンチマーク (bench_codec.c) から使う
+
+#ifndef I3_CODEC_H
+#define I3_CODEC_H
+
+#include "bitstream.h"
+#include "range_coder.h"
+
+// --- 設定項目 ---
+// 以下は既定値で、実行時にコマンドラインから変更できる (CodecOptions)
+// フレームサイズは4の倍数で、フレームサイズ/2 の素因数が 2, 3, 5 のみであること
+// (例: 1024, 或いは電話の標準パケット間隔に合わせた 160 = 16kHzで10ms, 320 = 20ms, 480 = 30ms)
+#define DEFAULT_FRAME_SIZE 1024     // FFTのフレームサイズ
+#define DEFAULT_SAMPLE_RATE 16000   // サンプリングレート (Hz)
+#define DEFAULT_NUM_BANDS 32        // 周波数帯域の分割数
+
+// 電話帯域の設定
+#define PHONE_BAND_LOW_HZ 300      // 電話帯域の下限 (Hz)
+#define PHONE_BAND_HIGH_HZ 3400    // 電話帯域の上限 (Hz)
+#define BFP_BLOCK_BINS 16          // 電話帯域のブロック浮動小数点で指数を共有するビン数
+
+// 静的に確保するバッファの上限
+#define MAX_FRAME_SIZE 4096         // フレームサイズの上限
+#define MAX_BANDS 64                // 帯域数の上限
+#define MAX_MAG_BITS 7              // 振幅の量子化ビット数の上限
+#define MAX_PHASE_BITS 4            // 位相の量子化ビット数の上限
+#define ALLOC_BITS 3                // マスキングモデルで帯域ごとに送る振幅のビット数の副情報 (0 〜 MAX_MAG_BITS)
+
+#define PI 3.14159265358979323846
+#define CACHE_LINE 64               // バッファの整列単位 (byte)
+
+// 実数信号のスペクトルで独立なビン数の上限 (0 〜 MAX_FRAME_SIZE/2)
+#define MAX_SPECTRUM_BINS (MAX_FRAME_SIZE / 2 + 1)
+// キャッシュライン単位に切り上げたスペクトル配列の長さ (float 16個 = 64byte)
+#define SPECTRUM_STRIDE ((MAX_SPECTRUM_BINS + 15) & ~15)
+// MDCTモードのホップ長の上限 (ホップ長はフレームサイズ/2)
+#define MAX_MDCT_HOP (MAX_FRAME_SIZE / 2)
+// 1フレームの圧縮データの上限 (電話帯域圧縮で全ビンを float の組で送る場合)
+#define MAX_PAYLOAD_BYTES (MAX_SPECTRUM_BINS * 2 * sizeof(float))
+// 圧縮データ用バッファの大きさ (展開時にビットストリームを8byte単位で読むための余白を含む)
+#define PAYLOAD_BUFFER_BYTES (MAX_PAYLOAD_BYTES + BITSTREAM_PADDING)
+// 標本化周波数変換 (取り込み・再生のレートとコーデックのレートの間) の上限
+#define MAX_RESAMPLE_TAPS 256       // 1位相あたりのタップ数の上限 (16の倍数に切り上げた値)
+#define MAX_RESAMPLE_COEFS 16384    // 全位相の係数の合計の上限 (例: 16000->44100 は 441 位相 x 32 タップ)
+#define RESAMPLE_BLOCK 1024         // 1回にまとめて変換する入力サンプル数 (これより長い入力は分けて処理する)
+// MDCT係数の振幅を量子化する範囲 (帯域のスケールファクタから下に何dBまでか)
+#define MDCT_RANGE_DB 48.0f
+// パケット損失の補間 (失われたフレームを直前のスペクトルから外挿する)
+#define PLC_DECAY 0.8f              // 補間1フレームごとの直前のスペクトルの減衰 (約 -2dB)
+#define PLC_FADE_FRAMES 6           // 続けてこのフレーム数を失うと背景雑音だけになる
+#define PLC_PHASES 64               // 補間の雑音の位相の種類 (単位円を等分した表を引く)
+
+// 単精度スペクトル (実部と虚部を別配列に持つ SoA 形式、キャッシュライン整列)
+typedef struct {
+    _Alignas(CACHE_LINE) float re[SPECTRUM_STRIDE]; // 実部 (Real part)
+    _Alignas(CACHE_LINE) float im[SPECTRUM_STRIDE]; // 虚部 (Imaginary part)
+} Spectrum;
+
+// 心理音響圧縮用の構造体
+typedef struct {
+    float magnitude;
+    float phase;
+    unsigned char quantized_mag;  // 量子化された振幅
+    unsigned char quantized_phase; // 量子化された位相
+} PsychoData;
+
+// 各周波数帯域の圧縮設定
+typedef struct {
+    int start_bin;      // 開始周波数ビン
+    int end_bin;        // 終了周波数ビン
+    int mag_bits;       // 振幅の量子化ビット数
+    int phase_bits;     // 位相の量子化ビット数
+    float threshold_db; // 最小可聴値 (dB)
+} BandConfig;
+
+// 圧縮方法の選択
+typedef enum {
+    COMPRESS_PSYCHOACOUSTIC = 1,  // 心理音響圧縮
+    COMPRESS_PHONE_BAND = 2,      // 電話帯域制限
+    COMPRESS_MDCT = 3             // MDCT (50%重なり) 符号化
+} CompressionMethod;
+
+// MDCTの窓関数
+typedef enum {
+    WINDOW_SINE = 0,  // 正弦窓
+    WINDOW_KBD = 1    // Kaiser-Bessel 派生窓
+} MdctWindow;
+
+// 周波数帯域の分け方
+typedef enum {
+    BAND_LAYOUT_LINEAR = 0,  // 等間隔
+    BAND_LAYOUT_BARK = 1,    // Bark 尺度で等間隔 (臨界帯域)
+    BAND_LAYOUT_ERB = 2      // ERB 尺度で等間隔
+} BandLayout;
+
+// コマンドラインから与えるコーデックの設定
+typedef struct {
+    int frame_size;          // フレームサイズ (サンプル数)
+    int sample_rate;         // サンプリングレート (Hz)
+    int num_bands;           // 周波数帯域の分割数 (0 なら分け方に合わせて自動)
+    BandLayout band_layout;  // 周波数帯域の分け方
+    int phone_low_hz;        // 電話帯域の下限 (Hz)
+    int phone_high_hz;       // 電話帯域の上限 (Hz)
+    MdctWindow mdct_window;  // MDCTの窓関数
+    const char *isa_name;    // FFTカーネルの命令セット (NULL なら CPU に合わせて自動選択)
+    int generic_kernels;     // 1 ならフレームサイズ特殊化カーネルを使わない (比較用)
+    int entropy_coding;      // 1 なら量子化後の振幅を適応レンジ符号で圧縮する
+    int masking_model;       // 1 なら心理音響圧縮のビット数をフレームごとのマスキングモデルで決める
+    int bfp_bits;            // 電話帯域の仮数のビット数 (8, 9, 10, 12, 16。0 なら float のまま送る)
+} CodecOptions;
+
+typedef struct CodecPlan CodecPlan;
+typedef void (*PlanFftFunc)(const CodecPlan *plan, float *re, float *im);
+typedef void (*PlanRfftFunc)(const CodecPlan *plan, const float *in, Spectrum *out);
+typedef void (*PlanIrfftFunc)(const CodecPlan *plan, Spectrum *in, float *out);
+typedef void (*PlanAnalyzeFunc)(const CodecPlan *plan, const Spectrum *spec,
+                                const float *mag_levels, const float *phase_levels,
+                                unsigned char *q_mag, unsigned char *q_phase);
+
+// コーデックのプラン: 設定から導いた形状、帯域設定、変換用の表と選択したカーネル
+// 起動時に codec_plan_init で一度だけ作り、以降は読み取り専用で全関数に渡す
+struct CodecPlan {
+    int frame_size;          // フレームサイズ N
+    int sample_rate;         // サンプリングレート (Hz)
+    int num_bands;           // 帯域数
+    BandLayout band_layout;  // 帯域の分け方
+    int spectrum_bins;       // 独立なビン数 (N/2+1)
+    int mdct_hop;            // MDCTモードのホップ長 (= 1ホップあたりの係数の数、窓長は N)
+    int max_payload;         // 1フレームの圧縮データの最大バイト数
+    int entropy_coding;      // 量子化後の振幅をレンジ符号化するか
+    int masking_model;       // 帯域のビット数をフレームごとに決めるか
+    int psycho_side_bytes;   // 心理音響圧縮の先頭の副情報 (帯域ごとのビット数) のバイト数
+    int mdct_raw_bytes;      // MDCT圧縮をビットストリームで送るときのバイト数
+    int bfp_bits;            // 電話帯域の仮数のビット数 (0 なら float)
+    int phone_low_hz, phone_high_hz;
+    int phone_low_bin, phone_high_bin;  // 電話帯域のビン番号
+    BandConfig bands[MAX_BANDS];        // 帯域設定
+
+    // 変換カーネル (フレームサイズに特殊化した版があればそれを、無ければ汎用版を指す)
+    const char *isa_name;    // 選択された命令セット名
+    int isa_level;           // 選択された命令セット (0 = スカラー)
+    int specialized;         // 特殊化カーネルを使っているか
+    PlanFftFunc fft_half;    // N/2 点の複素FFT (rfft/irfft 用)
+    PlanFftFunc fft_quarter; // N/4 点の複素FFT (MDCT 用)
+    PlanRfftFunc rfft;
+    PlanIrfftFunc irfft;
+    PlanAnalyzeFunc analyze; // 心理音響圧縮の振幅・位相の量子化 (命令セット別)
+
+    // 回転因子表とビット反転表 (表は倍精度で計算してから単精度に丸めて保持する)
+    int fft_log2;            // log2(N) (2のべき乗でなければ -1)
+    _Alignas(CACHE_LINE) float twiddle_re[MAX_FRAME_SIZE];        // Re W_N^k (一周分)
+    _Alignas(CACHE_LINE) float twiddle_im[MAX_FRAME_SIZE];        // Im W_N^k
+    _Alignas(CACHE_LINE) float stage_twiddle_re[MAX_FRAME_SIZE];  // 段ごとに連続に並べた回転因子 (半長 h の段は [h, 2h))
+    _Alignas(CACHE_LINE) float stage_twiddle_im[MAX_FRAME_SIZE];
+    int bitrev[MAX_FRAME_SIZE];                                   // log2(N) ビットでのビット反転
+
+    // 心理音響圧縮のビンごとの量子化パラメータ (帯域設定を展開したもの)
+    _Alignas(CACHE_LINE) float psy_threshold_db[MAX_SPECTRUM_BINS];  // 最小可聴値 (dB)
+    _Alignas(CACHE_LINE) float psy_mag_levels[MAX_SPECTRUM_BINS];    // 振幅の量子化段数 (2^mag_bits - 1)
+    _Alignas(CACHE_LINE) float psy_phase_levels[MAX_SPECTRUM_BINS];  // 位相の量子化段数 (2^phase_bits - 1)
+
+    // 心理音響展開の逆量子化表 (量子化値 -> 線形振幅、cos/sin(位相))
+    // b ビットの量子化値 q は [(1 << b) + q] に置く (全ビット数の表を1本に並べる)
+    _Alignas(CACHE_LINE) float psy_mag_lut[MAX_BANDS][2 << MAX_MAG_BITS];  // 帯域ごと (閾値で範囲が変わる)
+    _Alignas(CACHE_LINE) float psy_cos_lut[2 << MAX_PHASE_BITS];
+    _Alignas(CACHE_LINE) float psy_sin_lut[2 << MAX_PHASE_BITS];
+
+    // マスキングモデル
+    float band_bark[MAX_BANDS];                 // 帯域の中心周波数 (Bark)
+    float band_spread[MAX_BANDS][MAX_BANDS];    // 帯域 j のエネルギーが帯域 b に広がる割合 [j][b] (パワー比)
+
+    // MDCT の窓と DCT-IV の回転因子
+    MdctWindow mdct_window;
+    _Alignas(CACHE_LINE) float mdct_window_coefs[MAX_FRAME_SIZE];  // 分析・合成窓 (Princen-Bradley 条件を満たす)
+    _Alignas(CACHE_LINE) float mdct_pre_re[MAX_FRAME_SIZE / 4];    // DCT-IV 前段の回転 exp(-iπ(4n+1)/(4M))
+    _Alignas(CACHE_LINE) float mdct_pre_im[MAX_FRAME_SIZE / 4];
+    _Alignas(CACHE_LINE) float mdct_post_re[MAX_FRAME_SIZE / 4];   // DCT-IV 後段の回転 exp(-iπk/M)
+    _Alignas(CACHE_LINE) float mdct_post_im[MAX_FRAME_SIZE / 4];
+
+    // パケット損失の補間の雑音の位相 (cos/sin(2πi/PLC_PHASES))
+    _Alignas(CACHE_LINE) float plc_cos[PLC_PHASES];
+    _Alignas(CACHE_LINE) float plc_sin[PLC_PHASES];
+};
+
+// 目標ビットレートのレート制御の状態 (心理音響圧縮 + マスキングモデル用)
+// プランと違いフレームごとに更新するので、送信側が1つずつ持つ
+typedef struct {
+    int frame_bits;          // 1フレームあたりの平均の予算 (ビット)
+    int peak_bytes;          // 1フレームの上限 (バイト)
+    int reservoir_bits;      // ビットリザーバ (使い残しの蓄え、ビット)
+    int reservoir_max_bits;  // 蓄えの上限 (= peak_bytes*8 - frame_bits)
+    int step;                // 直前のフレームで選んだ量子化ステップ
+} RateControl;
+
+// 標本化周波数変換 (有理数比 L/M のポリフェーズ FIR) の状態
+// 係数は作成時に計算して読み取り専用、履歴はブロックごとに更新するので、変換の向きごとに1つずつ持つ
+typedef float (*ResampleDotFunc)(const float *x, const float *h, int n);
+typedef struct {
+    int in_rate, out_rate;   // 入力・出力のサンプリングレート (Hz)
+    int up, down;            // 約分した比 L = 出力/g, M = 入力/g
+    int taps;                // 1位相あたりのタップ数 (16の倍数。末尾の余りの係数は 0)
+    int phase;               // 次の出力の位相 (0 〜 L-1)
+    int next_input;          // 次の出力の窓の先頭 (history 内の位置)
+    ResampleDotFunc dot;     // 積和のカーネル (プランの命令セットに合わせる)
+    _Alignas(CACHE_LINE) float coefs[MAX_RESAMPLE_COEFS];  // 位相 p の係数を [p*taps, (p+1)*taps) に時間の逆順で置く
+    _Alignas(CACHE_LINE) float history[MAX_RESAMPLE_TAPS + RESAMPLE_BLOCK];  // 前回の末尾 taps-1 個 + 今回の入力
+} Resampler;
+
+// パケット損失の補間の状態 (受信側がフレームをまたいで持つ)
+// 正常に復号したフレームのスペクトルを覚えておき、失われたフレームは振幅を減衰させながら繰り返し、
+// 位相は直前の2フレームの差だけ進める。続けて失われると背景雑音 (パワーの下側を追った値、位相は乱数) へ移る
+// 正常なフレームでは複製とパワーの追跡だけを行い、位相の進みは補間を始めるときに求める
+// MDCTモードでは re に直前の係数を持ち、2フレーム目からは符号を乱数で反転する
+typedef struct {
+    int valid;               // 正常に復号したフレームがあるか
+    int lost;                // 続けて失われたフレーム数 (0 なら直前は正常に復号した)
+    int good;                // 続けて正常に復号したフレーム数 (2 以上なら位相の進みを測れる)
+    uint32_t seed;           // 雑音の位相・符号の乱数の状態
+    _Alignas(CACHE_LINE) float re[SPECTRUM_STRIDE];       // 直前のスペクトル (補間中は位相を進めたもの)
+    _Alignas(CACHE_LINE) float im[SPECTRUM_STRIDE];
+    _Alignas(CACHE_LINE) float prev_re[SPECTRUM_STRIDE];  // その1つ前のスペクトル
+    _Alignas(CACHE_LINE) float prev_im[SPECTRUM_STRIDE];
+    _Alignas(CACHE_LINE) float rot_re[SPECTRUM_STRIDE];   // 1フレームあたりの位相の進み (単位複素数)
+    _Alignas(CACHE_LINE) float rot_im[SPECTRUM_STRIDE];
+    _Alignas(CACHE_LINE) float noise[SPECTRUM_STRIDE];    // 背景雑音のパワー
+} PlcState;
+
+// --- プラン ---
+void codec_default_options(CodecOptions *opts);
+int codec_plan_init(CodecPlan *plan, const CodecOptions *opts);
+int codec_isa_level(const char *isa_name);
+void print_band_config(const CodecPlan *plan);
+
+// --- 電話帯域制限機能 ---
+void apply_phone_band_filter(const CodecPlan *plan, Spectrum *fft_data);
+void phone_band_compress(const CodecPlan *plan, const Spectrum *fft_data,
+                         unsigned char *compressed_data, int *compressed_size);
+void phone_band_decompress(const CodecPlan *plan, unsigned char *compressed_data,
+                           Spectrum *fft_data, int compressed_size);
+
+// --- 心理音響モデル ---
+float absolute_threshold_db(float freq_hz);
+unsigned char quantize_value(float value, int bits, float min_val, float max_val);
+float dequantize_value(unsigned char quantized, int bits, float min_val, float max_val);
+void psychoacoustic_compress(const CodecPlan *plan, const Spectrum *fft_data,
+                             unsigned char *compressed_data, int *compressed_size);
+int psychoacoustic_decompress(const CodecPlan *plan, unsigned char *compressed_data,
+                              Spectrum *fft_data, int compressed_size);
+
+// --- レート制御 ---
+int rate_control_init(RateControl *rc, const CodecPlan *plan, float kbps, int peak_bytes, int overhead_bytes);
+void psychoacoustic_compress_rate(const CodecPlan *plan, RateControl *rc, const Spectrum *fft_data,
+                                  unsigned char *compressed_data, int *compressed_size);
+
+// --- 標本化周波数変換 ---
+int resampler_init(Resampler *rs, const CodecPlan *plan, int in_rate, int out_rate);
+int resampler_max_output(const Resampler *rs, int n);
+int resampler_process(Resampler *rs, const short *in, int n, short *out);
+
+// --- FFT / IFFT ---
+void fft(const CodecPlan *plan, float *re, float *im, int N);
+void ifft(const CodecPlan *plan, float *re, float *im, int N);
+void rfft(const CodecPlan *plan, const float *in, Spectrum *out);
+void irfft(const CodecPlan *plan, Spectrum *in, float *out);
+
+// --- パケット損失の補間 ---
+void plc_init(PlcState *plc);
+void plc_update(const CodecPlan *plan, PlcState *plc, const Spectrum *spec);
+void plc_conceal(const CodecPlan *plan, PlcState *plc, Spectrum *spec);
+void plc_update_mdct(const CodecPlan *plan, PlcState *plc, const float *coefs);
+void plc_conceal_mdct(const CodecPlan *plan, PlcState *plc, float *coefs);
+
+// --- MDCT ---
+void mdct_forward(const CodecPlan *plan, const float *x, float *X);
+void mdct_inverse(const CodecPlan *plan, const float *X, float *y);
+void mdct_compress(const CodecPlan *plan, const float *coefs,
+                   unsigned char *compressed_data, int *compressed_size);
+int mdct_decompress(const CodecPlan *plan, unsigned char *compressed_data,
+                    float *coefs, int compressed_size);
+
+#endif
@@ -7,82 +7,182 @@
 // [圧縮モード (例: 1/2に間引く)]
 // サーバー: rec ... | ./phone 50000 2 | play ...
 // クライアント: rec ... | ./phone <ip> 50000 2 | play ...
+//
+// 音声は BLOCK_SAMPLES サンプルごとのパケット (BlockHeader + サンプル) で送る
+// 圧縮モードでは低域通過フィルタをかけてから 1/rate に間引き、受信側はヘッダの rate で元のレートへ補間する
+// (どちらも i3_codec のポリフェーズ変換器。rate は送信側ごとに決めてよい)
+// 送信と受信は1つのプロセスのイベントループで回し、標準入力の終わりまで送ったら相手に送信の終わりを知らせる
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
-#include <sys/wait.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
 #include <stdint.h> // int16_t を使うために追加
 
-#define BUFFER_SIZE 1024
+#include "i3_codec.h"
+#include "event_loop.h"
+
+#define BLOCK_SAMPLES 512     // 1パケットにまとめる入力サンプル数 (44.1kHz で約12ms)
+#define MAX_RATE 10           // 間引き率の上限 (低域通過フィルタのタップ数の上限から)
+#define NOMINAL_RATE_HZ 8000  // 変換器に渡す間引き後の名目上のレート (変換器は比だけを使う)
+
+// パケットの先頭
+typedef struct {
+    int32_t rate;     // 送信側の間引き率 (1 なら間引いていない)
+    int32_t samples;  // 続くサンプル数
+} BlockHeader;
 
 int socket_fd = -1;
 int server_socket = -1;
-pid_t sender_pid = -1;
-pid_t receiver_pid = -1;
 
 // クリーンアップ
 void cleanup() {
-    if (sender_pid > 0) kill(sender_pid, SIGTERM);
-    if (receiver_pid > 0) kill(receiver_pid, SIGTERM);
     if (socket_fd >= 0) close(socket_fd);
     if (server_socket >= 0) close(server_socket);
 }
 
 void signal_handler(int sig) {
+    ev_restore_on_exit();  // 標準入出力を非ブロッキングのまま残さない
     cleanup();
     exit(0);
 }
 
-// 送信プロセス: 標準入力 → (圧縮) → ソケット
-// rate > 1 の場合に、音声データを間引いて圧縮する
-void audio_sender(int sock_fd, int rate) {
-    // 圧縮しない場合 (rateが1以下) は、バッファ単位で高速に転送
-    if (rate <= 1) {
-        unsigned char buffer[BUFFER_SIZE];
-        ssize_t bytes_read;
-        while ((bytes_read = read(STDIN_FILENO, buffer, BUFFER_SIZE)) > 0) {
-            if (write(sock_fd, buffer, bytes_read) < 0) {
-                perror("write");
-                break;
+// 送信: 1ブロックを (圧縮して) 1パケットにし、ソケットへ書く (書ききれない分は sock_out に溜める)
+// rate > 1 の場合に、低域通過フィルタをかけてから間引いて圧縮する
+int send_block(int sock_fd, EvBuffer *sock_out, Resampler *decimator, int rate, const int16_t *block) {
+    struct {
+        BlockHeader header;
+        int16_t samples[BLOCK_SAMPLES + 1];
+    } packet;
+
+    packet.header.rate = rate;
+    if (rate > 1) {
+        packet.header.samples = resampler_process(decimator, block, BLOCK_SAMPLES, packet.samples);
+    } else {
+        memcpy(packet.samples, block, BLOCK_SAMPLES * sizeof(int16_t));
+        packet.header.samples = BLOCK_SAMPLES;
+    }
+    int bytes = sizeof(BlockHeader) + packet.header.samples * sizeof(int16_t);
+    return ev_write(sock_out, sock_fd, &packet, bytes);
+}
+
+// 受信: 溜めた中の揃ったパケットを (伸長して) output に足す (-1 = 壊れたパケット)
+// 送信側が間引いていれば、ヘッダの rate 倍に補間して元のレートに戻す
+int receive_blocks(EvBuffer *sock_in, EvBuffer *output, Resampler *interpolator, int *interpolator_rate) {
+    int16_t samples[BLOCK_SAMPLES + 1];
+    int16_t interpolated[(BLOCK_SAMPLES + 1) * MAX_RATE + 1];
+    BlockHeader header;
+
+    while (ev_buffered(sock_in) >= (int)sizeof(header)) {
+        memcpy(&header, ev_peek(sock_in), sizeof(header));
+        if (header.rate < 1 || header.rate > MAX_RATE ||
+            header.samples < 0 || header.samples > BLOCK_SAMPLES + 1) {
+            fprintf(stderr, "Invalid packet header (rate %d, %d samples)\n", header.rate, header.samples);
+            return -1;
+        }
+        int bytes = sizeof(header) + header.samples * sizeof(int16_t);
+        if (ev_buffered(sock_in) < bytes) break;
+        memcpy(samples, ev_peek(sock_in) + sizeof(header), header.samples * sizeof(int16_t));
+        ev_consume(sock_in, bytes);
+
+        const int16_t *out = samples;
+        int count = header.samples;
+        if (header.rate > 1) {
+            if (header.rate != *interpolator_rate) {
+                if (resampler_init(interpolator, NULL, NOMINAL_RATE_HZ, header.rate * NOMINAL_RATE_HZ) < 0) return -1;
+                *interpolator_rate = header.rate;
             }
+            count = resampler_process(interpolator, samples, header.samples, interpolated);
+            out = interpolated;
         }
-    } else {
-        // 圧縮する場合 (rate > 1) は、サンプル単位で処理
-        int16_t sample;
-        int count = 0;
-        // freadで標準入力から1サンプル(16bit = 2bytes)ずつ読み込む
-        while (fread(&sample, sizeof(int16_t), 1, stdin) == 1) {
-            // countがrateの倍数の時だけサンプルを送信
-            if (count % rate == 0) {
-                if (write(sock_fd, &sample, sizeof(int16_t)) < 0) {
+        if (ev_append(output, out, count * sizeof(int16_t)) < 0) return -1;
+    }
+    return 0;
+}
+
+// 通話: 標準入力 → (圧縮) → ソケット と ソケット → (伸長) → 標準出力 を1つのプロセスで回す (event_loop.h)
+// 標準入力の終わりまで送ったら shutdown(SHUT_WR) で相手に知らせ、相手が閉じるまで受けて書ききったら戻る
+int run_call(int sock_fd, int rate) {
+    static Resampler decimator, interpolator;
+    int interpolator_rate = 0;  // interpolator を作ったときの rate
+    int16_t block[BLOCK_SAMPLES];
+    EventLoop loop;
+    EvBuffer input = {0}, sock_out = {0}, sock_in = {0}, output = {0};  // 準備の途中で失敗しても解放できるように空にしておく
+    int input_open = 1, send_done = 0, recv_done = 0;
+
+    if (rate > 1 && resampler_init(&decimator, NULL, rate * NOMINAL_RATE_HZ, NOMINAL_RATE_HZ) < 0) return -1;
+    if (ev_init(&loop) < 0 ||
+        ev_buffer_init(&input, EV_READ_BYTES) < 0 || ev_buffer_init(&sock_out, EV_READ_BYTES) < 0 ||
+        ev_buffer_init(&sock_in, EV_READ_BYTES) < 0 || ev_buffer_init(&output, EV_READ_BYTES) < 0 ||
+        ev_add(&loop, STDIN_FILENO, EPOLLIN) < 0 || ev_add(&loop, sock_fd, EPOLLIN) < 0 ||
+        ev_add(&loop, STDOUT_FILENO, 0) < 0) {
+        perror("event loop");
+        ev_free(&loop);
+        ev_buffer_free(&input);
+        ev_buffer_free(&sock_out);
+        ev_buffer_free(&sock_in);
+        ev_buffer_free(&output);
+        return -1;
+    }
+
+    while (!send_done || !recv_done || ev_buffered(&output) > 0) {
+        // 書ききれない出力が溜まっている間は、そこへ流し込む入力を待たない
+        ev_set_events(&loop, STDIN_FILENO, (input_open && ev_buffered(&sock_out) < EV_HIGH_WATER) ? EPOLLIN : 0);
+        ev_set_events(&loop, sock_fd, (!recv_done && ev_buffered(&output) < EV_HIGH_WATER ? EPOLLIN : 0) |
+                                      (ev_buffered(&sock_out) > 0 ? EPOLLOUT : 0));
+        ev_set_events(&loop, STDOUT_FILENO, ev_buffered(&output) > 0 ? EPOLLOUT : 0);
+        if (ev_wait(&loop, -1) < 0) {
+            perror("epoll_wait");
+            break;
+        }
+
+        // 標準入力 → ソケット (揃ったブロックから送り、最後の半端なブロックは捨てる)
+        if (ev_ready(&loop, STDIN_FILENO) & EPOLLIN) {
+            int got = ev_read(&input, STDIN_FILENO);
+            if (got == 0 || got == -1) input_open = 0;
+            while (ev_buffered(&input) >= (int)sizeof(block)) {
+                memcpy(block, ev_peek(&input), sizeof(block));
+                ev_consume(&input, sizeof(block));
+                if (send_block(sock_fd, &sock_out, &decimator, rate, block) < 0) {
                     perror("write");
+                    input_open = 0;
                     break;
                 }
             }
-            count++;
         }
-    }
-    exit(0);
-}
+        if (!send_done && ev_buffered(&sock_out) > 0 && ev_flush(&sock_out, sock_fd) < 0) {
+            perror("write");
+            input_open = 0;
+            ev_consume(&sock_out, ev_buffered(&sock_out));
+        }
+        if (!send_done && !input_open && ev_buffered(&sock_out) == 0) {
+            shutdown(sock_fd, SHUT_WR);
+            send_done = 1;
+        }
 
-// 受信プロセス: ソケット → 標準出力
-void audio_receiver(int sock_fd) {
-    unsigned char buffer[BUFFER_SIZE];
-    ssize_t bytes_read;
-    
-    while ((bytes_read = read(sock_fd, buffer, BUFFER_SIZE)) > 0) {
-        if (write(STDOUT_FILENO, buffer, bytes_read) < 0) {
+        // ソケット → 標準出力
+        if (!recv_done && (ev_ready(&loop, sock_fd) & EPOLLIN)) {
+            int got = ev_read(&sock_in, sock_fd);
+            if (got == 0 || got == -1) recv_done = 1;
+            if (receive_blocks(&sock_in, &output, &interpolator, &interpolator_rate) < 0) recv_done = 1;
+        }
+        if (ev_buffered(&output) > 0 && ev_flush(&output, STDOUT_FILENO) < 0) {
             perror("write to stdout");
-            break;
+            recv_done = 1;
+            ev_consume(&output, ev_buffered(&output));
         }
     }
-    exit(0);
+
+    ev_free(&loop);
+    ev_buffer_free(&input);
+    ev_buffer_free(&sock_out);
+    ev_buffer_free(&sock_in);
+    ev_buffer_free(&output);
+    return 0;
 }
 
 // サーバーモード
@@ -170,26 +270,18 @@ int main(int argc, char **argv) {
         fprintf(stderr, "Rate must be a positive integer.\n");
         rate = 1;
     }
-    if (rate > 1) {
-        fprintf(stderr, "Compression mode enabled: 1/%d sampling.\n", rate);
+    if (rate > MAX_RATE) {
+        fprintf(stderr, "Rate %d is too large, using %d.\n", rate, MAX_RATE);
+        rate = MAX_RATE;
     }
-    
-    // 送信プロセス: 標準入力 → ソケット
-    sender_pid = fork();
-    if (sender_pid == 0) {
-        // 圧縮率を渡す
-        audio_sender(socket_fd, rate);
-    }
-    
-    // 受信プロセス: ソケット → 標準出力
-    receiver_pid = fork();
-    if (receiver_pid == 0) {
-        audio_receiver(socket_fd);
+    if (rate > 1) {
+        fprintf(stderr, "Compression mode enabled: 1/%d sampling (low-pass filtered, %d-sample blocks).\n",
+                rate, BLOCK_SAMPLES);
     }
     
-    // 親プロセス: 子プロセスの終了を待機
-    wait(NULL);
+    int status = run_call(socket_fd, rate) < 0 ? 1 : 0;
     cleanup();
-    
-    return 0;
+
+    return status;
 }
+
@@ -3,442 +3,680 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
-#include <sys/wait.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
 #include <math.h>
 
-// --- 設定項目 ---
-#define FRAME_SIZE 1024             // FFTのフレームサイズ (必ず2のべき乗にすること)
-#define SAMPLE_RATE 16000           // サンプリングレート (Hz)
-#define NUM_BANDS 32                // 周波数帯域の分割数
-
-// 電話帯域の設定
-#define PHONE_BAND_LOW_HZ 300      // 電話帯域の下限 (Hz)
-#define PHONE_BAND_HIGH_HZ 3400    // 電話帯域の上限 (Hz)
-
-#define PI 3.14159265358979323846
-
-// 1フレームあたりのデータサイズ (16bit = 2byte)
-#define FRAME_BYTES (FRAME_SIZE * sizeof(short))
-// FFT後の複素数データのサイズ
-#define FFT_BYTES (FRAME_SIZE * sizeof(Complex))
-
-// 複素数を扱うための構造体
-typedef struct {
-    double re; // 実部 (Real part)
-    double im; // 虚部 (Imaginary part)
-} Complex;
-
-// 心理音響圧縮用の構造体
-typedef struct {
-    float magnitude;
-    float phase;
-    unsigned char quantized_mag;  // 量子化された振幅
-    unsigned char quantized_phase; // 量子化された位相
-} PsychoData;
-
-// 各周波数帯域の圧縮設定
-typedef struct {
-    int start_bin;      // 開始周波数ビン
-    int end_bin;        // 終了周波数ビン
-    int mag_bits;       // 振幅の量子化ビット数
-    int phase_bits;     // 位相の量子化ビット数
-    float threshold_db; // 最小可聴値 (dB)
-} BandConfig;
-
-// 圧縮方法の選択
-typedef enum {
-    COMPRESS_PSYCHOACOUSTIC = 1,  // 心理音響圧縮
-    COMPRESS_PHONE_BAND = 2       // 電話帯域制限
-} CompressionMethod;
+#include "i3_codec.h"
+#include "vad.h"
+#include "rtp.h"
+#include "jitter_buffer.h"
+#include "fec.h"
+#include "wire.h"
+#include "event_loop.h"
 
 // グローバル変数
 CompressionMethod g_compression_method = COMPRESS_PSYCHOACOUSTIC;
-int g_phone_band_low_bin, g_phone_band_high_bin;  // 電話帯域のビン番号
 
-// --- 電話帯域制限機能 ---
+// --- 電話プログラム本体 ---
 
-// 電話帯域のビン番号を計算
-void init_phone_band_bins() {
-    g_phone_band_low_bin = (int)((float)PHONE_BAND_LOW_HZ * FRAME_SIZE / SAMPLE_RATE);
-    g_phone_band_high_bin = (int)((float)PHONE_BAND_HIGH_HZ * FRAME_SIZE / SAMPLE_RATE);
-    
-    // 範囲チェック
-    if (g_phone_band_low_bin < 0) g_phone_band_low_bin = 0;
-    if (g_phone_band_high_bin >= FRAME_SIZE/2) g_phone_band_high_bin = FRAME_SIZE/2 - 1;
-    
-    fprintf(stderr, "Phone band filtering: %d Hz - %d Hz (bins %d - %d)\n",
-            PHONE_BAND_LOW_HZ, PHONE_BAND_HIGH_HZ, 
-            g_phone_band_low_bin, g_phone_band_high_bin);
+int socket_fd = -1;
+int server_socket = -1;
+CodecPlan g_plan;  // コーデックのプラン (起動時にコマンドラインから作る)
+RateControl g_rate;    // 目標ビットレートのレート制御 (送信側だけが更新する)
+int g_rate_control = 0;  // --bitrate が指定されたか
+int g_dtx = 0;  // --dtx: 無音フレームは送らず雑音記述子だけを送る
+int g_capture_rate = 0;  // 標準入出力の PCM のサンプリングレート (コーデックと違えば変換する)
+Resampler g_capture_resampler;  // 取り込み -> コーデック (送信側が使う)
+Resampler g_playout_resampler;  // コーデック -> 再生 (受信側が使う)
+int g_udp = 0;  // --udp: 1フレームを1つの RTP パケットにして UDP で送る
+int g_jitter_buffer = 0;  // --jitter-buffer: 受信したフレームをジッタバッファに溜めて一定の間隔で再生する
+int g_fec_k = 0;  // --fec: K フレームごとに XOR のパリティを送る (0 なら送らない)
+WireReader g_wire;  // TCP の受信の溜め置き
+EvBuffer g_output;  // 標準出力へ書ききれなかった再生のサンプル
+
+#define CAPTURE_CHUNK 256  // レート変換するときに標準入力の溜め置きから一度に変換するサンプル数
+#define MAX_CAPTURE_RATIO 16  // 取り込みのレートとコーデックのレートの比の上限 (変換用バッファの大きさを決める)
+
+void cleanup() {
+    if (socket_fd >= 0) close(socket_fd);
+    if (server_socket >= 0) close(server_socket);
+}
+
+void signal_handler(int sig) {
+    ev_restore_on_exit();  // 標準入出力を非ブロッキングのまま残さない
+    cleanup();
+    exit(0);
 }
 
-// 電話帯域制限を適用
-void apply_phone_band_filter(Complex *fft_data) {
-    // 低周波成分を0にする
-    for (int i = 0; i < g_phone_band_low_bin; i++) {
-        fft_data[i].re = 0.0;
-        fft_data[i].im = 0.0;
-        // 対称成分も0にする
-        fft_data[FRAME_SIZE - 1 - i].re = 0.0;
-        fft_data[FRAME_SIZE - 1 - i].im = 0.0;
+// 標準入力から溜めた中からコーデックのレートで n サンプル取り出す (取り込みのレートが違えば変換する)
+// まだ足りなければ -1 を返す (入力の終わりの半端なサンプルは使わない)
+int take_codec_samples(EvBuffer *input, short *pcm, int n) {
+    if (g_capture_rate == g_plan.sample_rate) {
+        if (ev_buffered(input) < n * (int)sizeof(short)) return -1;
+        memcpy(pcm, ev_peek(input), n * sizeof(short));
+        ev_consume(input, n * sizeof(short));
+        return 0;
     }
-    
-    // 高周波成分を0にする
-    for (int i = g_phone_band_high_bin + 1; i < FRAME_SIZE/2; i++) {
-        fft_data[i].re = 0.0;
-        fft_data[i].im = 0.0;
-        // 対称成分も0にする
-        fft_data[FRAME_SIZE - i].re = 0.0;
-        fft_data[FRAME_SIZE - i].im = 0.0;
+
+    // 変換した余りを次のフレームへ持ち越す
+    static short pending[MAX_FRAME_SIZE + CAPTURE_CHUNK * MAX_CAPTURE_RATIO + 1];
+    static int pending_count = 0;
+    short chunk[CAPTURE_CHUNK];
+    while (pending_count < n) {
+        if (ev_buffered(input) < (int)sizeof(chunk)) return -1;
+        memcpy(chunk, ev_peek(input), sizeof(chunk));
+        ev_consume(input, sizeof(chunk));
+        pending_count += resampler_process(&g_capture_resampler, chunk, CAPTURE_CHUNK, pending + pending_count);
     }
+    memcpy(pcm, pending, n * sizeof(short));
+    pending_count -= n;
+    memmove(pending, pending + n, pending_count * sizeof(short));
+    return 0;
 }
 
-// 電話帯域データの圧縮（有効な帯域のみ送信）
-void phone_band_compress(Complex *fft_data, unsigned char *compressed_data, int *compressed_size) {
-    int write_pos = 0;
-    
-    // 有効な帯域のみを圧縮データに格納
-    for (int i = g_phone_band_low_bin; i <= g_phone_band_high_bin; i++) {
-        // 実部と虚部を float として格納
-        float real_part = (float)fft_data[i].re;
-        float imag_part = (float)fft_data[i].im;
-        
-        memcpy(&compressed_data[write_pos], &real_part, sizeof(float));
-        write_pos += sizeof(float);
-        memcpy(&compressed_data[write_pos], &imag_part, sizeof(float));
-        write_pos += sizeof(float);
+// コーデックのレートの n サンプルを標準出力へ書く (再生のレートが違えば変換する)
+// 実際に書くのはイベントループが標準出力に書けるとき (g_output に溜める)
+void write_playout_samples(const short *pcm, int n) {
+    if (g_capture_rate == g_plan.sample_rate) {
+        ev_append(&g_output, pcm, n * sizeof(short));
+        return;
     }
-    
-    *compressed_size = write_pos;
+    static short converted[MAX_FRAME_SIZE * MAX_CAPTURE_RATIO + 1];
+    int count = resampler_process(&g_playout_resampler, pcm, n, converted);
+    ev_append(&g_output, converted, count * sizeof(short));
 }
 
-// 電話帯域データの展開
-void phone_band_decompress(unsigned char *compressed_data, Complex *fft_data, int compressed_size) {
-    // FFTバッファを初期化
-    memset(fft_data, 0, FRAME_SIZE * sizeof(Complex));
-    
-    int read_pos = 0;
-    
-    // 有効な帯域のデータを復元
-    for (int i = g_phone_band_low_bin; i <= g_phone_band_high_bin && read_pos < compressed_size; i++) {
-        if (read_pos + sizeof(float) * 2 > compressed_size) break;
-        
-        float real_part, imag_part;
-        memcpy(&real_part, &compressed_data[read_pos], sizeof(float));
-        read_pos += sizeof(float);
-        memcpy(&imag_part, &compressed_data[read_pos], sizeof(float));
-        read_pos += sizeof(float);
-        
-        fft_data[i].re = (double)real_part;
-        fft_data[i].im = (double)imag_part;
-        
-        // 対称性を保つ（実数信号のため）
-        if (i > 0 && i < FRAME_SIZE/2) {
-            fft_data[FRAME_SIZE - i].re = fft_data[i].re;
-            fft_data[FRAME_SIZE - i].im = -fft_data[i].im;
-        }
-    }
+// 1フレームの前に付けるヘッダのバイト数 (TCP は wire.h の見出しで、長さ 128〜16383 byte のとき。UDP は RTP ヘッダ)
+int frame_header_bytes(void) {
+    return g_udp ? RTP_HEADER_BYTES : wire_header_bytes(128);
 }
 
-// --- 心理音響モデル ---
+// 圧縮方法に対応する RTP のペイロードタイプ (TCP のコーデックの番号も同じ)
+int method_payload_type(CompressionMethod method) {
+    return (method == COMPRESS_PHONE_BAND) ? RTP_PT_PHONE_BAND
+         : (method == COMPRESS_MDCT) ? RTP_PT_MDCT : RTP_PT_PSYCHOACOUSTIC;
+}
 
-// 絶対聴覚閾値の近似式 (Bark scale based)
-float absolute_threshold_db(float freq_hz) {
-    if (freq_hz < 20) return 80.0f;
-    if (freq_hz > 16000) return 60.0f;
-    
-    // 簡略化された絶対聴覚閾値曲線
-    float bark = 13.0f * atan(0.00076f * freq_hz) + 3.5f * atan(pow(freq_hz / 7500.0f, 2));
-    float threshold = 3.64f * pow(freq_hz / 1000.0f, -0.8f) 
-                     - 6.5f * exp(-0.6f * pow(freq_hz / 1000.0f - 3.3f, 2)) 
-                     + 0.001f * pow(freq_hz / 1000.0f, 4);
-    
-    // 低周波と高周波でのペナルティ
-    if (freq_hz < 500) threshold += 20.0f;
-    if (freq_hz > 8000) threshold += 10.0f;
-    
-    return threshold;
+int codec_payload_type(void) {
+    return method_payload_type(g_compression_method);
 }
 
-// 周波数帯域の設定を初期化
-void init_band_config(BandConfig bands[NUM_BANDS]) {
-    int bins_per_band = (FRAME_SIZE / 2) / NUM_BANDS;
-    
-    for (int i = 0; i < NUM_BANDS; i++) {
-        bands[i].start_bin = i * bins_per_band;
-        bands[i].end_bin = (i + 1) * bins_per_band - 1;
-        if (i == NUM_BANDS - 1) bands[i].end_bin = FRAME_SIZE / 2 - 1;
-        
-        // 中心周波数を計算
-        float center_freq = ((float)(bands[i].start_bin + bands[i].end_bin) / 2.0f) 
-                           * SAMPLE_RATE / FRAME_SIZE;
-        
-        // 絶対聴覚閾値を取得
-        bands[i].threshold_db = absolute_threshold_db(center_freq);
-        
-        // 閾値に基づいてビット数を決定
-        if (bands[i].threshold_db > 40.0f) {
-            // 聞こえにくい帯域: 低ビット
-            bands[i].mag_bits = 3;
-            bands[i].phase_bits = 2;
-        } else if (bands[i].threshold_db > 20.0f) {
-            // 中程度の帯域: 中ビット
-            bands[i].mag_bits = 5;
-            bands[i].phase_bits = 3;
-        } else {
-            // 聞こえやすい帯域: 高ビット
-            bands[i].mag_bits = 7;
-            bands[i].phase_bits = 4;
-        }
-        
-        fprintf(stderr, "Band %d: %.1f-%.1f Hz, Threshold: %.1f dB, Bits: %d/%d\n",
-                i, 
-                bands[i].start_bin * (float)SAMPLE_RATE / FRAME_SIZE,
-                bands[i].end_bin * (float)SAMPLE_RATE / FRAME_SIZE,
-                bands[i].threshold_db,
-                bands[i].mag_bits, bands[i].phase_bits);
-    }
+// ペイロードタイプに対応する圧縮方法 (知らない番号なら 0)
+CompressionMethod payload_type_method(int payload_type) {
+    return (payload_type == RTP_PT_PSYCHOACOUSTIC) ? COMPRESS_PSYCHOACOUSTIC
+         : (payload_type == RTP_PT_PHONE_BAND) ? COMPRESS_PHONE_BAND
+         : (payload_type == RTP_PT_MDCT) ? COMPRESS_MDCT : (CompressionMethod)0;
 }
 
-// 量子化関数
-unsigned char quantize_value(float value, int bits, float min_val, float max_val) {
-    int levels = (1 << bits) - 1;  // 2^bits - 1
-    float normalized = (value - min_val) / (max_val - min_val);
-    normalized = fmaxf(0.0f, fminf(1.0f, normalized));  // クランプ
-    return (unsigned char)(normalized * levels);
+// 送信側の状態 (フレームをまたいで持つ)
+typedef struct {
+    _Alignas(CACHE_LINE) float time_buffer[MAX_FRAME_SIZE];  // MDCTモードでは直前のホップ
+    VadState vad;
+    RtpSender rtp;
+    uint32_t timestamp;          // 送ったサンプル数 (コーデックのレート)
+    VadDecision last_decision;   // 有音区間の先頭に RTP のマーカーを付けるため
+    uint16_t sequence;           // TCP の見出しのシーケンス番号
+    // パリティは別のシーケンス番号で送る (受信側のフレームの欠落の数え方を変えないため)
+    // フレームの番号はタイムスタンプ / read_samples (タイムスタンプは 0 から始める)
+    RtpSender fec_rtp;
+    FecEncoder fec;
+    EvBuffer sock_out;           // TCP でソケットに書ききれなかったフレーム
+} Encoder;
+
+int encoder_init(Encoder *enc) {
+    memset(enc, 0, sizeof(*enc));
+    vad_init(&enc->vad);
+    rtp_sender_init(&enc->rtp);
+    rtp_sender_init(&enc->fec_rtp);
+    enc->last_decision = VAD_SID;
+    if (g_fec_k && fec_encoder_init(&enc->fec, g_fec_k, g_plan.max_payload) < 0) return -1;
+    return ev_buffer_init(&enc->sock_out, EV_READ_BYTES);
 }
 
-// 逆量子化関数
-float dequantize_value(unsigned char quantized, int bits, float min_val, float max_val) {
-    int levels = (1 << bits) - 1;  // 2^bits - 1
-    float normalized = (float)quantized / levels;
-    return min_val + normalized * (max_val - min_val);
+void encoder_free(Encoder *enc) {
+    if (g_fec_k) fec_encoder_free(&enc->fec);
+    ev_buffer_free(&enc->sock_out);
 }
 
-// 心理音響圧縮
-void psychoacoustic_compress(Complex *fft_data, unsigned char *compressed_data, 
-                           BandConfig bands[NUM_BANDS], int *compressed_size) {
-    int write_pos = 0;
+// 1フレーム (MDCTモードでは1ホップ) 圧縮して送る
+// TCP でソケットに書ききれない分は enc->sock_out に溜め、イベントループが書けるときに書き足す
+// 相手が切断していて送れなければ -1
+int send_frame(int sock_fd, Encoder *enc, short *pcm_buffer) {
+    const int frame_size = g_plan.frame_size, hop = g_plan.mdct_hop;
+    float *time_buffer = enc->time_buffer;
+    _Alignas(CACHE_LINE) float mdct_coefs[MAX_MDCT_HOP];
+    Spectrum fft_buffer;
+    unsigned char packet[RTP_HEADER_BYTES + PAYLOAD_BUFFER_BYTES];  // UDP では先頭に RTP ヘッダを置く
+    unsigned char *compressed_data = packet + RTP_HEADER_BYTES;      // 最大サイズ
+    static unsigned char fec_packet[RTP_HEADER_BYTES + FEC_PARITY_HEADER_BYTES + FEC_HEADER_BYTES + PAYLOAD_BUFFER_BYTES];
+
+    // MDCTモードでは1ホップ (半フレーム) ずつ読み、直前のホップと合わせて変換する
+    int read_samples = (g_compression_method == COMPRESS_MDCT) ? hop : frame_size;
+    static int silent_frames = 0;
+    uint32_t timestamp = enc->timestamp;
+    int compressed_size;
+    long fec_bytes = 0;  // このフレームの後に送ったパリティ
+    VadDecision vad_decision = g_dtx ? vad_process(&enc->vad, pcm_buffer, read_samples, compressed_data) : VAD_SPEECH;
     
-    for (int band = 0; band < NUM_BANDS; band++) {
-        for (int bin = bands[band].start_bin; bin <= bands[band].end_bin && bin < FRAME_SIZE/2; bin++) {
-            // 振幅と位相を計算
-            float magnitude = sqrt(fft_data[bin].re * fft_data[bin].re + 
-                                 fft_data[bin].im * fft_data[bin].im);
-            float phase = atan2(fft_data[bin].im, fft_data[bin].re);
-            
-            // 振幅を dB に変換
-            float magnitude_db = 20.0f * log10f(fmaxf(magnitude, 1e-10f));
-            
-            // 閾値以下の成分は大幅に減衰
-            if (magnitude_db < bands[band].threshold_db) {
-                magnitude_db = bands[band].threshold_db - 20.0f;  // さらに20dB減衰
+    // 圧縮方法に応じて処理
+    if (vad_decision != VAD_SPEECH) {
+        // 無音: 変換も圧縮もせず、ペイロードタイプ RTP_PT_CN で雑音記述子 (VAD_SID_BYTES byte) を送る
+        // 記述子を送り直さないフレームは、UDP では送らず (受信側はタイムスタンプの隙間で雑音を続ける)、
+        // TCP では空のペイロードを送る。TCP では見出しの長さの欄 (符号なし varint) がその長さになる
+        compressed_size = (vad_decision == VAD_SID) ? VAD_SID_BYTES : 0;
+        silent_frames++;
+        if (g_compression_method == COMPRESS_MDCT) {
+            // 次の有音フレームの窓の前半になるので、ホップの履歴だけは更新しておく
+            memmove(time_buffer, time_buffer + hop, hop * sizeof(float));
+            for (int i = 0; i < hop; i++) {
+                time_buffer[hop + i] = (float)pcm_buffer[i];
             }
-            
-            // 量子化範囲を設定 (適応的)
-            float mag_min = bands[band].threshold_db - 30.0f;
-            float mag_max = mag_min + 60.0f;  // 60dBの範囲
-            
-            // 量子化
-            unsigned char q_mag = quantize_value(magnitude_db, bands[band].mag_bits, mag_min, mag_max);
-            unsigned char q_phase = quantize_value(phase + PI, bands[band].phase_bits, 0.0f, 2.0f * PI);
-            
-            // 圧縮データに書き込み
-            compressed_data[write_pos++] = q_mag;
-            compressed_data[write_pos++] = q_phase;
         }
+    } else if (g_compression_method == COMPRESS_MDCT) {
+        // 窓の前半を1ホップ前のサンプル、後半を新しいサンプルにする
+        memmove(time_buffer, time_buffer + hop, hop * sizeof(float));
+        for (int i = 0; i < hop; i++) {
+            time_buffer[hop + i] = (float)pcm_buffer[i];
+        }
+        mdct_forward(&g_plan, time_buffer, mdct_coefs);
+        mdct_compress(&g_plan, mdct_coefs, compressed_data, &compressed_size);
+    } else {
+        // PCMデータを実数バッファに変換
+        for (int i = 0; i < frame_size; i++) {
+            time_buffer[i] = (float)pcm_buffer[i];
+        }
+
+        // 実数入力FFT実行
+        rfft(&g_plan, time_buffer, &fft_buffer);
+
+        if (g_compression_method == COMPRESS_PHONE_BAND) {
+            // 電話帯域制限を適用
+            apply_phone_band_filter(&g_plan, &fft_buffer);
+            // 電話帯域圧縮
+            phone_band_compress(&g_plan, &fft_buffer, compressed_data, &compressed_size);
+        } else if (g_rate_control) {
+            // 目標ビットレートに合わせた心理音響圧縮
+            psychoacoustic_compress_rate(&g_plan, &g_rate, &fft_buffer, compressed_data, &compressed_size);
+        } else {
+            // 心理音響圧縮
+            psychoacoustic_compress(&g_plan, &fft_buffer, compressed_data, &compressed_size);
+        }
+    }
+    
+    // 無音フレームは快適雑音のペイロードタイプ
+    int payload_type = (vad_decision == VAD_SPEECH) ? codec_payload_type() : RTP_PT_CN;
+    int header_bytes = frame_header_bytes();
+    if (g_udp) {
+        // 1フレームを1パケットで送る (雑音を続けるだけのフレームは送らない)
+        int marker = (vad_decision == VAD_SPEECH && enc->last_decision != VAD_SPEECH);
+        if (vad_decision == VAD_CONTINUE) {
+            header_bytes = 0;
+        } else if (rtp_send(sock_fd, &enc->rtp, packet, compressed_size, payload_type, timestamp, marker) < 0) {
+            return -1;
+        }
+        // グループの最後のフレームを送ったらパリティも送る (タイムスタンプはグループの先頭のフレームのもの)
+        // 送らなかったフレームも空の無音フレームとしてグループに入れる (受信側は復元すれば雑音を続ける)
+        int parity_size = g_fec_k ? fec_encoder_add(&enc->fec, timestamp / read_samples, vad_decision != VAD_SPEECH,
+                                                    compressed_data, compressed_size,
+                                                    fec_packet + RTP_HEADER_BYTES) : 0;
+        if (parity_size > 0) {
+            uint32_t group_timestamp = timestamp - (g_fec_k - 1) * read_samples;
+            if (rtp_send(sock_fd, &enc->fec_rtp, fec_packet, parity_size, RTP_PT_FEC, group_timestamp, 0) < 0) return -1;
+            fec_bytes += RTP_HEADER_BYTES + parity_size;
+        }
+    } else {
+        // 見出しと圧縮データを1回で送る
+        unsigned char header[WIRE_HEADER_MAX];
+        struct iovec iov[2] = {
+            {header, (size_t)wire_put_header(header, payload_type, enc->sequence++, compressed_size)},
+            {compressed_data, (size_t)compressed_size}};
+        if (ev_writev(&enc->sock_out, sock_fd, iov, 2) < 0) return -1;
+        header_bytes = wire_header_bytes(compressed_size);
     }
+    enc->timestamp = timestamp + read_samples;
+    enc->last_decision = vad_decision;
     
-    *compressed_size = write_pos;
+    // 圧縮率を表示 (レート制御中は直近100フレームの実際のビットレートも)
+    static int frame_count = 0;
+    static long sent_bytes = 0;
+    sent_bytes += header_bytes + compressed_size + fec_bytes;
+    if (++frame_count % 100 == 0) {
+        int original_size;
+        const char* method_name;
+        if (g_compression_method == COMPRESS_PHONE_BAND) {
+            original_size = (g_plan.phone_high_bin - g_plan.phone_low_bin + 1) * 2 * sizeof(float);
+            method_name = "Phone Band";
+        } else if (g_compression_method == COMPRESS_MDCT) {
+            original_size = hop * sizeof(float);
+            method_name = "MDCT";
+        } else {
+            original_size = g_plan.spectrum_bins * 2 * sizeof(float);
+            method_name = "Psychoacoustic";
+        }
+        float compression_ratio = (float)compressed_size / original_size;
+        fprintf(stderr, "%s compression ratio: %.2f%% (Frame %d)\n", 
+               method_name, compression_ratio * 100, frame_count);
+        if (g_rate_control) {
+            float kbps = sent_bytes * 8.0f * g_plan.sample_rate / (100.0f * read_samples) / 1000.0f;
+            fprintf(stderr, "Rate: %.1f kbps, step %d, reservoir %d/%d bits\n",
+                    kbps, g_rate.step, g_rate.reservoir_bits, g_rate.reservoir_max_bits);
+        }
+        if (g_dtx) {
+            fprintf(stderr, "DTX: %d of last 100 frames silent\n", silent_frames);
+            silent_frames = 0;
+        }
+        sent_bytes = 0;
+    }
+    return 0;
 }
 
-// 心理音響展開
-void psychoacoustic_decompress(unsigned char *compressed_data, Complex *fft_data, 
-                             BandConfig bands[NUM_BANDS], int compressed_size) {
-    // FFTバッファを初期化
-    memset(fft_data, 0, FRAME_SIZE * sizeof(Complex));
-    
-    int read_pos = 0;
-    
-    for (int band = 0; band < NUM_BANDS && read_pos < compressed_size; band++) {
-        for (int bin = bands[band].start_bin; bin <= bands[band].end_bin && bin < FRAME_SIZE/2; bin++) {
-            if (read_pos + 1 >= compressed_size) break;
-            
-            // 圧縮データから読み取り
-            unsigned char q_mag = compressed_data[read_pos++];
-            unsigned char q_phase = compressed_data[read_pos++];
-            
-            // 逆量子化
-            float mag_min = bands[band].threshold_db - 30.0f;
-            float mag_max = mag_min + 60.0f;
-            
-            float magnitude_db = dequantize_value(q_mag, bands[band].mag_bits, mag_min, mag_max);
-            float phase = dequantize_value(q_phase, bands[band].phase_bits, 0.0f, 2.0f * PI) - PI;
-            
-            // dBから線形振幅に変換
-            float magnitude = pow(10.0f, magnitude_db / 20.0f);
-            
-            // 複素数に変換
-            fft_data[bin].re = magnitude * cos(phase);
-            fft_data[bin].im = magnitude * sin(phase);
-            
-            // 対称性を保つ（実数信号のため）
-            if (bin > 0 && bin < FRAME_SIZE/2) {
-                fft_data[FRAME_SIZE - bin].re = fft_data[bin].re;
-                fft_data[FRAME_SIZE - bin].im = -fft_data[bin].im;
+#define RECEIVE_BROKEN 2    // receive_frame: 届いたが復号できないフレーム
+#define RECEIVE_PARITY 3    // receive_frame: 前方誤り訂正のパリティ (--fec)
+#define RECEIVE_AGAIN 4     // receive_frame: 次のフレームはまだ届いていない
+#define MAX_CONCEALED_GAP 16  // ジッタバッファを使わないとき、これより長い欠落は補間せずに詰める
+
+// UDP で1フレーム受け取る
+// payload にペイロードの位置、size にその長さ、timestamp に RTP のタイムスタンプを返す
+// ジッタバッファを使わなければ、追い越されて遅れて届いたパケットは捨てる (使うなら並べ直しはジッタバッファに任せる)
+// 戻り値: 0 = コーデックのフレーム、1 = 無音フレーム (payload は雑音記述子)、
+//         RECEIVE_BROKEN = 長さが合わず復号できないフレーム (補間する)、
+//         RECEIVE_PARITY = パリティ (timestamp はグループの先頭のフレームのもの)、
+//         RECEIVE_AGAIN = まだ届いていない、-1 = 相手の送信終了かエラー
+int receive_udp_frame(int sock_fd, RtpReceiveStats *stats, unsigned char *packet,
+                      unsigned char **payload, int *size, uint32_t *timestamp) {
+    while (1) {
+        int len = rtp_recv(sock_fd, packet, RTP_MAX_PACKET);
+        if (len == RTP_AGAIN) return RECEIVE_AGAIN;
+        if (len < 0) return -1;
+        RtpHeader h;
+        int offset = rtp_parse_header(packet, len, &h);
+        if (offset < 0 || h.payload_type == RTP_PT_HELLO) continue;
+        if (h.payload_type == RTP_PT_BYE) return -1;
+        if (h.payload_type == RTP_PT_FEC && g_fec_k) {
+            // パリティのシーケンス番号はフレームと別なので受信の統計には数えない
+            *payload = packet + offset;
+            *size = rtp_payload_length(packet, len, offset);
+            *timestamp = h.timestamp;
+            return RECEIVE_PARITY;
+        }
+        if (h.payload_type != RTP_PT_CN && h.payload_type != codec_payload_type()) {
+            // 相手と圧縮方法が違う
+            static int warned = 0;
+            if (!warned++) {
+                fprintf(stderr, "Ignoring RTP payload type %d (expected %d): check -p/-b/-m/--fec on both ends\n",
+                        h.payload_type, codec_payload_type());
             }
+            continue;
+        }
+        if (!rtp_receive_update(stats, h.sequence) && !g_jitter_buffer) continue;
+
+        *payload = packet + offset;
+        *size = rtp_payload_length(packet, len, offset);
+        *timestamp = h.timestamp;
+        if (h.payload_type == RTP_PT_CN) {
+            if (*size > VAD_SID_BYTES) continue;
+            return 1;
         }
+        if (*size <= 0 || *size > g_plan.max_payload) return RECEIVE_BROKEN;
+        return 0;
     }
 }
 
-// --- FFT / IFFT 実装 ---
-
-void fft(Complex *x, int N) {
-    if (N <= 1) return;
+// 1フレーム受け取る (TCP なら g_wire に溜めた中から1フレーム、UDP なら1パケット)
+// TCP のタイムスタンプはフレームの順番から数える。戻り値は receive_udp_frame と同じ
+// (TCP の RECEIVE_AGAIN は、溜めた中に次のフレームが全部は無いこと。読み足すのは呼び出し側)
+// TCP でシーケンス番号が飛ぶか形式が壊れていれば、ストリームがずれているので終わる
+int receive_frame(int sock_fd, RtpReceiveStats *stats, unsigned char *packet,
+                  unsigned char **payload, int *size, uint32_t *timestamp) {
+    if (g_udp) return receive_udp_frame(sock_fd, stats, packet, payload, size, timestamp);
+
+    static uint32_t tcp_timestamp = 0;
+    static uint16_t expected_sequence = 0;
+    WireFrame f;
+    int got = wire_parse_frame(&g_wire, &f);
+    if (got == 0) return RECEIVE_AGAIN;
+    if (got < 0) {
+        fprintf(stderr, "Broken TCP frame header: stream out of sync\n");
+        return -1;
+    }
+    if (f.sequence != expected_sequence) {
+        fprintf(stderr, "TCP frame %u arrived where %u was expected: stream out of sync\n",
+                f.sequence, expected_sequence);
+        return -1;
+    }
+    expected_sequence++;
+    *payload = f.payload;
+    *size = f.size;
+    *timestamp = tcp_timestamp;
+    tcp_timestamp += (g_compression_method == COMPRESS_MDCT) ? g_plan.mdct_hop : g_plan.frame_size;
+    if (f.codec == RTP_PT_CN) return (f.size > VAD_SID_BYTES) ? RECEIVE_BROKEN : 1;
+    if (f.codec != codec_payload_type() || f.size <= 0) return RECEIVE_BROKEN;
+    return 0;
+}
 
-    Complex *even = malloc(N/2 * sizeof(Complex));
-    Complex *odd  = malloc(N/2 * sizeof(Complex));
-    for (int i = 0; i < N/2; i++) {
-        even[i] = x[2*i];
-        odd[i]  = x[2*i+1];
+// 受信側の復号の状態 (フレームをまたいで持つ)
+typedef struct {
+    _Alignas(CACHE_LINE) float mdct_overlap[MAX_MDCT_HOP];  // 前フレームの後半 (重畳加算用)
+    ComfortNoise comfort_noise;
+    PlcState plc;     // 失われたフレームを外挿するための直前のスペクトル
+    int last_silent;  // 直前に再生したのは無音フレームか
+} Decoder;
+
+// MDCT係数を逆変換し、前フレームの後半と重畳加算して1ホップ分を出力
+void output_mdct(Decoder *dec, const float *mdct_coefs) {
+    const int hop = g_plan.mdct_hop;
+    short pcm_buffer[MAX_FRAME_SIZE];
+    _Alignas(CACHE_LINE) float time_buffer[MAX_FRAME_SIZE];
+    mdct_inverse(&g_plan, mdct_coefs, time_buffer);
+    for (int i = 0; i < hop; i++) {
+        float sample = time_buffer[i] + dec->mdct_overlap[i];
+        dec->mdct_overlap[i] = time_buffer[hop + i];
+        pcm_buffer[i] = (short)roundf(sample);
     }
+    write_playout_samples(pcm_buffer, hop);
+}
 
-    fft(even, N/2);
-    fft(odd, N/2);
+// スペクトルを逆変換して1フレーム分を出力
+void output_spectrum(Spectrum *fft_buffer) {
+    const int frame_size = g_plan.frame_size;
+    short pcm_buffer[MAX_FRAME_SIZE];
+    _Alignas(CACHE_LINE) float time_buffer[MAX_FRAME_SIZE];
 
-    for (int k = 0; k < N/2; k++) {
-        double angle = -2.0 * PI * k / N;
-        Complex t = {cos(angle) * odd[k].re - sin(angle) * odd[k].im,
-                     cos(angle) * odd[k].im + sin(angle) * odd[k].re};
-        x[k]       = (Complex){even[k].re + t.re, even[k].im + t.im};
-        x[k + N/2] = (Complex){even[k].re - t.re, even[k].im - t.im};
+    // 実数出力IFFT実行
+    irfft(&g_plan, fft_buffer, time_buffer);
+
+    // 実数データをshort型PCMデータに変換
+    for (int i = 0; i < frame_size; i++) {
+        pcm_buffer[i] = (short)roundf(time_buffer[i]);
     }
 
-    free(even);
-    free(odd);
+    // PCMデータを標準出力へ書き出し
+    write_playout_samples(pcm_buffer, frame_size);
 }
 
-void ifft(Complex *x, int N) {
-    for (int i = 0; i < N; i++) {
-        x[i].im = -x[i].im;
+// 届かなかったフレームの代わりを1フレーム書き出す
+// 無音区間なら快適雑音を続け、有音区間なら直前のスペクトルから外挿する (続けて失うと背景雑音へ移る)
+void conceal_frame(Decoder *dec) {
+    if (dec->last_silent) {
+        const int samples = (g_compression_method == COMPRESS_MDCT) ? g_plan.mdct_hop : g_plan.frame_size;
+        short pcm_buffer[MAX_FRAME_SIZE];
+        cng_generate(&dec->comfort_noise, pcm_buffer, samples);
+        write_playout_samples(pcm_buffer, samples);
+        return;
+    }
+    if (g_compression_method == COMPRESS_MDCT) {
+        _Alignas(CACHE_LINE) float mdct_coefs[MAX_MDCT_HOP];
+        plc_conceal_mdct(&g_plan, &dec->plc, mdct_coefs);
+        output_mdct(dec, mdct_coefs);
+        return;
     }
+    Spectrum fft_buffer;
+    plc_conceal(&g_plan, &dec->plc, &fft_buffer);
+    output_spectrum(&fft_buffer);
+}
 
-    fft(x, N);
+// 1フレーム (MDCTモードでは1ホップ) 復号して標準出力へ書き出す
+// silent なら payload は雑音記述子 (0byte なら直前の雑音を続ける)
+// 長さが合わず展開できないフレームは、届かなかったものとして補間する
+void decode_frame(Decoder *dec, int silent, unsigned char *compressed_data, int compressed_size) {
+    short pcm_buffer[MAX_FRAME_SIZE];
+    _Alignas(CACHE_LINE) float mdct_coefs[MAX_MDCT_HOP];
+    Spectrum fft_buffer;
+    dec->last_silent = silent;
+
+    // DTX の無音フレーム: 雑音記述子があれば更新して快適雑音を出力
+    if (silent) {
+        if (compressed_size > 0) cng_update(&dec->comfort_noise, compressed_data, compressed_size);
+        int samples = (g_compression_method == COMPRESS_MDCT) ? g_plan.mdct_hop : g_plan.frame_size;
+        cng_generate(&dec->comfort_noise, pcm_buffer, samples);
+        // 重畳加算の相手がいないので、次の有音フレームは前半を0から始める
+        memset(dec->mdct_overlap, 0, sizeof(dec->mdct_overlap));
+        write_playout_samples(pcm_buffer, samples);
+        return;
+    }
+    
+    if (g_compression_method == COMPRESS_MDCT) {
+        // MDCT展開と逆変換
+        if (mdct_decompress(&g_plan, compressed_data, mdct_coefs, compressed_size) < 0) {
+            conceal_frame(dec);
+            return;
+        }
+        plc_update_mdct(&g_plan, &dec->plc, mdct_coefs);
+        output_mdct(dec, mdct_coefs);
+        return;
+    }
 
-    for (int i = 0; i < N; i++) {
-        x[i].re = x[i].re / N;
-        x[i].im = -x[i].im / N;
+    // 圧縮方法に応じて展開
+    if (g_compression_method == COMPRESS_PHONE_BAND) {
+        // 電話帯域展開
+        phone_band_decompress(&g_plan, compressed_data, &fft_buffer, compressed_size);
+    } else {
+        // 心理音響展開
+        if (psychoacoustic_decompress(&g_plan, compressed_data, &fft_buffer, compressed_size) < 0) {
+            conceal_frame(dec);
+            return;
+        }
     }
+    plc_update(&g_plan, &dec->plc, &fft_buffer);
+    output_spectrum(&fft_buffer);
 }
 
-// --- 電話プログラム本体 ---
+void print_jitter_buffer(const JitterBuffer *jb) {
+    fprintf(stderr, "Jitter buffer: delay %.0f ms (target %.0f ms, jitter %.1f ms), "
+            "%ld concealed, %ld too late, %ld stretched, %ld skipped, %ld DTX\n",
+            jb_delay_ms(jb), jb_target_ms(jb), jb_jitter_ms(jb),
+            jb->concealed, jb->late, jb->stretched, jb->skipped, jb->continued);
+}
 
-int socket_fd = -1;
-int server_socket = -1;
-pid_t sender_pid = -1;
-pid_t receiver_pid = -1;
-BandConfig g_bands[NUM_BANDS];  // グローバル帯域設定
+// 前方誤り訂正で復元したフレームをジッタバッファに入れる (届いたフレームと同じく長さを確かめる)
+// まだ届いておらず再生にも間に合ったなら 1 を返す
+int put_recovered_frame(JitterBuffer *jb, const FecFrame *f) {
+    int valid = (f->type == 1) ? f->len <= VAD_SID_BYTES
+                               : (f->type == 0 && f->len > 0 && f->len <= g_plan.max_payload);
+    return valid && jb_put(jb, f->frame * jb->frame_samples, f->type, f->data, f->len);
+}
 
-void cleanup() {
-    if (sender_pid > 0) kill(sender_pid, SIGTERM);
-    if (receiver_pid > 0) kill(receiver_pid, SIGTERM);
-    if (socket_fd >= 0) close(socket_fd);
-    if (server_socket >= 0) close(server_socket);
+// 受信側の状態
+typedef struct {
+    Decoder dec;
+    RtpReceiveStats stats;
+    int have_timestamp;      // ジッタバッファを使わないとき、フレームを受け取ったか
+    uint32_t next_timestamp; // その次に来るはずのフレームのタイムスタンプ
+    JitterBuffer jb;         // --jitter-buffer
+    FecDecoder fec;          // --fec
+    long recovered_frames;
+    int ended;               // 相手の送信が終わった
+} Receiver;
+
+int receiver_init(Receiver *r) {
+    const int samples = (g_compression_method == COMPRESS_MDCT) ? g_plan.mdct_hop : g_plan.frame_size;
+    memset(r, 0, sizeof(*r));
+    cng_init(&r->dec.comfort_noise);
+    plc_init(&r->dec.plc);
+    if (!g_udp && wire_reader_init(&g_wire, g_plan.max_payload, BITSTREAM_PADDING) < 0) return -1;
+    if (!g_jitter_buffer) return 0;
+    // ジッタバッファに溜め、送信側のサンプリングレートの間隔で再生する
+    if (jb_init(&r->jb, samples, g_plan.sample_rate, PAYLOAD_BUFFER_BYTES) < 0) return -1;
+    if (g_fec_k) {
+        // 前方誤り訂正ではグループの先頭のフレームも最後のパリティが届くまで待てるだけ遅延させる
+        if (fec_decoder_init(&r->fec, g_fec_k, g_plan.max_payload) < 0) return -1;
+        jb_set_min_delay(&r->jb, g_fec_k * samples);
+    }
+    return 0;
 }
 
-void signal_handler(int sig) {
-    cleanup();
-    exit(0);
+// 相手の送信が終わった (ジッタバッファは溜めた分を再生してから終わる)
+void receiver_end(Receiver *r) {
+    r->ended = 1;
+    if (g_jitter_buffer) jb_end(&r->jb);
 }
 
-// 送信プロセス
-void audio_sender(int sock_fd) {
-    short pcm_buffer[FRAME_SIZE];
-    Complex fft_buffer[FRAME_SIZE];
-    unsigned char compressed_data[FRAME_SIZE * 2];  // 最大サイズ
-    
-    while (read(STDIN_FILENO, pcm_buffer, FRAME_BYTES) == FRAME_BYTES) {
-        // PCMデータを複素数バッファに変換
-        for (int i = 0; i < FRAME_SIZE; i++) {
-            fft_buffer[i].re = (double)pcm_buffer[i];
-            fft_buffer[i].im = 0.0;
+// 届いているフレームを取り出せるだけ取り出す
+// ジッタバッファを使わなければ届いた順にすぐ再生し (タイムスタンプが飛んだ分は補間する)、使うなら溜める
+// ジッタバッファが一杯になれば取り出すのをやめる (残りは再生が進んでから)
+void receive_frames(int sock_fd, Receiver *r) {
+    static unsigned char packet[RTP_MAX_PACKET];  // UDP の受信バッファ (ペイロードの後ろに展開用の余白がある)
+    unsigned char *compressed_data;
+    int compressed_size;
+    uint32_t timestamp;
+    FecFrame recovered;
+    const int samples = (g_compression_method == COMPRESS_MDCT) ? g_plan.mdct_hop : g_plan.frame_size;
+
+    while (!r->ended && !(g_jitter_buffer && jb_full(&r->jb))) {
+        int silent = receive_frame(sock_fd, &r->stats, packet, &compressed_data, &compressed_size, &timestamp);
+        if (silent == RECEIVE_AGAIN) return;
+        if (silent < 0) {
+            receiver_end(r);
+        } else if (!g_jitter_buffer) {
+            // タイムスタンプが飛んだ分を補間する (無音区間なら DTX で送られなかった分の雑音を続ける)
+            int32_t gap = r->have_timestamp ? (int32_t)(timestamp - r->next_timestamp) / samples : 0;
+            for (int32_t i = 0; i < gap && i < MAX_CONCEALED_GAP; i++) conceal_frame(&r->dec);
+            r->have_timestamp = 1;
+            r->next_timestamp = timestamp + samples;
+            if (silent == RECEIVE_BROKEN) conceal_frame(&r->dec);
+            else decode_frame(&r->dec, silent, compressed_data, compressed_size);
+        } else if (silent == RECEIVE_PARITY) {
+            if (fec_decoder_add_parity(&r->fec, compressed_data, compressed_size, &recovered)) {
+                r->recovered_frames += put_recovered_frame(&r->jb, &recovered);
+            }
+        } else if (silent != RECEIVE_BROKEN) {
+            jb_put(&r->jb, timestamp, silent, compressed_data, compressed_size);
+            if (g_fec_k && fec_decoder_add_frame(&r->fec, timestamp / samples, silent,
+                                                 compressed_data, compressed_size, &recovered)) {
+                r->recovered_frames += put_recovered_frame(&r->jb, &recovered);
+            }
         }
+    }
+}
 
-        // FFT実行
-        fft(fft_buffer, FRAME_SIZE);
+// 再生の時刻になったフレームをジッタバッファから再生する
+// 送信側が終わり、溜めた分もすべて再生したら 1 を返す
+int play_due_frames(Receiver *r) {
+    JitterBuffer *jb = &r->jb;
+    unsigned char *compressed_data;
+    int compressed_size, silent;
+    while (1) {
+        JitterResult res = jb_get(jb, &silent, &compressed_data, &compressed_size);
+        if (res == JB_END) return 1;
+        if (res == JB_WAIT) return 0;
+        if (res == JB_FRAME) decode_frame(&r->dec, silent, compressed_data, compressed_size);
+        else conceal_frame(&r->dec);
 
-        int compressed_size;
-        
-        // 圧縮方法に応じて処理
-        if (g_compression_method == COMPRESS_PHONE_BAND) {
-            // 電話帯域制限を適用
-            apply_phone_band_filter(fft_buffer);
-            // 電話帯域圧縮
-            phone_band_compress(fft_buffer, compressed_data, &compressed_size);
-        } else {
-            // 心理音響圧縮
-            psychoacoustic_compress(fft_buffer, compressed_data, g_bands, &compressed_size);
-        }
-        
-        // 圧縮サイズを先に送信
-        write(sock_fd, &compressed_size, sizeof(int));
-        // 圧縮データを送信
-        write(sock_fd, compressed_data, compressed_size);
-        
-        // 圧縮率を表示
-        static int frame_count = 0;
-        if (++frame_count % 100 == 0) {
-            int original_size = (g_compression_method == COMPRESS_PHONE_BAND) ? 
-                               ((g_phone_band_high_bin - g_phone_band_low_bin + 1) * 2 * sizeof(double)) : 
-                               FFT_BYTES;
-            float compression_ratio = (float)compressed_size / original_size;
-            const char* method_name = (g_compression_method == COMPRESS_PHONE_BAND) ? 
-                                    "Phone Band" : "Psychoacoustic";
-            fprintf(stderr, "%s compression ratio: %.2f%% (Frame %d)\n", 
-                   method_name, compression_ratio * 100, frame_count);
-        }
+        if ((jb->played + jb->concealed + jb->continued) % 100 == 0) print_jitter_buffer(jb);
     }
-    exit(0);
 }
 
-// 受信プロセス
-void audio_receiver(int sock_fd) {
-    short pcm_buffer[FRAME_SIZE];
-    Complex fft_buffer[FRAME_SIZE];
-    unsigned char compressed_data[FRAME_SIZE * 2];
-    
-    while (1) {
-        int compressed_size;
-        // 圧縮サイズを受信
-        if (read(sock_fd, &compressed_size, sizeof(int)) != sizeof(int)) break;
-        if (compressed_size <= 0 || compressed_size > FRAME_SIZE * 2) break;
-        
-        // 圧縮データを受信
-        if (read(sock_fd, compressed_data, compressed_size) != compressed_size) break;
-        
-        // 圧縮方法に応じて展開
-        if (g_compression_method == COMPRESS_PHONE_BAND) {
-            // 電話帯域展開
-            phone_band_decompress(compressed_data, fft_buffer, compressed_size);
-        } else {
-            // 心理音響展開
-            psychoacoustic_decompress(compressed_data, fft_buffer, g_bands, compressed_size);
-        }
+void receiver_free(Receiver *r) {
+    if (g_jitter_buffer) {
+        print_jitter_buffer(&r->jb);
+        jb_free(&r->jb);
+    }
+    if (g_fec_k) {
+        fprintf(stderr, "FEC: recovered %ld frames (1 parity per %d frames)\n", r->recovered_frames, g_fec_k);
+        fec_decoder_free(&r->fec);
+    }
+    if (g_udp) {
+        fprintf(stderr, "UDP: received %ld packets, %ld lost, %ld late\n",
+                r->stats.received, r->stats.lost, r->stats.late);
+    } else {
+        wire_reader_free(&g_wire);
+    }
+}
 
-        // IFFT実行
-        ifft(fft_buffer, FRAME_SIZE);
+// 通話: 標準入力 → 圧縮 → ソケット と ソケット → 展開 → 標準出力 を1つのプロセスで回す (event_loop.h)
+// 送信は標準入力の終わりまで送ったら相手に知らせ (TCP は shutdown(SHUT_WR)、UDP は送信終了のパケット)、
+// 受信は相手の送信が終わって再生し終えたら終わる。両方が終わり、標準出力に書ききったら戻る
+int run_call(int sock_fd) {
+    static Encoder enc;
+    static Receiver rx;
+    EventLoop loop;
+    EvBuffer input;
+    short pcm_buffer[MAX_FRAME_SIZE];
+    const int read_samples = (g_compression_method == COMPRESS_MDCT) ? g_plan.mdct_hop : g_plan.frame_size;
+    int input_open = 1, send_done = 0, recv_done = 0, sock_eof = 0;
+
+    if (encoder_init(&enc) < 0 || receiver_init(&rx) < 0 ||
+        ev_buffer_init(&input, EV_READ_BYTES) < 0 || ev_buffer_init(&g_output, EV_READ_BYTES) < 0) {
+        perror("buffers");
+        return -1;
+    }
+    if (ev_init(&loop) < 0 || ev_add(&loop, STDIN_FILENO, EPOLLIN) < 0 ||
+        ev_add(&loop, sock_fd, EPOLLIN) < 0 || ev_add(&loop, STDOUT_FILENO, 0) < 0) {
+        perror("event loop");
+        ev_free(&loop);
+        return -1;
+    }
 
-        // 複素数データをshort型PCMデータに変換
-        for (int i = 0; i < FRAME_SIZE; i++) {
-            pcm_buffer[i] = (short)round(fft_buffer[i].re);
+    while (!send_done || !recv_done || ev_buffered(&g_output) > 0) {
+        // 書ききれない出力が溜まっている間は、そこへ流し込む入力を待たない
+        // ジッタバッファは再生の時刻に合わせて書き出すので、溜めきれない間だけ受信を止める
+        int listen_input = input_open && ev_buffered(&enc.sock_out) < EV_HIGH_WATER;
+        int listen_socket = !recv_done && !rx.ended && !sock_eof &&
+                            (g_jitter_buffer ? !jb_full(&rx.jb) : ev_buffered(&g_output) < EV_HIGH_WATER);
+        ev_set_events(&loop, STDIN_FILENO, listen_input ? EPOLLIN : 0);
+        ev_set_events(&loop, sock_fd, (listen_socket ? EPOLLIN : 0) | (ev_buffered(&enc.sock_out) > 0 ? EPOLLOUT : 0));
+        ev_set_events(&loop, STDOUT_FILENO, ev_buffered(&g_output) > 0 ? EPOLLOUT : 0);
+        // ジッタバッファの次の再生の時刻まで待つ
+        if (ev_wait(&loop, (g_jitter_buffer && !recv_done) ? jb_wait_ms(&rx.jb) : -1) < 0) {
+            perror("epoll_wait");
+            break;
         }
 
-        // PCMデータを標準出力へ書き出し
-        write(STDOUT_FILENO, pcm_buffer, FRAME_BYTES);
+        // 標準入力 → 圧縮 → ソケット (入力の終わりの半端なフレームは送らない)
+        if (ev_ready(&loop, STDIN_FILENO) & EPOLLIN) {
+            int got = ev_read(&input, STDIN_FILENO);
+            if (got == 0 || got == -1) input_open = 0;
+            while (take_codec_samples(&input, pcm_buffer, read_samples) == 0) {
+                if (send_frame(sock_fd, &enc, pcm_buffer) < 0) {
+                    perror("send");
+                    input_open = 0;
+                    break;
+                }
+            }
+        }
+        if (!send_done && ev_buffered(&enc.sock_out) > 0 && ev_flush(&enc.sock_out, sock_fd) < 0) {
+            perror("send");
+            input_open = 0;
+            ev_consume(&enc.sock_out, ev_buffered(&enc.sock_out));
+        }
+        if (!send_done && !input_open && ev_buffered(&enc.sock_out) == 0) {
+            // 送り終えたことを相手に知らせる (UDP で最後のフレームを送っていなければ先に送る)
+            if (g_udp && enc.last_decision == VAD_CONTINUE) {
+                rtp_send_silence_end(sock_fd, &enc.rtp, enc.timestamp - read_samples);
+            }
+            if (g_udp) rtp_send_bye(sock_fd, &enc.rtp, enc.timestamp);
+            else shutdown(sock_fd, SHUT_WR);
+            send_done = 1;
+        }
+
+        // ソケット → 展開 → 標準出力
+        if (!recv_done) {
+            if (!g_udp && (ev_ready(&loop, sock_fd) & EPOLLIN)) {
+                int got = wire_reader_fill(&g_wire, sock_fd);
+                if (got == 0 || got == -1) sock_eof = 1;
+            }
+            // UDP は届いたときだけ読み、TCP は溜めた中に残っていれば読み足さなくても取り出す
+            if (!g_udp || (ev_ready(&loop, sock_fd) & EPOLLIN)) receive_frames(sock_fd, &rx);
+            // 相手が閉じた: 溜めた中のフレームを取り出しきったら終わる
+            if (sock_eof && !rx.ended && !(g_jitter_buffer && jb_full(&rx.jb))) receiver_end(&rx);
+            recv_done = g_jitter_buffer ? play_due_frames(&rx) : rx.ended;
+        }
+        if (ev_buffered(&g_output) > 0 && ev_flush(&g_output, STDOUT_FILENO) < 0) {
+            // 書き出せないなら受信も止める
+            perror("write to stdout");
+            recv_done = 1;
+            ev_consume(&g_output, ev_buffered(&g_output));
+        }
     }
-    exit(0);
+
+    receiver_free(&rx);
+    encoder_free(&enc);
+    ev_free(&loop);
+    ev_buffer_free(&input);
+    ev_buffer_free(&g_output);
+    return 0;
 }
 
 int run_server(int port) {
@@ -473,60 +711,310 @@ int run_client(const char *ip_str, int port) {
     return 0;
 }
 
+// TCP の接続時にコーデックの設定を決める (wire.h の HELLO)
+// ペイロードの形式を変える設定 (圧縮方法・フレームサイズ・レート・帯域・窓・BFP・電話帯域) はすべて両端で揃える
+// クライアントは自分の設定を申し出て、サーバーが返した設定を使う
+// サーバーは申し出どおりにプランを作れて、--bitrate の条件 (心理音響圧縮とマスキングモデル) も満たせば受け、
+// そうでなければ自分の設定を返す
+int negotiate_codec(int sock_fd, int is_server, int require_masking, CompressionMethod *method, CodecOptions *opts) {
+    WireHello mine = {WIRE_VERSION, method_payload_type(*method),
+                      (opts->entropy_coding ? WIRE_FLAG_ENTROPY : 0) | (opts->masking_model ? WIRE_FLAG_MASKING : 0),
+                      opts->frame_size, opts->sample_rate, opts->num_bands, opts->band_layout, opts->mdct_window,
+                      opts->bfp_bits, opts->phone_low_hz, opts->phone_high_hz};
+    WireHello peer;
+    if (!is_server && wire_send_hello(sock_fd, &mine) < 0) {
+        perror("handshake");
+        return -1;
+    }
+    if (wire_recv_hello(sock_fd, &peer) < 0) {
+        fprintf(stderr, "Handshake failed: the peer closed the connection or is not i3_phone_fft\n");
+        return -1;
+    }
+    if (peer.version != WIRE_VERSION) {
+        if (is_server) wire_send_hello(sock_fd, &mine);  // 相手にもこちらの版を知らせる
+        fprintf(stderr, "Peer speaks protocol version %d, this is version %d\n", peer.version, WIRE_VERSION);
+        return -1;
+    }
+
+    CodecOptions chosen = *opts;
+    chosen.entropy_coding = (peer.flags & WIRE_FLAG_ENTROPY) != 0;
+    chosen.masking_model = (peer.flags & WIRE_FLAG_MASKING) != 0;
+    chosen.frame_size = peer.frame_size;
+    chosen.sample_rate = peer.sample_rate;
+    chosen.num_bands = peer.num_bands;
+    chosen.band_layout = (peer.band_layout == BAND_LAYOUT_BARK) ? BAND_LAYOUT_BARK
+                       : (peer.band_layout == BAND_LAYOUT_ERB) ? BAND_LAYOUT_ERB : BAND_LAYOUT_LINEAR;
+    chosen.mdct_window = (peer.mdct_window == WINDOW_KBD) ? WINDOW_KBD : WINDOW_SINE;
+    chosen.bfp_bits = peer.bfp_bits;
+    chosen.phone_low_hz = peer.phone_low_hz;
+    chosen.phone_high_hz = peer.phone_high_hz;
+    CompressionMethod chosen_method = payload_type_method(peer.codec);
+    if (is_server) {
+        static CodecPlan trial;
+        int accept = chosen_method != 0 &&
+                     (!require_masking || (chosen_method == COMPRESS_PSYCHOACOUSTIC && chosen.masking_model)) &&
+                     codec_plan_init(&trial, &chosen) == 0;
+        if (wire_send_hello(sock_fd, accept ? &peer : &mine) < 0) {
+            perror("handshake");
+            return -1;
+        }
+        if (!accept) {
+            fprintf(stderr, "Client offer not usable here: answering with this server's codec settings\n");
+            return 0;
+        }
+    } else if (chosen_method == 0) {
+        fprintf(stderr, "Server answered with unknown codec %d\n", peer.codec);
+        return -1;
+    }
+    if (memcmp(&peer, &mine, sizeof(peer)) != 0) {
+        fprintf(stderr, "Negotiated codec differs from the local options: using the %s's settings\n",
+                is_server ? "client" : "server");
+    }
+    *method = chosen_method;
+    *opts = chosen;
+    return 0;
+}
+
 int main(int argc, char **argv) {
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
     // コマンドライン引数の解析
     int compression_method = 1;  // デフォルトは心理音響圧縮
+    float bitrate_kbps = 0.0f;   // 0 ならレート制御しない
+    int peak_bytes = 0;          // 0 なら平均の2倍
+    CodecOptions codec_opts;
+    codec_default_options(&codec_opts);
     int arg_start = 1;
     
-    if (argc >= 2 && (strcmp(argv[1], "-p") == 0 || strcmp(argv[1], "--psychoacoustic") == 0)) {
-        compression_method = 1;
-        arg_start = 2;
-    } else if (argc >= 2 && (strcmp(argv[1], "-b") == 0 || strcmp(argv[1], "--phone-band") == 0)) {
-        compression_method = 2;
-        arg_start = 2;
+    while (arg_start < argc && argv[arg_start][0] == '-') {
+        if (strcmp(argv[arg_start], "-p") == 0 || strcmp(argv[arg_start], "--psychoacoustic") == 0) {
+            compression_method = 1;
+            arg_start++;
+        } else if (strcmp(argv[arg_start], "-b") == 0 || strcmp(argv[arg_start], "--phone-band") == 0) {
+            compression_method = 2;
+            arg_start++;
+        } else if (strcmp(argv[arg_start], "-m") == 0 || strcmp(argv[arg_start], "--mdct") == 0) {
+            compression_method = 3;
+            arg_start++;
+        } else if (strcmp(argv[arg_start], "-e") == 0 || strcmp(argv[arg_start], "--entropy") == 0) {
+            codec_opts.entropy_coding = 1;
+            arg_start++;
+        } else if (strcmp(argv[arg_start], "--masking") == 0) {
+            codec_opts.masking_model = 1;
+            arg_start++;
+        } else if (strcmp(argv[arg_start], "--bitrate") == 0 && arg_start + 1 < argc) {
+            bitrate_kbps = atof(argv[arg_start + 1]);
+            arg_start += 2;
+        } else if (strcmp(argv[arg_start], "--peak-bytes") == 0 && arg_start + 1 < argc) {
+            peak_bytes = atoi(argv[arg_start + 1]);
+            arg_start += 2;
+        } else if (strcmp(argv[arg_start], "--udp") == 0) {
+            g_udp = 1;
+            arg_start++;
+        } else if (strcmp(argv[arg_start], "--jitter-buffer") == 0) {
+            g_jitter_buffer = 1;
+            arg_start++;
+        } else if (strcmp(argv[arg_start], "--fec") == 0 && arg_start + 1 < argc) {
+            g_fec_k = atoi(argv[arg_start + 1]);
+            arg_start += 2;
+        } else if (strcmp(argv[arg_start], "--dtx") == 0) {
+            g_dtx = 1;
+            arg_start++;
+        } else if (strcmp(argv[arg_start], "--bfp-bits") == 0 && arg_start + 1 < argc) {
+            codec_opts.bfp_bits = atoi(argv[arg_start + 1]);
+            arg_start += 2;
+        } else if (strcmp(argv[arg_start], "--window") == 0 && arg_start + 1 < argc) {
+            codec_opts.mdct_window = (strcmp(argv[arg_start + 1], "kbd") == 0) ? WINDOW_KBD : WINDOW_SINE;
+            arg_start += 2;
+        } else if (strcmp(argv[arg_start], "--isa") == 0 && arg_start + 1 < argc) {
+            codec_opts.isa_name = argv[arg_start + 1];
+            if (codec_isa_level(codec_opts.isa_name) < 0) return 1;
+            arg_start += 2;
+        } else if (strcmp(argv[arg_start], "--frame-size") == 0 && arg_start + 1 < argc) {
+            codec_opts.frame_size = atoi(argv[arg_start + 1]);
+            arg_start += 2;
+        } else if (strcmp(argv[arg_start], "--sample-rate") == 0 && arg_start + 1 < argc) {
+            codec_opts.sample_rate = atoi(argv[arg_start + 1]);
+            arg_start += 2;
+        } else if (strcmp(argv[arg_start], "--capture-rate") == 0 && arg_start + 1 < argc) {
+            g_capture_rate = atoi(argv[arg_start + 1]);
+            arg_start += 2;
+        } else if (strcmp(argv[arg_start], "--bands") == 0 && arg_start + 1 < argc) {
+            codec_opts.num_bands = atoi(argv[arg_start + 1]);
+            arg_start += 2;
+        } else if (strcmp(argv[arg_start], "--band-layout") == 0 && arg_start + 1 < argc) {
+            const char *layout = argv[arg_start + 1];
+            codec_opts.band_layout = (strcmp(layout, "bark") == 0) ? BAND_LAYOUT_BARK
+                                   : (strcmp(layout, "erb") == 0) ? BAND_LAYOUT_ERB : BAND_LAYOUT_LINEAR;
+            arg_start += 2;
+        } else if (strcmp(argv[arg_start], "--phone-low") == 0 && arg_start + 1 < argc) {
+            codec_opts.phone_low_hz = atoi(argv[arg_start + 1]);
+            arg_start += 2;
+        } else if (strcmp(argv[arg_start], "--phone-high") == 0 && arg_start + 1 < argc) {
+            codec_opts.phone_high_hz = atoi(argv[arg_start + 1]);
+            arg_start += 2;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[arg_start]);
+            arg_start = argc;  // 使い方を表示させる
+        }
     }
     
     g_compression_method = (CompressionMethod)compression_method;
-    
-    if (g_compression_method == COMPRESS_PSYCHOACOUSTIC) {
-        fprintf(stderr, "Using psychoacoustic compression\n");
-        init_band_config(g_bands);
-    } else {
-        fprintf(stderr, "Using phone band compression (300-3400 Hz)\n");
-        init_phone_band_bins();
+
+    // パリティを待つためにジッタバッファで並べ直す
+    if (g_fec_k) {
+        if (!g_udp || g_fec_k < 2 || g_fec_k > FEC_MAX_K) {
+            fprintf(stderr, "--fec needs --udp and a group of 2 to %d frames\n", FEC_MAX_K);
+            return 1;
+        }
+        g_jitter_buffer = 1;
     }
 
+    // レート制御は帯域のビット数をフレームごとに送るマスキングモデルの上で行う
+    if (bitrate_kbps > 0.0f) codec_opts.masking_model = 1;
+    // 標準入出力のレートは自分の設定のまま (接続時にコーデックのレートが変われば変換して合わせる)
+    if (g_capture_rate == 0) g_capture_rate = codec_opts.sample_rate;
+
     // ネットワーク設定
     if (argc - arg_start == 1) {
-        run_server(atoi(argv[arg_start]));
+        if (g_udp) socket_fd = rtp_udp_server(atoi(argv[arg_start]));
+        else run_server(atoi(argv[arg_start]));
     } else if (argc - arg_start == 2) {
-        run_client(argv[arg_start], atoi(argv[arg_start + 1]));
+        if (g_udp) socket_fd = rtp_udp_client(argv[arg_start], atoi(argv[arg_start + 1]));
+        else run_client(argv[arg_start], atoi(argv[arg_start + 1]));
     } else {
         fprintf(stderr, "Usage:\n");
         fprintf(stderr, "  Options:\n");
         fprintf(stderr, "    -p, --psychoacoustic  Use psychoacoustic compression (default)\n");
         fprintf(stderr, "    -b, --phone-band      Use phone band compression (300-3400 Hz)\n");
+        fprintf(stderr, "    -m, --mdct            Use MDCT compression with 50%% overlap\n");
+        fprintf(stderr, "    -e, --entropy         Range-code quantized spectra (psychoacoustic/MDCT)\n");
+        fprintf(stderr, "    --masking             Allocate psychoacoustic bits per frame from a masking model\n");
+        fprintf(stderr, "    --bitrate <kbps>      Hold an average bitrate with a bit reservoir (psychoacoustic;\n"
+                        "                          implies --masking)\n");
+        fprintf(stderr, "    --peak-bytes <n>      Largest frame under --bitrate (default: twice the average)\n");
+        fprintf(stderr, "    --bfp-bits <n>        Pack the phone band as block floating point with n-bit\n"
+                        "                          mantissas (8, 9, 10, 12 or 16; default: raw floats)\n");
+        fprintf(stderr, "    --udp                 Send one RTP packet per frame over UDP instead of a TCP stream\n");
+        fprintf(stderr, "    --jitter-buffer       Reorder received frames and play them out on a jitter-adaptive delay\n");
+        fprintf(stderr, "    --fec <k>             Send an XOR parity packet every k frames (2-%d, implies --jitter-buffer;\n"
+                        "                          adds about 1/k to the bitrate)\n", FEC_MAX_K);
+        fprintf(stderr, "    --dtx                 Detect silence and send comfort-noise descriptors instead of frames\n");
+        fprintf(stderr, "    --window <sine|kbd>   MDCT window (default: sine)\n");
+        fprintf(stderr, "    --isa <name>          Force FFT kernel: scalar, sse2, avx2, avx512 (default: auto)\n");
+        fprintf(stderr, "    --frame-size <n>      Samples per frame (default: %d)\n", DEFAULT_FRAME_SIZE);
+        fprintf(stderr, "    --sample-rate <hz>    Sample rate of the PCM stream (default: %d)\n", DEFAULT_SAMPLE_RATE);
+        fprintf(stderr, "    --capture-rate <hz>   Sample rate of stdin/stdout PCM, resampled to the codec rate\n"
+                        "                          (default: same as --sample-rate)\n");
+        fprintf(stderr, "    --bands <n>           Number of frequency bands (default: %d, or one per critical band)\n", DEFAULT_NUM_BANDS);
+        fprintf(stderr, "    --band-layout <linear|bark|erb>  Band spacing (default: linear)\n");
+        fprintf(stderr, "    --phone-low <hz>      Phone band lower edge (default: %d)\n", PHONE_BAND_LOW_HZ);
+        fprintf(stderr, "    --phone-high <hz>     Phone band upper edge (default: %d)\n", PHONE_BAND_HIGH_HZ);
         fprintf(stderr, "  Server: %s [options] <port>\n", argv[0]);
         fprintf(stderr, "  Client: %s [options] <ip> <port>\n", argv[0]);
+        fprintf(stderr, "  Over TCP the client offers its codec settings (-p/-b/-m, -e, --masking, --frame-size,\n"
+                        "  --sample-rate, --bands, --band-layout, --window, --bfp-bits, --phone-low/--phone-high)\n"
+                        "  at connect time; the server accepts them when it can and otherwise answers with its own.\n");
         fprintf(stderr, "\n");
         fprintf(stderr, "Examples:\n");
         fprintf(stderr, "  %s -p 12345                    # Psychoacoustic compression server\n", argv[0]);
         fprintf(stderr, "  %s -b 127.0.0.1 12345         # Phone band compression client\n", argv[0]);
+        fprintf(stderr, "  %s -m --window kbd 12345       # MDCT compression server\n", argv[0]);
+        fprintf(stderr, "  %s -m -e 127.0.0.1 12345      # MDCT compression client with entropy coding\n", argv[0]);
+        fprintf(stderr, "  %s -b --sample-rate 8000 --frame-size 256 12345   # 8kHz phone band server\n", argv[0]);
+        fprintf(stderr, "  %s -b --bfp-bits 10 127.0.0.1 12345              # Phone band with 10-bit mantissas\n", argv[0]);
+        fprintf(stderr, "  %s -p --band-layout bark --masking 12345          # Critical bands, per-frame bits\n", argv[0]);
+        fprintf(stderr, "  %s -p -e --bitrate 24 127.0.0.1 12345            # 24 kbps psychoacoustic client\n", argv[0]);
+        fprintf(stderr, "  rec -t raw -b 16 -c 1 -e s -r 44100 - | %s --capture-rate 44100 12345 \\\n"
+                        "      | play -t raw -b 16 -c 1 -e s -r 44100 -     # 44.1kHz sound card, 16kHz codec\n", argv[0]);
+        fprintf(stderr, "  %s -p -e --dtx 12345                             # Psychoacoustic server with DTX\n", argv[0]);
+        fprintf(stderr, "  %s -b --udp --dtx 127.0.0.1 12345                # Phone band over RTP/UDP\n", argv[0]);
+        fprintf(stderr, "  %s -b --udp --jitter-buffer 12345                # RTP/UDP with adaptive playout delay\n", argv[0]);
+        fprintf(stderr, "  %s -m --udp --fec 4 127.0.0.1 12345             # RTP/UDP with 25%% parity\n", argv[0]);
+        return 1;
+    }
+    if (socket_fd < 0) {
+        perror("UDP socket");
+        return 1;
+    }
+
+    // TCP では接続時に相手とコーデックの設定を決める
+    if (!g_udp && negotiate_codec(socket_fd, argc - arg_start == 1, bitrate_kbps > 0.0f,
+                                  &g_compression_method, &codec_opts) < 0) return 1;
+    if (bitrate_kbps > 0.0f && (g_compression_method != COMPRESS_PSYCHOACOUSTIC || !codec_opts.masking_model)) {
+        fprintf(stderr, "--bitrate is only supported with psychoacoustic compression and the masking model\n");
         return 1;
     }
 
-    sender_pid = fork();
-    if (sender_pid == 0) audio_sender(socket_fd);
+    // コーデックのプランを作る (送信と受信で共有する)
+    if (codec_plan_init(&g_plan, &codec_opts) < 0) return 1;
+
+    // 取り込み・再生のレートが違えば両方向の変換器を作る
+    if (g_capture_rate != g_plan.sample_rate) {
+        if (g_capture_rate > g_plan.sample_rate * MAX_CAPTURE_RATIO ||
+            g_plan.sample_rate > g_capture_rate * MAX_CAPTURE_RATIO) {
+            fprintf(stderr, "Capture rate %d Hz must be within %d times the codec rate %d Hz\n",
+                    g_capture_rate, MAX_CAPTURE_RATIO, g_plan.sample_rate);
+            return 1;
+        }
+        if (resampler_init(&g_capture_resampler, &g_plan, g_capture_rate, g_plan.sample_rate) < 0) return 1;
+        if (resampler_init(&g_playout_resampler, &g_plan, g_plan.sample_rate, g_capture_rate) < 0) return 1;
+    }
+    if (bitrate_kbps > 0.0f) {
+        // ビットレートにはフレームごとの長さの欄も含める
+        // 前方誤り訂正のパリティ (K フレームに1つ、フレームと同じくらいの長さ) の分はフレームに割り当てる量から除く
+        float frame_kbps = g_fec_k ? bitrate_kbps * g_fec_k / (g_fec_k + 1) : bitrate_kbps;
+        if (rate_control_init(&g_rate, &g_plan, frame_kbps, peak_bytes, frame_header_bytes()) < 0) return 1;
+        g_rate_control = 1;
+    }
+    static const char *layout_names[] = {"linear", "Bark", "ERB"};
+    fprintf(stderr, "Codec: %d samples/frame at %d Hz, %d bands (%s)\n",
+            g_plan.frame_size, g_plan.sample_rate, g_plan.num_bands, layout_names[g_plan.band_layout]);
+    fprintf(stderr, "FFT kernel: %s (%s)\n", g_plan.isa_name,
+            g_plan.specialized ? "specialized" : "generic");
+    if (g_capture_rate != g_plan.sample_rate) {
+        fprintf(stderr, "Capture/playout rate: %d Hz (polyphase %d/%d, %d taps/phase)\n",
+                g_capture_rate, g_capture_resampler.up, g_capture_resampler.down, g_capture_resampler.taps);
+    }
+    if (g_plan.entropy_coding && g_compression_method != COMPRESS_PHONE_BAND) {
+        fprintf(stderr, "Entropy coding: adaptive range coder\n");
+    }
+    if (g_fec_k) {
+        fprintf(stderr, "FEC: 1 XOR parity packet per %d frames (recovers one lost frame per group)\n", g_fec_k);
+    }
+    if (g_dtx) {
+        fprintf(stderr, "DTX: silent frames send a %d-byte noise descriptor (at most every %d frames)\n",
+                VAD_SID_BYTES, VAD_SID_INTERVAL);
+    }
+    
+    if (g_compression_method == COMPRESS_PSYCHOACOUSTIC) {
+        fprintf(stderr, "Using psychoacoustic compression\n");
+        if (g_plan.masking_model) fprintf(stderr, "Bit allocation: per-frame masking model\n");
+        if (g_rate_control) {
+            fprintf(stderr, "Rate control: %.1f kbps (%d bits/frame + %d-byte header), peak %d bytes/frame\n",
+                    bitrate_kbps, g_rate.frame_bits, frame_header_bytes(), g_rate.peak_bytes);
+        }
+        print_band_config(&g_plan);
+    } else if (g_compression_method == COMPRESS_MDCT) {
+        fprintf(stderr, "Using MDCT compression (%s window, 50%% overlap)\n",
+                g_plan.mdct_window == WINDOW_KBD ? "KBD" : "sine");
+        print_band_config(&g_plan);
+    } else {
+        fprintf(stderr, "Using phone band compression (%d-%d Hz)\n",
+                g_plan.phone_low_hz, g_plan.phone_high_hz);
+        fprintf(stderr, "Phone band filtering: %d Hz - %d Hz (bins %d - %d)\n",
+                g_plan.phone_low_hz, g_plan.phone_high_hz,
+                g_plan.phone_low_bin, g_plan.phone_high_bin);
+        if (g_plan.bfp_bits) {
+            fprintf(stderr, "Phone band packing: block floating point, %d-bit mantissas, %d bins per exponent\n",
+                    g_plan.bfp_bits, BFP_BLOCK_BINS);
+        }
+    }
 
-    receiver_pid = fork();
-    if (receiver_pid == 0) audio_receiver(socket_fd);
 
-    wait(NULL);
-    wait(NULL);
+    int status = run_call(socket_fd) < 0 ? 1 : 0;
     cleanup();
 
-    return 0;
+    return status;
 }
\ No newline at end of file
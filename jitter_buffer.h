@@ -0,0 +1,249 @@
+// 受信側のジッタバッファ (--jitter-buffer)
+// 届いたフレームをタイムスタンプ順に並べて溜め、送信側のサンプリングレートに合わせた一定の間隔で取り出す
+// 届いた順にすぐ標準出力へ書くと、ネットワークの揺らぎ (ジッタ) で再生側のパイプが空になった所で音が途切れる
+//
+// 遅延の決め方
+//   到着時刻とタイムスタンプの差の揺らぎ (RFC 3550 の interarrival jitter) を測り、
+//   目標の遅延 = JB_JITTER_FACTOR × ジッタ + 1フレーム (JB_MAX_DELAY_MS まで)
+//   目標は揺らぎが増えるか再生に間に合わないパケットが来ればすぐ上げ、揺らぎが減ったときはゆっくり下げる
+// 遅延の変え方 (どちらも1フレームずつなので、遅延は滑らかに増減する)
+//   伸ばす: 再生の時刻にフレームが届いていなければ補間を1フレーム出して待つ。
+//           目標より1フレーム以上少なければ、無音フレームはもう一度出し、有音フレームの前には補間を1フレーム挟む
+//   縮める: 目標より1フレーム以上多く溜まっていれば1フレーム飛ばす
+//   (有音区間では JB_SPEECH_ADJUST_INTERVAL フレームに1回まで。無音区間ではいつでも)
+// jb_set_min_delay で目標の下限を決められる (前方誤り訂正のパリティが届くのを待つ分など)
+// 後ろのフレームが届いているのに抜けているフレームは失われたものとして、補間を出して先へ進む
+// 無音フレームの後に抜けているフレームは、送信側が DTX で送らなかったものとして待たずに先へ進む
+// (呼び出し側は直前の雑音を続ける。遅延も伸ばさない)
+//
+// 時刻はすべてサンプル単位 (CLOCK_MONOTONIC × サンプリングレート)
+// 中身は呼び出し側が決める (silent は無音フレームか。遅延を変える場所を選ぶのに使う)
+// i3_phone_fft / phone / i1i2i3_phone から使う (ヘッダのみ)
+
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define JB_SLOTS 64                     // 溜められるフレーム数
+#define JB_JITTER_FACTOR 4.0            // 目標の遅延はジッタの何倍か
+#define JB_MAX_DELAY_MS 400             // 目標の遅延の上限
+#define JB_TARGET_RELEASE 64            // 目標を下げるときの時定数 (パケット数)
+#define JB_SPEECH_ADJUST_INTERVAL 16    // 有音区間で遅延を変える最短の間隔 (フレーム数)
+
+typedef enum {
+    JB_WAIT,      // まだ再生の時刻ではない
+    JB_FRAME,     // 届いたフレームを再生する
+    JB_CONCEAL,   // フレームが無いので補間を1フレーム再生する (無音区間なら快適雑音を続ける)
+    JB_END        // 送信側が終わり、溜めたフレームもすべて再生した
+} JitterResult;
+
+typedef struct {
+    int used;
+    int silent;
+    uint32_t timestamp;
+    int size;
+    unsigned char *data;
+} JitterSlot;
+
+typedef struct {
+    int frame_samples;       // 1フレームのサンプル数 (タイムスタンプの増分)
+    int rate;                // サンプリングレート (Hz)
+    JitterSlot slots[JB_SLOTS];
+    unsigned char *pool;     // フレームの中身 (JB_SLOTS × max_bytes)
+    int started, ended;
+    uint32_t first_ts;       // 最初に届いたフレームのタイムスタンプ
+    uint32_t next_ts;        // 次に再生するフレームのタイムスタンプ
+    uint32_t newest_ts;      // 届いた中で最も新しいフレームのタイムスタンプ
+    double next_play;        // 次に再生する時刻
+    double last_transit;     // 直前のフレームの (到着時刻 - タイムスタンプ)
+    double jitter;           // 到着の揺らぎ (サンプル数)
+    double target;           // 目標の遅延 (サンプル数)
+    double min_target;       // 目標の遅延の下限 (サンプル数)
+    int since_adjust;        // 有音区間で最後に遅延を変えてからのフレーム数
+    int last_silent;         // 直前に再生したのは無音フレームか
+    long played, concealed, late, stretched, skipped;
+    long continued;          // 無音区間で送られてこなかったフレーム (DTX)
+} JitterBuffer;
+
+static inline double jb_clock(const JitterBuffer *jb) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (t.tv_sec + t.tv_nsec * 1e-9) * jb->rate;
+}
+
+// max_bytes は1フレームの中身の最大 (読み出しの余白も含める)
+static inline int jb_init(JitterBuffer *jb, int frame_samples, int rate, int max_bytes) {
+    memset(jb, 0, sizeof(*jb));
+    jb->frame_samples = frame_samples;
+    jb->rate = rate;
+    jb->target = frame_samples;
+    jb->pool = (unsigned char *)malloc((size_t)JB_SLOTS * max_bytes);
+    if (!jb->pool) return -1;
+    for (int i = 0; i < JB_SLOTS; i++) jb->slots[i].data = jb->pool + (size_t)i * max_bytes;
+    return 0;
+}
+
+static inline void jb_free(JitterBuffer *jb) {
+    free(jb->pool);
+    jb->pool = NULL;
+}
+
+// 目標の遅延の下限を決める (JB_MAX_DELAY_MS より優先する)。最初のフレームを入れる前に呼ぶ
+static inline void jb_set_min_delay(JitterBuffer *jb, int samples) {
+    jb->min_target = samples;
+    if (jb->target < samples) jb->target = samples;
+}
+
+static inline JitterSlot *jb_slot(JitterBuffer *jb, uint32_t timestamp) {
+    return &jb->slots[((timestamp - jb->first_ts) / jb->frame_samples) % JB_SLOTS];
+}
+
+// 溜まっているサンプル数 (次に再生するフレームから、届いた中で最も新しいフレームの終わりまで)
+static inline int jb_buffered(const JitterBuffer *jb) {
+    if (!jb->started) return 0;
+    int32_t ahead = (int32_t)(jb->newest_ts - jb->next_ts);
+    return (ahead < 0) ? 0 : ahead + jb->frame_samples;
+}
+
+// 今の遅延と目標の遅延 (ms)
+static inline double jb_delay_ms(const JitterBuffer *jb) {
+    return 1000.0 * jb_buffered(jb) / jb->rate;
+}
+
+static inline double jb_target_ms(const JitterBuffer *jb) {
+    return 1000.0 * jb->target / jb->rate;
+}
+
+static inline double jb_jitter_ms(const JitterBuffer *jb) {
+    return 1000.0 * jb->jitter / jb->rate;
+}
+
+// これ以上先のフレームは置けない (受信を止めて再生を進める)
+static inline int jb_full(const JitterBuffer *jb) {
+    return jb_buffered(jb) >= JB_SLOTS * jb->frame_samples;
+}
+
+// 送信側が終わった (溜まっている分を再生したら JB_END を返す)
+static inline void jb_end(JitterBuffer *jb) {
+    jb->ended = 1;
+}
+
+// 届いたフレームを入れる。再生済みのフレーム、JB_SLOTS 以上先のフレーム、重複は捨てて 0 を返す
+static inline int jb_put(JitterBuffer *jb, uint32_t timestamp, int silent, const unsigned char *data, int size) {
+    double now = jb_clock(jb);
+    if (!jb->started) {
+        jb->started = 1;
+        jb->first_ts = jb->next_ts = jb->newest_ts = timestamp;
+        jb->next_play = now + jb->target;
+        jb->last_transit = now;
+    } else {
+        // 到着の揺らぎ (RFC 3550 A.8 と同じく 1/16 の指数平滑)
+        double transit = now - (double)(int32_t)(timestamp - jb->first_ts);
+        jb->jitter += (fabs(transit - jb->last_transit) - jb->jitter) / 16.0;
+        jb->last_transit = transit;
+
+        double wanted = JB_JITTER_FACTOR * jb->jitter + jb->frame_samples;
+        double limit = (double)JB_MAX_DELAY_MS * jb->rate / 1000.0;
+        if (wanted > limit) wanted = limit;
+        if (wanted < jb->min_target) wanted = jb->min_target;
+        if (wanted > jb->target) jb->target = wanted;
+        else jb->target += (wanted - jb->target) / JB_TARGET_RELEASE;
+    }
+
+    int32_t ahead = (int32_t)(timestamp - jb->next_ts);
+    if (ahead < 0) {
+        // 再生に間に合わなかった: 揺らぎの見積もりが足りないので目標を1フレーム上げる
+        double limit = (double)JB_MAX_DELAY_MS * jb->rate / 1000.0;
+        jb->target = fmax(fmin(jb->target + jb->frame_samples, limit), jb->min_target);
+        jb->late++;
+        return 0;
+    }
+    if (ahead >= JB_SLOTS * jb->frame_samples) {
+        jb->late++;
+        return 0;
+    }
+    JitterSlot *s = jb_slot(jb, timestamp);
+    if (s->used && s->timestamp == timestamp) return 0;
+    s->used = 1;
+    s->silent = silent;
+    s->timestamp = timestamp;
+    s->size = size;
+    memcpy(s->data, data, size);
+    if ((int32_t)(timestamp - jb->newest_ts) > 0) jb->newest_ts = timestamp;
+    return 1;
+}
+
+// 次の再生の時刻までの ms (まだ何も届いていなければ -1 = 受信を待つ)
+static inline int jb_wait_ms(const JitterBuffer *jb) {
+    if (!jb->started) return jb->ended ? 0 : -1;
+    double ms = (jb->next_play - jb_clock(jb)) * 1000.0 / jb->rate;
+    return (ms <= 0) ? 0 : (int)ceil(ms);
+}
+
+// 再生の時刻になっていれば1フレーム取り出す
+// JB_FRAME なら silent / data / size にフレームを返す (data は次に jb_put するまで有効)
+static inline JitterResult jb_get(JitterBuffer *jb, int *silent, unsigned char **data, int *size) {
+    if (!jb->started) return jb->ended ? JB_END : JB_WAIT;
+    if (jb_clock(jb) < jb->next_play) return JB_WAIT;
+
+    while (1) {
+        JitterSlot *s = jb_slot(jb, jb->next_ts);
+        int newer = (int32_t)(jb->newest_ts - jb->next_ts) > 0;
+        if (!s->used || s->timestamp != jb->next_ts) {
+            if (!newer && jb->ended) return JB_END;
+            if (jb->last_silent) {
+                // 無音区間: 送信側が送らなかったフレームなので、雑音を続けて先へ進む
+                jb->next_ts += jb->frame_samples;
+                jb->next_play += jb->frame_samples;
+                jb->continued++;
+                return JB_CONCEAL;
+            }
+            // 後ろが届いていれば失われたフレームとして先へ進み、そうでなければ届くのを待つ (遅延が伸びる)
+            if (newer) jb->next_ts += jb->frame_samples;
+            else jb->stretched++;
+            jb->next_play += jb->frame_samples;
+            jb->concealed++;
+            return JB_CONCEAL;
+        }
+
+        int buffered = jb_buffered(jb);
+        int can_adjust = s->silent || ++jb->since_adjust >= JB_SPEECH_ADJUST_INTERVAL;
+        if (can_adjust && !s->silent) jb->since_adjust = 0;
+        if (can_adjust && newer && buffered > jb->target + jb->frame_samples) {
+            // 溜まりすぎているので1フレーム飛ばす
+            s->used = 0;
+            jb->next_ts += jb->frame_samples;
+            jb->skipped++;
+            continue;
+        }
+        int grow = can_adjust && !jb->ended && buffered + jb->frame_samples <= jb->target;
+        jb->next_play += jb->frame_samples;
+        if (grow && !s->silent) {
+            // 足りないので有音フレームの前に補間を1フレーム挟む (次もこのフレームから)
+            jb->stretched++;
+            jb->concealed++;
+            return JB_CONCEAL;
+        }
+
+        *silent = s->silent;
+        *data = s->data;
+        *size = s->size;
+        jb->played++;
+        jb->last_silent = s->silent;
+        if (grow) {
+            // 足りないので無音フレームをもう一度出す (次もこのフレームから)
+            jb->stretched++;
+        } else {
+            s->used = 0;
+            jb->next_ts += jb->frame_samples;
+        }
+        return JB_FRAME;
+    }
+}
+
+#endif
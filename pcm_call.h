@@ -0,0 +1,177 @@
+// 生PCMの通話 (phone / i1i2i3_phone): 標準入力をソケットへ送り、ソケットから届いたものを標準出力へ書く
+// 以前は送信と受信を別々のプロセスに fork していたが、1つのプロセスのイベントループ (event_loop.h) で両方向を回す
+//   TCP: 標準入力をそのまま送る (--dtx なら DTX_FRAME_SAMPLES サンプルのフレームごとに dtx_encode_frame)
+//   --udp: 1フレームを1つの RTP パケットにする (rtp_pcm_send_frame / rtp_pcm_receive_packet)
+//   --jitter-buffer: 受信したパケットをジッタバッファに入れ、次の再生の時刻を待ちの期限にして書き出す
+// 通話は、送信が終わり (標準入力の終わりまで送って TCP なら shutdown(SHUT_WR)、UDP なら送信終了のパケット)、
+// 受信が終わり (相手が閉じたか送信終了のパケット)、標準出力に書ききったときに終わる
+// 途中のエラーは止まった方向だけを終わらせ、PcmCallResult の errors に残す (表示は呼び出し側)
+// phone / i1i2i3_phone から使う (ヘッダのみ)
+
+#ifndef PCM_CALL_H
+#define PCM_CALL_H
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "event_loop.h"
+#include "vad.h"
+#include "rtp.h"
+#include "jitter_buffer.h"
+
+#define PCM_CALL_BUFFER 65536         // 溜め置きの初期の大きさ
+
+// errors のビット
+#define PCM_CALL_INPUT_ERROR 0x01     // 標準入力の読み込み
+#define PCM_CALL_SEND_ERROR 0x02      // ソケットへの送信 (相手が切断した)
+#define PCM_CALL_RECEIVE_ERROR 0x04   // ソケットの受信 (--dtx では壊れたストリームも)
+#define PCM_CALL_OUTPUT_ERROR 0x08    // 標準出力への書き込み
+
+typedef struct {
+    long frames;             // 送ったフレーム数 (--dtx / --udp)
+    long silent_frames;      // そのうち無音として送ったフレーム数
+    RtpReceiveStats stats;   // 受信したパケット (--udp)
+    int errors;              // PCM_CALL_*_ERROR
+} PcmCallResult;
+
+// sock_fd で通話する。jb は --jitter-buffer のときだけ渡す (--udp のみ)
+// loop は呼び出し側が持ち、通話の間は ev_current が指す (戻る前に ev_free で外す)
+// イベントループを用意できなければ -1
+static inline int pcm_call_run(EventLoop *loop, int sock_fd, int dtx, int udp, JitterBuffer *jb,
+                               PcmCallResult *res) {
+    EvBuffer input = {0}, sock_out = {0}, sock_in = {0}, output = {0};  // 準備の途中で失敗しても解放できるように空にしておく
+    RtpPcmSender rtp_sender;
+    RtpPcmReceiver rtp_receiver;
+    VadState vad;
+    ComfortNoise cn;
+    unsigned char packet[RTP_MAX_PACKET];
+    short pcm[RTP_PCM_RECEIVE_SAMPLES];  // 受信では隙間を埋める雑音も入る
+    const int frame_bytes = DTX_FRAME_SAMPLES * sizeof(short);
+    int framed = dtx || udp;
+    int input_open = 1, send_done = 0, recv_done = 0;
+
+    memset(res, 0, sizeof(*res));
+    if (ev_init(loop) < 0) {
+        ev_free(loop);
+        return -1;
+    }
+    if (ev_buffer_init(&input, PCM_CALL_BUFFER) < 0 || ev_buffer_init(&sock_out, PCM_CALL_BUFFER) < 0 ||
+        ev_buffer_init(&sock_in, PCM_CALL_BUFFER) < 0 || ev_buffer_init(&output, PCM_CALL_BUFFER) < 0 ||
+        ev_add(loop, STDIN_FILENO, EPOLLIN) < 0 || ev_add(loop, sock_fd, EPOLLIN) < 0 ||
+        ev_add(loop, STDOUT_FILENO, 0) < 0) {
+        ev_free(loop);
+        ev_buffer_free(&input);
+        ev_buffer_free(&sock_out);
+        ev_buffer_free(&sock_in);
+        ev_buffer_free(&output);
+        return -1;
+    }
+    rtp_pcm_sender_init(&rtp_sender, dtx);
+    rtp_pcm_receiver_init(&rtp_receiver, jb);
+    vad_init(&vad);
+    cng_init(&cn);
+
+    while (!send_done || !recv_done || ev_buffered(&output) > 0) {
+        // 書ききれない出力が溜まっている間は、そこへ流し込む入力を待たない
+        int listen_input = input_open && ev_buffered(&sock_out) < EV_HIGH_WATER;
+        int listen_socket = !recv_done && ev_buffered(&output) < EV_HIGH_WATER && !(jb && jb_full(jb));
+        ev_set_events(loop, STDIN_FILENO, listen_input ? EPOLLIN : 0);
+        ev_set_events(loop, sock_fd, (listen_socket ? EPOLLIN : 0) | (ev_buffered(&sock_out) > 0 ? EPOLLOUT : 0));
+        ev_set_events(loop, STDOUT_FILENO, ev_buffered(&output) > 0 ? EPOLLOUT : 0);
+        if (ev_wait(loop, (jb && !recv_done) ? jb_wait_ms(jb) : -1) < 0) break;
+
+        // 標準入力 → ソケット
+        if (ev_ready(loop, STDIN_FILENO) & EPOLLIN) {
+            // 区切らずに送るときはそのまま送信の溜め置きに読む
+            int got = ev_read(framed ? &input : &sock_out, STDIN_FILENO);
+            if (got == 0 || got == -1) {
+                if (got < 0) res->errors |= PCM_CALL_INPUT_ERROR;
+                input_open = 0;
+            }
+            // 揃ったフレームから送る (最後の半端なフレームは捨てる)
+            while (framed && ev_buffered(&input) >= frame_bytes) {
+                int silent;
+                memcpy(pcm, ev_peek(&input), frame_bytes);
+                ev_consume(&input, frame_bytes);
+                if (udp) {
+                    if (rtp_pcm_send_frame(sock_fd, &rtp_sender, pcm, &silent) < 0) {
+                        res->errors |= PCM_CALL_SEND_ERROR;
+                        input_open = 0;
+                        break;
+                    }
+                } else {
+                    int len = dtx_encode_frame(&vad, pcm, packet, &silent);
+                    ev_append(&sock_out, packet, len);
+                }
+                res->frames++;
+                res->silent_frames += silent;
+            }
+        }
+        if (!send_done && ev_buffered(&sock_out) > 0 && ev_flush(&sock_out, sock_fd) < 0) {
+            res->errors |= PCM_CALL_SEND_ERROR;
+            input_open = 0;
+            ev_consume(&sock_out, ev_buffered(&sock_out));
+        }
+        if (!send_done && !input_open && ev_buffered(&sock_out) == 0) {
+            // 送り終えたことを相手に知らせる
+            if (udp) rtp_pcm_send_bye(sock_fd, &rtp_sender);
+            else shutdown(sock_fd, SHUT_WR);
+            send_done = 1;
+        }
+
+        // ソケット → 標準出力
+        if (!recv_done && (ev_ready(loop, sock_fd) & EPOLLIN)) {
+            if (udp) {
+                int len;
+                while ((len = rtp_recv(sock_fd, packet, RTP_MAX_PACKET)) >= 0) {
+                    int bytes = rtp_pcm_receive_packet(&rtp_receiver, packet, len, pcm);
+                    if (bytes > 0) ev_append(&output, pcm, bytes);
+                    if (bytes < 0 && !jb) recv_done = 1;
+                    if (bytes < 0 || (jb && jb_full(jb))) break;
+                }
+                if (len == -1) {
+                    res->errors |= PCM_CALL_RECEIVE_ERROR;
+                    if (jb) jb_end(jb);
+                    else recv_done = 1;
+                }
+            } else {
+                // 区切らずに受けるときはそのまま出力の溜め置きに読む
+                int got = ev_read(dtx ? &sock_in : &output, sock_fd);
+                if (got == -1) res->errors |= PCM_CALL_RECEIVE_ERROR;
+                if (got == 0 || got == -1) recv_done = 1;
+                int used = 0;
+                while (dtx && (used = dtx_decode_packet(&cn, ev_peek(&sock_in), ev_buffered(&sock_in), pcm)) > 0) {
+                    ev_consume(&sock_in, used);
+                    ev_append(&output, pcm, frame_bytes);
+                }
+                if (dtx && used < 0) {
+                    res->errors |= PCM_CALL_RECEIVE_ERROR;
+                    recv_done = 1;
+                }
+            }
+        }
+        if (jb && !recv_done) {
+            // 再生の時刻になったフレームを書き出す
+            int bytes;
+            while ((bytes = rtp_pcm_playout(&rtp_receiver, pcm)) > 0) ev_append(&output, pcm, bytes);
+            if (bytes < 0) recv_done = 1;
+        }
+        if (ev_buffered(&output) > 0 && ev_flush(&output, STDOUT_FILENO) < 0) {
+            // 書き出せないなら受信も止める
+            res->errors |= PCM_CALL_OUTPUT_ERROR;
+            recv_done = 1;
+            ev_consume(&output, ev_buffered(&output));
+        }
+    }
+
+    res->stats = rtp_receiver.stats;
+    ev_free(loop);
+    ev_buffer_free(&input);
+    ev_buffer_free(&sock_out);
+    ev_buffer_free(&sock_in);
+    ev_buffer_free(&output);
+    return 0;
+}
+
+#endif
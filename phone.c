@@ -6,87 +6,109 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <sys/wait.h> // For waitpid()
 #include <errno.h>    // For errno
+#include <signal.h>   // For signal()
 
-#define BUFFER_SIZE 4096 // データ送受信用バッファサイズ
+#include "vad.h"      // --dtx 用の音声区間検出と快適雑音
+#include "rtp.h"      // --udp 用の RTP 形式のパケット
+#include "pcm_call.h" // 送信と受信を1つのプロセスで回すイベントループ
+
+#define PCM_SAMPLE_RATE 44100 // --sample-rate の既定値 (rec / play の -r と合わせる)
 
 void error_exit(const char *msg) {
     perror(msg);
     exit(EXIT_FAILURE);
 }
 
-void transfer_data(int fd_from, int fd_to, const char* direction_name, int socket_to_shutdown_for_sender) {
-    
-    char buffer[BUFFER_SIZE];
-    ssize_t n_read, n_written_total, n_written_single;
-    int read_error_occurred = 0;
-    int write_error_occurred = 0;
-
-    fprintf(stderr, "[%s PID: %d] データ転送開始 (from fd %d to fd %d).\n",
-            direction_name, getpid(), fd_from, fd_to);
-
-    while ((n_read = read(fd_from, buffer, BUFFER_SIZE)) > 0) {
-        n_written_total = 0;
-        while (n_written_total < n_read) {
-            n_written_single = write(fd_to, buffer + n_written_total, n_read - n_written_total);
-            if (n_written_single < 0) {
-                if (errno == EINTR) continue; // シグナルによる中断なら再試行
-                
-                if (errno == EPIPE) {
-                    fprintf(stderr, "[%s PID: %d] 書込みエラー: Broken pipe (相手が接続を切断したか、パイプがクローズされました).\n",
-                            direction_name, getpid());
-                } else {
-                    fprintf(stderr, "[%s PID: %d] 書込みエラー: ", direction_name, getpid());
-                    perror("");
-                }
-                write_error_occurred = 1;
-                goto end_loop; 
-            }
-            n_written_total += n_written_single;
-        }
+// Ctrl-C などで終わるときも標準入出力を非ブロッキングのまま残さない
+void signal_handler(int sig) {
+    ev_restore_on_exit();
+    exit(0);
+}
+
+// 1つのプロセスで送信 (標準入力 -> ソケット) と受信 (ソケット -> 標準出力) を同時に行う (pcm_call.h)
+// --dtx / --udp では 16bit モノラル PCM を DTX_FRAME_SAMPLES サンプルのフレームに区切って送る
+// --dtx では無音区間は雑音記述子だけを送り、--udp では1フレームを1つの RTP パケットにする
+// jitter_rate が 0 でなければ、受信したパケットをそのサンプリングレートで再生するジッタバッファに通す
+void run_call(int conn_fd, int dtx, int udp, int jitter_rate) {
+    EventLoop loop;
+    PcmCallResult res;
+    JitterBuffer jb;
+    if (jitter_rate && jb_init(&jb, DTX_FRAME_SAMPLES, jitter_rate, DTX_FRAME_SAMPLES * sizeof(short)) < 0) {
+        error_exit("ジッタバッファの確保エラー");
     }
 
-end_loop:
-    if (n_read < 0) {
-        fprintf(stderr, "[%s PID: %d] 読込みエラー: ", direction_name, getpid());
-        perror("");
-        read_error_occurred = 1;
+    fprintf(stderr, "[PID: %d] %sデータ転送開始 (標準入力 -> fd %d -> 標準出力).\n",
+            getpid(), udp ? "UDP " : dtx ? "DTX " : "", conn_fd);
+    if (pcm_call_run(&loop, conn_fd, dtx, udp, jitter_rate ? &jb : NULL, &res) < 0) error_exit("イベントループの準備エラー");
+
+    if (res.errors & PCM_CALL_INPUT_ERROR) {
+        fprintf(stderr, "[送信] 標準入力の読込みエラーのため、送信を停止しました。\n");
+    } else if (res.errors & PCM_CALL_SEND_ERROR) {
+        fprintf(stderr, "[送信] 書込みエラー (相手が接続を切断しました) のため、送信を異常終了しました。\n");
+    } else {
+        fprintf(stderr, "[送信] 標準入力からの読み込みが正常に終了しました。送信を停止しました。\n");
+    }
+    if (dtx || udp) {
+        fprintf(stderr, "[送信] %ld フレーム中 %ld フレームを無音として送信しました。\n", res.frames, res.silent_frames);
     }
 
-    if (socket_to_shutdown_for_sender != -1) { // 送信担当の場合 (STDIN -> socket)
-        if (write_error_occurred) {
-             fprintf(stderr, "[%s PID: %d] 書込みエラーのため、送信を異常終了します。\n", direction_name, getpid());
-        } else if (read_error_occurred) {
-             fprintf(stderr, "[%s PID: %d] 標準入力の読込みエラーのため、送信を停止します。\n", direction_name, getpid());
-        } else { // n_read == 0 (EOF from stdin)
-             fprintf(stderr, "[%s PID: %d] 標準入力からの読み込みが正常に終了しました。送信を停止します。\n", direction_name, getpid());
-        }
-        // 送信パスからの送信終了を通知
-        if (shutdown(socket_to_shutdown_for_sender, SHUT_WR) < 0) {
-            if (errno != ENOTCONN && errno != EPIPE) { // 既に切断されている場合はエラーとしない
-                 fprintf(stderr, "[%s PID: %d] shutdown(SHUT_WR) エラー: ", direction_name, getpid());
-                 perror("");
-            }
-        }
-    } else { // 受信担当の場合 (socket -> STDOUT)
-        if (write_error_occurred) {
-            fprintf(stderr, "[%s PID: %d] 標準出力への書込みエラーのため、受信を終了します。\n", direction_name, getpid());
-        } else if (read_error_occurred) {
-            fprintf(stderr, "[%s PID: %d] ソケットの読込みエラーのため、受信を終了します。\n", direction_name, getpid());
-        } else { // n_read == 0 (EOF from socket)
-            fprintf(stderr, "[%s PID: %d] ソケットからの読み込みが正常に終了しました (相手が送信を停止)。\n", direction_name, getpid());
-        }
+    if (res.errors & PCM_CALL_OUTPUT_ERROR) {
+        fprintf(stderr, "[受信] 標準出力への書込みエラーのため、受信を終了しました。\n");
+    } else if (res.errors & PCM_CALL_RECEIVE_ERROR) {
+        fprintf(stderr, "[受信] ソケットの読込みエラーのため、受信を終了しました。\n");
+    } else {
+        fprintf(stderr, "[受信] ソケットからの読み込みが正常に終了しました (相手が送信を停止)。\n");
+    }
+    if (udp) {
+        fprintf(stderr, "[受信] %ld パケットを受信しました (欠落 %ld, 遅着で破棄 %ld)。\n",
+                res.stats.received, res.stats.lost, res.stats.late);
+    }
+    if (jitter_rate) {
+        fprintf(stderr, "[受信] ジッタバッファ: 遅延 %.0f ms (目標 %.0f ms, ジッタ %.1f ms), "
+                "補間 %ld フレーム, 再生に間に合わず破棄 %ld, 伸長 %ld, 短縮 %ld。\n",
+                jb_delay_ms(&jb), jb_target_ms(&jb), jb_jitter_ms(&jb),
+                jb.concealed, jb.late, jb.stretched, jb.skipped);
+        jb_free(&jb);
     }
-    fprintf(stderr, "[%s PID: %d] データ転送終了。\n", direction_name, getpid());
+    fprintf(stderr, "[PID: %d] データ転送終了。\n", getpid());
 }
 
 
 int main(int argc, char *argv[]) {
-    if (argc < 3) {
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    // 先頭のオプション (両端で同じものを指定すること)
+    //   --dtx: 不連続送信
+    //   --udp: TCP の代わりに UDP で RTP 形式のパケットを送る
+    //   --jitter-buffer: 受信したパケットをジッタバッファで並べ直し、一定の間隔で再生する (--udp と一緒に使う)
+    //   --sample-rate <Hz>: ジッタバッファが再生の間隔に使うサンプリングレート
+    int dtx = 0, udp = 0, jitter_buffer = 0, sample_rate = PCM_SAMPLE_RATE;
+    int a = 1; // モード引数の位置
+    while (a < argc && strncmp(argv[a], "--", 2) == 0) {
+        if (strcmp(argv[a], "--dtx") == 0) dtx = 1;
+        else if (strcmp(argv[a], "--udp") == 0) udp = 1;
+        else if (strcmp(argv[a], "--jitter-buffer") == 0) jitter_buffer = 1;
+        else if (strcmp(argv[a], "--sample-rate") == 0 && a + 1 < argc) sample_rate = atoi(argv[++a]);
+        else break;
+        a++;
+    }
+    int num_options = a - 1;
+    int jitter_rate = jitter_buffer ? sample_rate : 0;
+    if (jitter_buffer && (!udp || sample_rate <= 0)) {
+        fprintf(stderr, "--jitter-buffer は --udp と一緒に、正のサンプリングレートで使ってください。\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (argc - num_options < 3) {
         fprintf(stderr, "使用法:\n");
-        fprintf(stderr, "  サーバーモード: %s server <ポート番号>\n", argv[0]);
-        fprintf(stderr, "  クライアントモード: %s client <IPアドレス> <ポート番号>\n", argv[0]);
+        fprintf(stderr, "  サーバーモード: %s [オプション] server <ポート番号>\n", argv[0]);
+        fprintf(stderr, "  クライアントモード: %s [オプション] client <IPアドレス> <ポート番号>\n", argv[0]);
+        fprintf(stderr, "  --dtx: 無音区間はフレームの代わりに雑音記述子を送り、受信側で快適雑音を合成する (16bit モノラル PCM)\n");
+        fprintf(stderr, "  --udp: 1フレームずつ RTP 形式のパケットにして UDP で送る (失われたフレームは待たない)\n");
+        fprintf(stderr, "  --jitter-buffer: 受信したパケットを揺らぎに合わせた遅延で並べ直して再生する (--udp と一緒に使う)\n");
+        fprintf(stderr, "  --sample-rate <Hz>: ジッタバッファの再生のサンプリングレート (既定: %d)\n", PCM_SAMPLE_RATE);
         exit(EXIT_FAILURE);
     }
 
@@ -94,108 +116,86 @@ int main(int argc, char *argv[]) {
     int conn_fd = -1, listen_fd = -1;
     struct sockaddr_in serv_addr, client_addr;
     socklen_t client_len;
-    pid_t pid;
 
-    int is_server_mode = (strcmp(argv[1], "server") == 0);
+    int is_server_mode = (strcmp(argv[a], "server") == 0);
 
     if (is_server_mode) { // サーバーモード
-        if (argc != 3) {
-            fprintf(stderr, "サーバー使用法: %s server <ポート番号>\n", argv[0]);
+        if (argc - num_options != 3) {
+            fprintf(stderr, "サーバー使用法: %s [オプション] server <ポート番号>\n", argv[0]);
             exit(EXIT_FAILURE);
         }
-        port = atoi(argv[2]);
+        port = atoi(argv[a + 1]);
 
-        if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) error_exit("socket 作成エラー (サーバー)");
+        if (udp) {
+            if ((conn_fd = rtp_udp_server(port)) < 0) error_exit("UDP ソケットエラー (サーバー)");
+        } else {
+            if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) error_exit("socket 作成エラー (サーバー)");
         
-        int optval = 1;
-        if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0) {
-            close(listen_fd); // setsockopt失敗時はlisten_fdを閉じる
-            error_exit("setsockopt(SO_REUSEADDR) エラー");
-        }
+            int optval = 1;
+            if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0) {
+                close(listen_fd); // setsockopt失敗時はlisten_fdを閉じる
+                error_exit("setsockopt(SO_REUSEADDR) エラー");
+            }
 
-        memset(&serv_addr, 0, sizeof(serv_addr));
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        serv_addr.sin_port = htons(port);
+            memset(&serv_addr, 0, sizeof(serv_addr));
+            serv_addr.sin_family = AF_INET;
+            serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+            serv_addr.sin_port = htons(port);
 
-        if (bind(listen_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-            close(listen_fd);
-            error_exit("bind エラー");
-        }
-        if (listen(listen_fd, 1) < 0) { // この電話アプリでは1対1通信のみ想定
-            close(listen_fd);
-            error_exit("listen エラー");
-        }
-        fprintf(stderr, "[メインプロセス PID: %d] サーバー: ポート %d で接続待機中...\n", getpid(), port);
-        client_len = sizeof(client_addr);
-        if ((conn_fd = accept(listen_fd, (struct sockaddr *)&client_addr, &client_len)) < 0) {
-            close(listen_fd);
-            error_exit("accept エラー");
+            if (bind(listen_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+                close(listen_fd);
+                error_exit("bind エラー");
+            }
+            if (listen(listen_fd, 1) < 0) { // この電話アプリでは1対1通信のみ想定
+                close(listen_fd);
+                error_exit("listen エラー");
+            }
+            fprintf(stderr, "[メインプロセス PID: %d] サーバー: ポート %d で接続待機中...\n", getpid(), port);
+            client_len = sizeof(client_addr);
+            if ((conn_fd = accept(listen_fd, (struct sockaddr *)&client_addr, &client_len)) < 0) {
+                close(listen_fd);
+                error_exit("accept エラー");
+            }
+            char client_ip_str[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &client_addr.sin_addr, client_ip_str, sizeof(client_ip_str));
+            fprintf(stderr, "[メインプロセス PID: %d] サーバー: クライアント %s:%d が接続しました。\n", getpid(), client_ip_str, ntohs(client_addr.sin_port));
+            close(listen_fd); // 1対1接続なのでリスニングソケットは閉じる
+            listen_fd = -1; 
         }
-        char client_ip_str[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip_str, sizeof(client_ip_str));
-        fprintf(stderr, "[メインプロセス PID: %d] サーバー: クライアント %s:%d が接続しました。\n", getpid(), client_ip_str, ntohs(client_addr.sin_port));
-        close(listen_fd); // 1対1接続なのでリスニングソケットは閉じる
-        listen_fd = -1; 
     } else { // クライアントモード
-        if (strcmp(argv[1], "client") != 0 || argc != 4) {
-            fprintf(stderr, "クライアント使用法: %s client <IPアドレス> <ポート番号>\n", argv[0]);
+        if (strcmp(argv[a], "client") != 0 || argc - num_options != 4) {
+            fprintf(stderr, "クライアント使用法: %s [オプション] client <IPアドレス> <ポート番号>\n", argv[0]);
             exit(EXIT_FAILURE);
         }
-        char *server_ip = argv[2];
-        port = atoi(argv[3]);
+        char *server_ip = argv[a + 1];
+        port = atoi(argv[a + 2]);
 
-        if ((conn_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) error_exit("socket 作成エラー (クライアント)");
+        if (udp) {
+            if ((conn_fd = rtp_udp_client(server_ip, port)) < 0) error_exit("UDP ソケットエラー (クライアント)");
+        } else {
+            if ((conn_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) error_exit("socket 作成エラー (クライアント)");
         
-        memset(&serv_addr, 0, sizeof(serv_addr));
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_port = htons(port);
-        if (inet_pton(AF_INET, server_ip, &serv_addr.sin_addr) <= 0) {
-            close(conn_fd);
-            error_exit("inet_pton 無効なIPアドレスまたは変換エラー");
-        }
+            memset(&serv_addr, 0, sizeof(serv_addr));
+            serv_addr.sin_family = AF_INET;
+            serv_addr.sin_port = htons(port);
+            if (inet_pton(AF_INET, server_ip, &serv_addr.sin_addr) <= 0) {
+                close(conn_fd);
+                error_exit("inet_pton 無効なIPアドレスまたは変換エラー");
+            }
 
-        fprintf(stderr, "[メインプロセス PID: %d] クライアント: サーバー %s:%d に接続中...\n", getpid(), server_ip, port);
-        if (connect(conn_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-            close(conn_fd);
-            error_exit("connect エラー");
+            fprintf(stderr, "[メインプロセス PID: %d] クライアント: サーバー %s:%d に接続中...\n", getpid(), server_ip, port);
+            if (connect(conn_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+                close(conn_fd);
+                error_exit("connect エラー");
+            }
+            fprintf(stderr, "[メインプロセス PID: %d] クライアント: サーバーに接続しました。\n", getpid());
         }
-        fprintf(stderr, "[メインプロセス PID: %d] クライアント: サーバーに接続しました。\n", getpid());
     }
 
     // この時点で conn_fd はサーバー・クライアント双方で確立済み
-    
-    pid = fork();
-    if (pid < 0) {
-        close(conn_fd);
-        error_exit("fork エラー");
-    }
-
-    if (pid == 0) { // 子プロセス: 受信担当 (ソケット -> 標準出力)
-        transfer_data(conn_fd, STDOUT_FILENO, "受信担当", -1);
-        fprintf(stderr, "[受信担当 PID: %d] 終了します。\n", getpid());
-        close(conn_fd); // 子プロセス側のconn_fdをクローズ
-        exit(0); 
-    } else { // 親プロセス: 送信担当 (標準入力 -> ソケット)
-        transfer_data(STDIN_FILENO, conn_fd, "送信担当", conn_fd);
-        
-        fprintf(stderr, "[送信担当 PID: %d] 子プロセス (受信担当) の終了を待機中...\n", getpid());
-        int status;
-        if (waitpid(pid, &status, 0) < 0) {
-            perror("waitpid エラー");
-        } else {
-            if (WIFEXITED(status)) {
-                fprintf(stderr, "[送信担当 PID: %d] 子プロセスはステータス %d で正常終了しました。\n", getpid(), WEXITSTATUS(status));
-            } else if (WIFSIGNALED(status)) {
-                fprintf(stderr, "[送信担当 PID: %d] 子プロセスはシグナル %d で異常終了しました。\n", getpid(), WTERMSIG(status));
-            } else {
-                 fprintf(stderr, "[送信担当 PID: %d] 子プロセスの終了ステータスは不明です: %d\n", getpid(), status);
-            }
-        }
-        
-        close(conn_fd); // 親プロセス側のconn_fdをクローズ
-        fprintf(stderr, "[送信担当 PID: %d] 全ての処理を終了しました。\n", getpid());
-    }
+    run_call(conn_fd, dtx, udp, jitter_rate);
+    close(conn_fd);
+    fprintf(stderr, "[PID: %d] 全ての処理を終了しました。\n", getpid());
 
     return 0;
 }
\ No newline at end of file
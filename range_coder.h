@@ -0,0 +1,204 @@
+// 適応型レンジ符号器 (量子化後のスペクトル記号のエントロピー符号化用)
+// 32bit のレンジと桁上がり用のキャッシュを持つ方式で、1byte 単位で出力する
+// 記号の出現頻度は AdaptiveModel で数え、符号化・復号の双方で同じ順に更新する
+//
+// 復号側は入力の終わりより後ろを 0 として読むので、入力バッファに余白は不要
+// (符号化側は末尾の 0 を送らない)
+
+#ifndef RANGE_CODER_H
+#define RANGE_CODER_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define RC_MAX_SYMBOLS 256       // 1モデルあたりの最大記号数
+#define RC_TOP (1u << 24)        // レンジがこれを下回ったら1byte出力する
+#define RC_INCREMENT 24          // 1回の出現で加える頻度
+#define RC_MAX_TOTAL (1u << 16)  // 頻度の合計がこれを超えたら半分にする
+#define RC_MAX_DIRECT_BITS 16    // 1回で符号化できる生ビット数の上限
+#define RC_BLOCK_SHIFT 4         // 累積頻度を求めるときにまとめて飛ばす記号数 (log2)
+
+// 適応頻度モデル
+// 記号 16 個ごとの頻度の和 (block) も持ち、累積頻度の計算と記号の探索を記号数によらず
+// 高々 32 ステップで済ませる
+typedef struct {
+    int num_symbols;
+    uint32_t total;
+    uint16_t freq[RC_MAX_SYMBOLS];
+    uint32_t block[RC_MAX_SYMBOLS >> RC_BLOCK_SHIFT];
+} AdaptiveModel;
+
+typedef struct {
+    unsigned char *data;
+    int pos;
+    uint64_t low;
+    uint32_t range;
+    unsigned char cache;   // 桁上がりが確定していない先頭バイト
+    int cache_size;        // cache と後続の 0xFF の個数
+} RangeEncoder;
+
+typedef struct {
+    const unsigned char *data;
+    int pos;
+    int size;
+    uint32_t code;
+    uint32_t range;
+} RangeDecoder;
+
+// --- 頻度モデル ---
+
+// 全記号を同じ頻度で初期化する
+static inline void model_init(AdaptiveModel *m, int num_symbols) {
+    m->num_symbols = num_symbols;
+    m->total = num_symbols;
+    memset(m->block, 0, sizeof(m->block));
+    for (int i = 0; i < num_symbols; i++) {
+        m->freq[i] = 1;
+        m->block[i >> RC_BLOCK_SHIFT]++;
+    }
+}
+
+static inline void model_update(AdaptiveModel *m, int symbol) {
+    m->freq[symbol] += RC_INCREMENT;
+    m->block[symbol >> RC_BLOCK_SHIFT] += RC_INCREMENT;
+    m->total += RC_INCREMENT;
+    if (m->total > RC_MAX_TOTAL) {
+        m->total = 0;
+        memset(m->block, 0, sizeof(m->block));
+        for (int i = 0; i < m->num_symbols; i++) {
+            m->freq[i] = (m->freq[i] + 1) >> 1;
+            m->block[i >> RC_BLOCK_SHIFT] += m->freq[i];
+            m->total += m->freq[i];
+        }
+    }
+}
+
+// symbol より前の記号の頻度の和
+static inline uint32_t model_cumulative(const AdaptiveModel *m, int symbol) {
+    uint32_t cum = 0;
+    int first = symbol & ~((1 << RC_BLOCK_SHIFT) - 1);
+    for (int b = 0; b < (symbol >> RC_BLOCK_SHIFT); b++) cum += m->block[b];
+    for (int i = first; i < symbol; i++) cum += m->freq[i];
+    return cum;
+}
+
+// --- 符号化 ---
+
+static inline void range_encoder_init(RangeEncoder *rc, unsigned char *data) {
+    rc->data = data;
+    rc->pos = 0;
+    rc->low = 0;
+    rc->range = 0xFFFFFFFFu;
+    rc->cache = 0;
+    rc->cache_size = 1;
+}
+
+// low の最上位バイトを出力する (桁上がりが確定するまで 0xFF の並びは保留する)
+static inline void range_encoder_shift_low(RangeEncoder *rc) {
+    if ((uint32_t)rc->low < 0xFF000000u || (rc->low >> 32) != 0) {
+        unsigned char carry = (unsigned char)(rc->low >> 32);
+        unsigned char temp = rc->cache;
+        do {
+            rc->data[rc->pos++] = (unsigned char)(temp + carry);
+            temp = 0xFF;
+        } while (--rc->cache_size != 0);
+        rc->cache = (unsigned char)(rc->low >> 24);
+    }
+    rc->cache_size++;
+    rc->low = (rc->low & 0x00FFFFFFu) << 8;
+}
+
+static inline void range_encoder_normalize(RangeEncoder *rc) {
+    while (rc->range < RC_TOP) {
+        rc->range <<= 8;
+        range_encoder_shift_low(rc);
+    }
+}
+
+// 記号をモデルの頻度で符号化し、モデルを更新する
+static inline void range_encode_symbol(RangeEncoder *rc, AdaptiveModel *m, int symbol) {
+    uint32_t cum = model_cumulative(m, symbol);
+    uint32_t r = rc->range / m->total;
+    rc->low += (uint64_t)r * cum;
+    rc->range = r * m->freq[symbol];
+    range_encoder_normalize(rc);
+    model_update(m, symbol);
+}
+
+// bits ビットの値を等確率で符号化する (bits <= RC_MAX_DIRECT_BITS)
+static inline void range_encode_bits(RangeEncoder *rc, uint32_t value, int bits) {
+    rc->range >>= bits;
+    rc->low += (uint64_t)rc->range * value;
+    range_encoder_normalize(rc);
+}
+
+// 残りを出力し、全体のバイト数を返す
+// 先頭の1byteは常に 0 なので出力から除く (復号側も読み飛ばさない)
+static inline int range_encoder_finish(RangeEncoder *rc) {
+    for (int i = 0; i < 5; i++) range_encoder_shift_low(rc);
+    memmove(rc->data, rc->data + 1, rc->pos - 1);
+    rc->pos--;
+    // 末尾の 0 は復号側が補うので送らない
+    while (rc->pos > 0 && rc->data[rc->pos - 1] == 0) rc->pos--;
+    return rc->pos;
+}
+
+// --- 復号 ---
+
+static inline unsigned char range_decoder_next_byte(RangeDecoder *rc) {
+    return (rc->pos < rc->size) ? rc->data[rc->pos++] : 0;
+}
+
+static inline void range_decoder_init(RangeDecoder *rc, const unsigned char *data, int size) {
+    rc->data = data;
+    rc->pos = 0;
+    rc->size = size;
+    rc->range = 0xFFFFFFFFu;
+    rc->code = 0;
+    for (int i = 0; i < 4; i++) rc->code = (rc->code << 8) | range_decoder_next_byte(rc);
+}
+
+static inline void range_decoder_normalize(RangeDecoder *rc) {
+    while (rc->range < RC_TOP) {
+        rc->range <<= 8;
+        rc->code = (rc->code << 8) | range_decoder_next_byte(rc);
+    }
+}
+
+// モデルの頻度で記号を復号し、モデルを更新する
+static inline int range_decode_symbol(RangeDecoder *rc, AdaptiveModel *m) {
+    uint32_t r = rc->range / m->total;
+    uint32_t target = rc->code / r;
+    if (target >= m->total) target = m->total - 1;
+
+    // 該当するブロックを探してから、その中の記号を探す
+    uint32_t cum = 0;
+    int b = 0;
+    while (cum + m->block[b] <= target) {
+        cum += m->block[b];
+        b++;
+    }
+    int symbol = b << RC_BLOCK_SHIFT;
+    while (cum + m->freq[symbol] <= target) {
+        cum += m->freq[symbol];
+        symbol++;
+    }
+
+    rc->code -= r * cum;
+    rc->range = r * m->freq[symbol];
+    range_decoder_normalize(rc);
+    model_update(m, symbol);
+    return symbol;
+}
+
+// 等確率で符号化された bits ビットの値を復号する
+static inline uint32_t range_decode_bits(RangeDecoder *rc, int bits) {
+    rc->range >>= bits;
+    uint32_t value = rc->code / rc->range;
+    if (value >> bits) value = (1u << bits) - 1;  // 壊れたデータでも範囲内に収める
+    rc->code -= value * rc->range;
+    range_decoder_normalize(rc);
+    return value;
+}
+
+#endif
@@ -0,0 +1,369 @@
+// RTP 形式のパケットで UDP 上に音声を送る (--udp)
+// TCP では1つのセグメントが失われると再送まで後続がすべて止まる (head-of-line blocking) ので、
+// UDP で1フレームを1パケットにして送り、失われたフレームは待たずに先へ進む
+//
+// パケットは RFC 3550 の固定ヘッダ (12byte、ネットワークバイトオーダ) + ペイロード
+//   シーケンス番号: 1パケットごとに1増える (欠落・順序の入れ替わりの検出用)
+//   タイムスタンプ: 先頭サンプルの番号 (送信側のサンプリングレート単位)
+//   ペイロードタイプ: 中身の種類 (RTP_PT_*)。コーデックのフレームは圧縮方法ごとに別の番号にする
+//
+// UDP には接続が無いので、サーバーは最初に届いたパケットの送信元を相手として connect し、
+// クライアントは接続時に中身の無い RTP_PT_HELLO のパケットを送って自分のアドレスを知らせる
+// 送信の終わりは RTP_PT_BYE のパケットで知らせる (失われても相手は待ち続けるだけなので数回送る)
+// phone / i1i2i3_phone / i3_phone_fft から使う (ヘッダのみ)
+
+#ifndef RTP_H
+#define RTP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "vad.h"
+#include "jitter_buffer.h"
+
+#define RTP_VERSION 2
+#define RTP_HEADER_BYTES 12
+#define RTP_MAX_PACKET 65536         // 受信バッファの大きさ (UDP の最大長)
+#define RTP_SOCKET_BUFFER (1 << 20)  // ソケットの受信バッファ (SO_RCVBUF)
+#define RTP_BYE_REPEAT 3             // 送信終了のパケットを送る回数
+#define RTP_AGAIN -2                 // rtp_recv: まだ何も届いていない
+
+// ペイロードタイプ (13 は RFC 3389 の快適雑音、96 以降は動的割り当ての範囲を固定で使う)
+#define RTP_PT_CN 13                 // 雑音記述子 (VAD_SID_BYTES byte、空なら直前の雑音を続ける)
+#define RTP_PT_PCM 96                // 16bit モノラル PCM (送信側のバイトオーダのまま)
+#define RTP_PT_PSYCHOACOUSTIC 97     // i3_phone_fft の心理音響圧縮のフレーム
+#define RTP_PT_PHONE_BAND 98         // i3_phone_fft の電話帯域圧縮のフレーム
+#define RTP_PT_MDCT 99               // i3_phone_fft の MDCT 圧縮のフレーム
+#define RTP_PT_FEC 100               // i3_phone_fft の前方誤り訂正のパリティ (fec.h、シーケンス番号はフレームと別)
+#define RTP_PT_BYE 126               // 送信終了 (受信側はこれを受けたら終わる)
+#define RTP_PT_HELLO 127             // クライアントの接続通知 (受信側は読み捨てる)
+
+typedef struct {
+    int payload_type;
+    int marker;          // 有音区間の先頭で 1 (RFC 3551)
+    uint16_t sequence;
+    uint32_t timestamp;
+    uint32_t ssrc;       // 送信元の識別子
+} RtpHeader;
+
+// 送信側の状態
+typedef struct {
+    uint16_t sequence;
+    uint32_t ssrc;
+} RtpSender;
+
+// 受信側の統計 (シーケンス番号から数える)
+typedef struct {
+    int started;
+    uint16_t expected;   // 次に来るはずのシーケンス番号
+    long received;       // 受け取ったパケット数
+    long lost;           // 届かなかったパケット数 (後から届いたものも一度は数える)
+    long late;           // 追い越された後に届いて捨てたパケット数
+} RtpReceiveStats;
+
+static inline void rtp_write_header(unsigned char *p, const RtpHeader *h) {
+    p[0] = RTP_VERSION << 6;
+    p[1] = (unsigned char)((h->marker ? 0x80 : 0) | (h->payload_type & 0x7F));
+    p[2] = (unsigned char)(h->sequence >> 8);
+    p[3] = (unsigned char)h->sequence;
+    p[4] = (unsigned char)(h->timestamp >> 24);
+    p[5] = (unsigned char)(h->timestamp >> 16);
+    p[6] = (unsigned char)(h->timestamp >> 8);
+    p[7] = (unsigned char)h->timestamp;
+    p[8] = (unsigned char)(h->ssrc >> 24);
+    p[9] = (unsigned char)(h->ssrc >> 16);
+    p[10] = (unsigned char)(h->ssrc >> 8);
+    p[11] = (unsigned char)h->ssrc;
+}
+
+// ヘッダを読み、ペイロードの先頭までのバイト数を返す (RTP でなければ -1)
+// CSRC と拡張ヘッダは読み飛ばす
+static inline int rtp_parse_header(const unsigned char *p, int len, RtpHeader *h) {
+    if (len < RTP_HEADER_BYTES || (p[0] >> 6) != RTP_VERSION) return -1;
+    int offset = RTP_HEADER_BYTES + (p[0] & 0x0F) * 4;
+    if ((p[0] & 0x10) && offset + 4 <= len) offset += 4 + ((p[offset + 2] << 8) | p[offset + 3]) * 4;
+    if (offset > len) return -1;
+    h->marker = p[1] >> 7;
+    h->payload_type = p[1] & 0x7F;
+    h->sequence = (uint16_t)((p[2] << 8) | p[3]);
+    h->timestamp = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+    h->ssrc = ((uint32_t)p[8] << 24) | ((uint32_t)p[9] << 16) | ((uint32_t)p[10] << 8) | p[11];
+    // パディング (末尾の1byteがその長さ)
+    if ((p[0] & 0x20) && len > offset) {
+        int pad = p[len - 1];
+        if (pad > len - offset) return -1;
+    }
+    return offset;
+}
+
+// ペイロードの長さ (パディングを除く)
+static inline int rtp_payload_length(const unsigned char *p, int len, int offset) {
+    return (p[0] & 0x20) ? len - offset - p[len - 1] : len - offset;
+}
+
+static inline void rtp_sender_init(RtpSender *s) {
+    s->sequence = (uint16_t)(getpid() * 7919u);
+    s->ssrc = (uint32_t)getpid() * 2654435761u ^ (uint32_t)time(NULL);
+}
+
+// ヘッダを付けて1パケット送る (packet の先頭 RTP_HEADER_BYTES byte はヘッダ用に空けておくこと)
+// 相手がまだ待ち受けていないときの ICMP による ECONNREFUSED はエラーにしない
+// 非ブロッキングのソケットで送信バッファが一杯 (EAGAIN) なら、そのパケットはネットワークで失われたものとする
+static inline int rtp_send(int sock_fd, RtpSender *s, unsigned char *packet, int payload_bytes,
+                           int payload_type, uint32_t timestamp, int marker) {
+    RtpHeader h = {payload_type, marker, s->sequence++, timestamp, s->ssrc};
+    rtp_write_header(packet, &h);
+    if (send(sock_fd, packet, RTP_HEADER_BYTES + payload_bytes, 0) < 0 &&
+        errno != ECONNREFUSED && errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+    return 0;
+}
+
+// DTX で送らずに終わった最後の無音フレームを、空の雑音記述子 (RTP_PT_CN) として送る
+// 受信側は送信終了の前に、そこまでの隙間を直前の雑音で埋める
+static inline int rtp_send_silence_end(int sock_fd, RtpSender *s, uint32_t timestamp) {
+    unsigned char packet[RTP_HEADER_BYTES];
+    return rtp_send(sock_fd, s, packet, 0, RTP_PT_CN, timestamp, 0);
+}
+
+// 送信終了を知らせる
+static inline void rtp_send_bye(int sock_fd, RtpSender *s, uint32_t timestamp) {
+    unsigned char packet[RTP_HEADER_BYTES];
+    for (int i = 0; i < RTP_BYE_REPEAT; i++) rtp_send(sock_fd, s, packet, 0, RTP_PT_BYE, timestamp, 0);
+}
+
+// 1パケット受け取り、長さを返す (ECONNREFUSED と EINTR は読み直す。ソケットのエラーなら -1、
+// 非ブロッキングのソケットにまだ何も届いていなければ RTP_AGAIN)
+static inline int rtp_recv(int sock_fd, unsigned char *packet, int size) {
+    while (1) {
+        ssize_t len = recv(sock_fd, packet, size, 0);
+        if (len >= 0) return (int)len;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return RTP_AGAIN;
+        if (errno != ECONNREFUSED && errno != EINTR) return -1;
+    }
+}
+
+// 受け取ったパケットのシーケンス番号を調べ、再生に使うなら 1、遅れて届いたので捨てるなら 0 を返す
+static inline int rtp_receive_update(RtpReceiveStats *st, uint16_t sequence) {
+    if (!st->started) {
+        st->started = 1;
+        st->expected = sequence;
+    }
+    int16_t ahead = (int16_t)(sequence - st->expected);
+    if (ahead < 0) {
+        st->late++;
+        return 0;
+    }
+    st->lost += ahead;
+    st->received++;
+    st->expected = (uint16_t)(sequence + 1);
+    return 1;
+}
+
+// --- ソケット ---
+
+// 受信バッファを広げた UDP ソケットを作る (受信側の書き出しが一時的に遅れても取りこぼさないように)
+static inline int rtp_socket(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+    int size = RTP_SOCKET_BUFFER;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    return fd;
+}
+
+// port で待ち、最初に届いたパケットの送信元を相手として connect したソケットを返す
+// (届いたパケットは読まずに残すので、受信側がそのまま読む)
+static inline int rtp_udp_server(int port) {
+    int fd = rtp_socket();
+    if (fd < 0) return -1;
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    fprintf(stderr, "Server waiting for UDP packets on port %d...\n", port);
+
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    unsigned char probe;
+    if (recvfrom(fd, &probe, 1, MSG_PEEK, (struct sockaddr *)&peer, &len) < 0 ||
+        connect(fd, (struct sockaddr *)&peer, len) < 0) {
+        close(fd);
+        return -1;
+    }
+    fprintf(stderr, "Client %s:%d sent the first packet\n", inet_ntoa(peer.sin_addr), ntohs(peer.sin_port));
+    return fd;
+}
+
+// ip_str:port へ connect したソケットを作り、接続通知のパケットを送る
+static inline int rtp_udp_client(const char *ip_str, int port) {
+    int fd = rtp_socket();
+    if (fd < 0) return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_aton(ip_str, &addr.sin_addr) == 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    unsigned char hello[RTP_HEADER_BYTES];
+    RtpSender s;
+    rtp_sender_init(&s);
+    rtp_send(fd, &s, hello, 0, RTP_PT_HELLO, 0, 0);
+    fprintf(stderr, "Sending UDP packets to %s:%d\n", ip_str, port);
+    return fd;
+}
+
+// --- 生PCMの送受信 (phone / i1i2i3_phone の --udp) ---
+// DTX_FRAME_SAMPLES サンプルを1パケット (RTP_PT_PCM) にする
+// dtx が 1 なら無音のフレームは雑音記述子 (RTP_PT_CN) にし、受信側は1パケットにつき1フレームの快適雑音を書き出す
+// 記述子を送り直さない無音のフレームは送らない。受信側はタイムスタンプの隙間を直前の雑音で埋める
+#define RTP_PCM_MAX_GAP (2 * VAD_SID_INTERVAL)   // ジッタバッファを使わないとき、雑音で埋める隙間の最大 (フレーム)
+#define RTP_PCM_RECEIVE_SAMPLES ((RTP_PCM_MAX_GAP + 1) * DTX_FRAME_SAMPLES)  // 1パケットで書き出す最大
+
+typedef struct {
+    VadState vad;
+    RtpSender sender;
+    int dtx;
+    uint32_t timestamp;
+    int was_silent;      // 直前のフレームは無音か (有音区間の先頭にマーカーを付ける)
+    int skipped;         // 直前のフレームは送らなかったか
+} RtpPcmSender;
+
+typedef struct {
+    ComfortNoise cn;
+    RtpReceiveStats stats;
+    JitterBuffer *jb;    // NULL なら届いた順に書き出す
+    int last_silent;     // 直前に書き出したのは無音フレームか
+    int have_timestamp;  // ジッタバッファを使わないとき、パケットを受け取ったか
+    uint32_t next_timestamp;  // その次に来るはずのパケットのタイムスタンプ
+} RtpPcmReceiver;
+
+static inline void rtp_pcm_sender_init(RtpPcmSender *s, int dtx) {
+    vad_init(&s->vad);
+    rtp_sender_init(&s->sender);
+    s->dtx = dtx;
+    s->timestamp = 0;
+    s->was_silent = 1;
+    s->skipped = 0;
+}
+
+// 1フレームを1パケットで送る (無音なら silent を 1 にする。雑音を続けるだけなら送らない)
+static inline int rtp_pcm_send_frame(int sock_fd, RtpPcmSender *s, const short *pcm, int *silent) {
+    unsigned char packet[RTP_HEADER_BYTES + DTX_FRAME_SAMPLES * sizeof(short)];
+    VadDecision d = s->dtx ? vad_process(&s->vad, pcm, DTX_FRAME_SAMPLES, packet + RTP_HEADER_BYTES) : VAD_SPEECH;
+    int sent = 0;
+    if (d == VAD_SPEECH) {
+        memcpy(packet + RTP_HEADER_BYTES, pcm, DTX_FRAME_SAMPLES * sizeof(short));
+        sent = rtp_send(sock_fd, &s->sender, packet, DTX_FRAME_SAMPLES * sizeof(short), RTP_PT_PCM,
+                        s->timestamp, s->was_silent);
+    } else if (d == VAD_SID) {
+        sent = rtp_send(sock_fd, &s->sender, packet, VAD_SID_BYTES, RTP_PT_CN, s->timestamp, 0);
+    }
+    *silent = (d != VAD_SPEECH);
+    s->was_silent = *silent;
+    s->skipped = (d == VAD_CONTINUE);
+    s->timestamp += DTX_FRAME_SAMPLES;
+    return sent;
+}
+
+// 送信終了を知らせる (最後のフレームを送っていなければ先に送る)
+static inline void rtp_pcm_send_bye(int sock_fd, RtpPcmSender *s) {
+    if (s->skipped) rtp_send_silence_end(sock_fd, &s->sender, s->timestamp - DTX_FRAME_SAMPLES);
+    rtp_send_bye(sock_fd, &s->sender, s->timestamp);
+}
+
+// jb があれば受信したパケットをジッタバッファで並べ直して再生の時刻に書き出す
+static inline void rtp_pcm_receiver_init(RtpPcmReceiver *r, JitterBuffer *jb) {
+    cng_init(&r->cn);
+    memset(&r->stats, 0, sizeof(r->stats));
+    r->jb = jb;
+    r->last_silent = 0;
+    r->have_timestamp = 0;
+}
+
+// 受信した1パケットを処理し、すぐ書き出す PCM があれば pcm に入れてその byte 数を返す
+// (0 = 書き出すものは無い、-1 = 相手の送信終了。ジッタバッファがあれば jb_end して rtp_pcm_playout に任せる)
+// ジッタバッファが無ければ、追い越されて遅れて届いたパケットは捨てる。無音区間の後でタイムスタンプが飛んでいれば、
+// その分の快適雑音 (RTP_PCM_MAX_GAP フレームまで) をパケットのフレームの前に入れる
+// pcm は RTP_PCM_RECEIVE_SAMPLES サンプル
+static inline int rtp_pcm_receive_packet(RtpPcmReceiver *r, const unsigned char *packet, int len, short *pcm) {
+    RtpHeader h;
+    int offset = rtp_parse_header(packet, len, &h);
+    if (offset < 0 || h.payload_type == RTP_PT_HELLO) return 0;
+    if (h.payload_type == RTP_PT_BYE) {
+        if (r->jb) jb_end(r->jb);
+        return -1;
+    }
+    int in_order = rtp_receive_update(&r->stats, h.sequence);
+    int payload = rtp_payload_length(packet, len, offset);
+    const int frame_bytes = DTX_FRAME_SAMPLES * sizeof(short);
+    if (r->jb) {
+        // 順序はジッタバッファがタイムスタンプで並べ直す
+        if ((h.payload_type == RTP_PT_PCM && payload <= frame_bytes) || h.payload_type == RTP_PT_CN) {
+            jb_put(r->jb, h.timestamp, h.payload_type == RTP_PT_CN, packet + offset, payload);
+        }
+        return 0;
+    }
+    if (!in_order || (h.payload_type != RTP_PT_PCM && h.payload_type != RTP_PT_CN)) return 0;
+
+    // 送られなかった無音のフレームの分だけ雑音を続ける
+    int32_t gap = r->have_timestamp ? (int32_t)(h.timestamp - r->next_timestamp) / DTX_FRAME_SAMPLES : 0;
+    int filled = 0;
+    if (r->last_silent) {
+        for (; filled < gap && filled < RTP_PCM_MAX_GAP; filled++) {
+            cng_generate(&r->cn, pcm + filled * DTX_FRAME_SAMPLES, DTX_FRAME_SAMPLES);
+        }
+    }
+    r->have_timestamp = 1;
+    r->next_timestamp = h.timestamp + DTX_FRAME_SAMPLES;
+    pcm += filled * DTX_FRAME_SAMPLES;
+
+    r->last_silent = (h.payload_type == RTP_PT_CN);
+    if (h.payload_type == RTP_PT_PCM) {
+        int bytes = (payload < frame_bytes ? payload : frame_bytes) & ~1;
+        memcpy(pcm, packet + offset, bytes);
+        return filled * frame_bytes + bytes;
+    }
+    cng_update(&r->cn, packet + offset, payload);
+    cng_generate(&r->cn, pcm, DTX_FRAME_SAMPLES);
+    return (filled + 1) * frame_bytes;
+}
+
+// ジッタバッファから再生の時刻になった1フレームを pcm に取り出してその byte 数を返す
+// (0 = まだ再生の時刻ではない、-1 = 送信側が終わり、溜めた分もすべて書き出した)
+// 抜けたフレームは、無音区間なら快適雑音、有音区間なら0で埋める
+static inline int rtp_pcm_playout(RtpPcmReceiver *r, short *pcm) {
+    int silent, size;
+    unsigned char *data;
+    JitterResult res = jb_get(r->jb, &silent, &data, &size);
+    if (res == JB_END) return -1;
+    if (res == JB_WAIT) return 0;
+    if (res == JB_FRAME && !silent) {
+        memcpy(pcm, data, size & ~1);
+        r->last_silent = 0;
+        return size & ~1;
+    }
+    if (res == JB_FRAME) {
+        cng_update(&r->cn, data, size);
+        r->last_silent = 1;
+    }
+    if (r->last_silent) cng_generate(&r->cn, pcm, DTX_FRAME_SAMPLES);
+    else memset(pcm, 0, DTX_FRAME_SAMPLES * sizeof(short));
+    return DTX_FRAME_SAMPLES * sizeof(short);
+}
+
+#endif
@@ -0,0 +1,245 @@
+// 音声区間検出 (VAD) と不連続送信 (DTX)・快適雑音生成 (CNG)
+// 送信側はフレームごとにエネルギーとスペクトル平坦度から有音・無音を判定し、無音区間ではフレームの代わりに
+// 小さな雑音記述子 (SID) を低い頻度で送る。受信側は記述子から同じ大きさ・同じ概形の快適雑音を合成する
+//
+// スペクトル平坦度は線形予測 (LPC) の予測誤差の比 (スペクトルの幾何平均/算術平均に相当) で求めるので FFT は要らない
+// 雑音記述子はフレームのパワー (1byte) と LPC の反射係数 (int8 x VAD_ORDER) で、
+// 受信側は白色雑音を反射係数の格子型全極フィルタに通して雑音を作る (|k| < 1 なので常に安定)
+//
+// i3_phone_fft (コーデックのフレーム) と生PCMを送る phone / i1i2i3_phone (dtx_encode_frame / dtx_decode_packet) から使う
+// PCM は 16bit モノラルとする
+
+#ifndef VAD_H
+#define VAD_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#define VAD_ORDER 8                     // LPC の次数 (記述子の反射係数の数)
+#define VAD_SID_BYTES (1 + VAD_ORDER)   // 雑音記述子のバイト数
+#define VAD_SID_INTERVAL 8              // 無音が続くとき記述子を送り直す間隔 (フレーム)
+#define VAD_HANGOVER 5                  // 有音の後、無音と判定してもこのフレーム数は有音として送る (語尾の欠け防止)
+
+#define VAD_SPEECH_MARGIN_DB 9.0f       // 背景雑音よりこれだけ大きいフレームは有音
+#define VAD_TONAL_MARGIN_DB 4.0f        // 予測しやすい (平坦でない) フレームはこれだけ大きければ有音
+#define VAD_TONAL_FLATNESS_DB -10.0f    // 平坦度 (dB) がこれ以下なら音声らしい
+#define VAD_MIN_SPEECH_DB 30.0f         // 平均パワーがこれより小さいフレームは常に無音 (RMS 約32)
+#define VAD_INIT_NOISE_DB 40.0f         // 背景雑音の推定の初期値
+#define VAD_NOISE_RISE_DB 0.05f         // 背景雑音の推定が1フレームで上がる上限 (下がるのは即座)
+#define VAD_SID_CHANGE_DB 3.0f          // 雑音のパワーがこれだけ変われば記述子を送り直す
+#define VAD_ENERGY_STEP_DB 0.5f         // 記述子のパワーの量子化幅
+
+// 1フレームの判定結果
+typedef enum {
+    VAD_SPEECH,     // 有音: 通常のフレームを送る
+    VAD_SID,        // 無音: 雑音記述子を送る
+    VAD_CONTINUE    // 無音: 記述子は送らない (受信側は直前の記述子で雑音を続ける)
+} VadDecision;
+
+typedef struct {
+    float noise_db;            // 背景雑音のパワーの推定 (dB)
+    int hangover;              // 有音として送る残りフレーム数
+    int in_silence;            // 無音区間中か (記述子を送った後)
+    int frames_since_sid;      // 最後に記述子を送ってからのフレーム数
+    float sid_db;              // 最後に送った記述子のパワー (dB)
+} VadState;
+
+typedef struct {
+    float k[VAD_ORDER];        // 反射係数
+    float state[VAD_ORDER];    // 格子型フィルタの遅延 (後ろ向き予測誤差)
+    float gain;                // 励振の現在のゲイン (フレーム内で target_gain へ近づける)
+    float target_gain;
+    uint32_t seed;             // 雑音の乱数の状態
+} ComfortNoise;
+
+// --- 分析 ---
+
+// 自己相関から Levinson-Durbin 法で反射係数を求め、予測誤差のパワーの比 (<= 1) を返す
+static inline float vad_lpc(const short *pcm, int n, float *k) {
+    double r[VAD_ORDER + 1];
+    for (int lag = 0; lag <= VAD_ORDER; lag++) {
+        double sum = 0.0;
+        for (int i = lag; i < n; i++) sum += (double)pcm[i] * pcm[i - lag];
+        r[lag] = sum;
+    }
+    memset(k, 0, VAD_ORDER * sizeof(float));
+    if (r[0] <= 0.0) return 1.0f;
+    r[0] *= 1.0001;  // 白色雑音を少し足して悪条件を避ける (-40dB)
+
+    double a[VAD_ORDER + 1] = {1.0}, prev[VAD_ORDER + 1];
+    double err = r[0];
+    for (int m = 1; m <= VAD_ORDER; m++) {
+        double acc = r[m];
+        for (int i = 1; i < m; i++) acc += a[i] * r[m - i];
+        double km = -acc / err;
+        memcpy(prev, a, sizeof(a));
+        for (int i = 1; i < m; i++) a[i] = prev[i] + km * prev[m - i];
+        a[m] = km;
+        err *= 1.0 - km * km;
+        k[m - 1] = (float)km;
+    }
+    return (float)(err / r[0]);
+}
+
+static inline void vad_init(VadState *vad) {
+    vad->noise_db = VAD_INIT_NOISE_DB;
+    vad->hangover = 0;
+    vad->in_silence = 0;
+    vad->frames_since_sid = 0;
+    vad->sid_db = 0.0f;
+}
+
+// 1フレームを判定する。VAD_SID のときは sid に VAD_SID_BYTES byte の雑音記述子を書く
+static inline VadDecision vad_process(VadState *vad, const short *pcm, int n, unsigned char *sid) {
+    float k[VAD_ORDER];
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) sum += (double)pcm[i] * pcm[i];
+    float energy_db = 10.0f * log10f((float)(sum / n) + 1e-3f);
+    float flatness_db = 10.0f * log10f(vad_lpc(pcm, n, k));
+
+    // 有音の判定 (背景雑音より十分大きい、または少し大きくて予測しやすい)
+    int speech = energy_db > VAD_MIN_SPEECH_DB &&
+                 (energy_db > vad->noise_db + VAD_SPEECH_MARGIN_DB ||
+                  (energy_db > vad->noise_db + VAD_TONAL_MARGIN_DB && flatness_db < VAD_TONAL_FLATNESS_DB));
+
+    // 背景雑音の推定は小さいフレームへ即座に下げ、大きいフレームへはゆっくり上げる (最小値追跡)
+    if (energy_db < vad->noise_db) vad->noise_db = energy_db;
+    else vad->noise_db += fminf(energy_db - vad->noise_db, VAD_NOISE_RISE_DB);
+
+    if (speech) vad->hangover = VAD_HANGOVER;
+    if (speech || vad->hangover > 0) {
+        if (!speech) vad->hangover--;
+        vad->in_silence = 0;
+        return VAD_SPEECH;
+    }
+
+    // 無音: 区間の始め、一定間隔ごと、雑音の大きさが変わったときに記述子を送る
+    vad->frames_since_sid++;
+    if (vad->in_silence && vad->frames_since_sid < VAD_SID_INTERVAL &&
+        fabsf(energy_db - vad->sid_db) < VAD_SID_CHANGE_DB) {
+        return VAD_CONTINUE;
+    }
+    int level = (int)lrintf(fmaxf(energy_db, 0.0f) / VAD_ENERGY_STEP_DB);
+    sid[0] = (unsigned char)(level < 255 ? level : 255);
+    for (int i = 0; i < VAD_ORDER; i++) {
+        int q = (int)lrintf(k[i] * 127.0f);
+        sid[1 + i] = (unsigned char)(signed char)(q > 126 ? 126 : (q < -126 ? -126 : q));
+    }
+    vad->in_silence = 1;
+    vad->frames_since_sid = 0;
+    vad->sid_db = energy_db;
+    return VAD_SID;
+}
+
+// --- 快適雑音の合成 ---
+
+static inline void cng_init(ComfortNoise *cn) {
+    memset(cn, 0, sizeof(*cn));
+    cn->seed = 12345;
+}
+
+// 雑音記述子を受け取る (長さが足りなければ無視する)
+static inline void cng_update(ComfortNoise *cn, const unsigned char *sid, int len) {
+    if (len < VAD_SID_BYTES) return;
+    float power = powf(10.0f, sid[0] * VAD_ENERGY_STEP_DB / 10.0f);
+    // 全極フィルタのパワー利得は 1/Π(1-k^2) なので、励振のパワーはその分小さくする
+    for (int i = 0; i < VAD_ORDER; i++) {
+        cn->k[i] = (signed char)sid[1 + i] / 127.0f;
+        power *= 1.0f - cn->k[i] * cn->k[i];
+    }
+    cn->target_gain = sqrtf(power);
+}
+
+// n サンプルの快適雑音を作る
+static inline void cng_generate(ComfortNoise *cn, short *out, int n) {
+    const float step = (cn->target_gain - cn->gain) / n;
+    for (int i = 0; i < n; i++) {
+        // 分散 1 の一様乱数 ([-√3, √3))
+        cn->seed = cn->seed * 1103515245u + 12345u;
+        float e = ((float)(cn->seed >> 8) / 16777216.0f * 2.0f - 1.0f) * 1.7320508f;
+        cn->gain += step;
+
+        // 格子型の全極フィルタ (state[m] は m 段目の1サンプル前の後ろ向き予測誤差)
+        float f = e * cn->gain;
+        for (int m = VAD_ORDER - 1; m >= 0; m--) {
+            f -= cn->k[m] * cn->state[m];
+            if (m + 1 < VAD_ORDER) cn->state[m + 1] = cn->state[m] + cn->k[m] * f;
+        }
+        cn->state[0] = f;
+        out[i] = (short)fmaxf(fminf(f, 32767.0f), -32768.0f);
+    }
+    cn->gain = cn->target_gain;
+}
+
+// --- 生PCMの不連続送信 (phone / i1i2i3_phone の --dtx) ---
+// DTX_FRAME_SAMPLES サンプルごとに、先頭1byteの種類に続けて
+//   DTX_PACKET_SPEECH:   PCM (DTX_FRAME_SAMPLES * 2 byte)
+//   DTX_PACKET_SID:      雑音記述子 (VAD_SID_BYTES byte)
+//   DTX_PACKET_CONTINUE: なし
+// を送る。受信側は無音のパケット1つにつき1フレーム分の快適雑音を書き出す
+
+#define DTX_FRAME_SAMPLES 512
+#define DTX_PACKET_SPEECH 0
+#define DTX_PACKET_SID 1
+#define DTX_PACKET_CONTINUE 2
+
+// n byte を読み切る (途中で終わったら -1)
+static inline int dtx_read_full(int fd, void *buf, int n) {
+    int done = 0;
+    while (done < n) {
+        ssize_t r = read(fd, (char *)buf + done, n - done);
+        if (r <= 0) return -1;
+        done += (int)r;
+    }
+    return 0;
+}
+
+static inline int dtx_write_full(int fd, const void *buf, int n) {
+    int done = 0;
+    while (done < n) {
+        ssize_t w = write(fd, (const char *)buf + done, n - done);
+        if (w <= 0) return -1;
+        done += (int)w;
+    }
+    return 0;
+}
+
+// 1フレームを判定してパケットにし、その長さを返す (無音なら silent を 1 にする)
+static inline int dtx_encode_frame(VadState *vad, const short *pcm, unsigned char *packet, int *silent) {
+    VadDecision d = vad_process(vad, pcm, DTX_FRAME_SAMPLES, packet + 1);
+    *silent = (d != VAD_SPEECH);
+    if (d == VAD_SPEECH) {
+        packet[0] = DTX_PACKET_SPEECH;
+        memcpy(packet + 1, pcm, DTX_FRAME_SAMPLES * sizeof(short));
+        return 1 + DTX_FRAME_SAMPLES * sizeof(short);
+    }
+    if (d == VAD_SID) {
+        packet[0] = DTX_PACKET_SID;
+        return 1 + VAD_SID_BYTES;
+    }
+    packet[0] = DTX_PACKET_CONTINUE;
+    return 1;
+}
+
+// 受信した len byte の先頭のパケットを1つ解いて pcm に1フレーム書く
+// 使った byte 数を返す (パケットがまだ全部届いていなければ 0、壊れたストリームなら -1)
+static inline int dtx_decode_packet(ComfortNoise *cn, const unsigned char *buf, int len, short *pcm) {
+    if (len < 1) return 0;
+    int type = buf[0];
+    int size = (type == DTX_PACKET_SPEECH) ? 1 + DTX_FRAME_SAMPLES * (int)sizeof(short)
+             : (type == DTX_PACKET_SID) ? 1 + VAD_SID_BYTES
+             : (type == DTX_PACKET_CONTINUE) ? 1 : -1;
+    if (size < 0) return -1;
+    if (len < size) return 0;
+    if (type == DTX_PACKET_SPEECH) {
+        memcpy(pcm, buf + 1, DTX_FRAME_SAMPLES * sizeof(short));
+    } else {
+        if (type == DTX_PACKET_SID) cng_update(cn, buf + 1, VAD_SID_BYTES);
+        cng_generate(cn, pcm, DTX_FRAME_SAMPLES);
+    }
+    return size;
+}
+
+#endif
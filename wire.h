@@ -0,0 +1,218 @@
+// TCP のストリームの形式 (i3_phone_fft)
+// 以前は長さの欄 (ホストのバイトオーダの int) とペイロードを別々に write していた。
+// フレームの区切りや圧縮方法が両端の設定の一致に頼っていて、ずれると気付かずに読み続けてしまっていた
+//
+// 接続直後にクライアントが使いたいコーデックの設定を HELLO で申し出て、サーバーは使う設定を HELLO で返す
+//   HELLO (WIRE_HELLO_BYTES byte 固定):
+//     "I3" [版 (1)] [コーデック (1)] [フラグ (1)] [フレームサイズ (4)] [サンプリングレート (4)]
+//     [帯域数 (1)] [帯域の分け方 (1)] [MDCT の窓 (1)] [BFP の仮数のビット数 (1)]
+//     [電話帯域の下限 Hz (2)] [電話帯域の上限 Hz (2)]
+//   ペイロードの形式を変える設定はすべて HELLO に載せる (片側だけ違うと復号できても中身が壊れるため)
+//   サーバーは申し出どおりにできればそのまま返し、できなければ自分の設定を返す。どちらも返された設定を使う
+//   版が違えば互いに相手の版を表示して終わる (版までの3byteは版によらず同じ。版が違えば残りは読まない)
+// 以降は1フレームごとに
+//   [ペイロードの長さ (varint)] [コーデック (1)] [シーケンス番号 (2)] [ペイロード]
+//   varint は下位から7bitずつ、続きがあれば最上位ビットを立てる (LEB128)。長さ 127 までなら見出しは 4byte
+//   シーケンス番号は 1フレームごとに1増える (ストリームのずれの検出用)
+// 数値はすべてネットワークバイトオーダ。コーデックの番号は RTP のペイロードタイプと同じ (無音フレームは RTP_PT_CN)
+//
+// 送信は見出しとペイロードを writev で1回にまとめ、受信は大きく read して溜めた中から1フレームずつ取り出す
+// (read の区切りがフレームの区切りと合わなくてもよい。どちらも非ブロッキングの記述子で使える)
+// i3_phone_fft から使う (ヘッダのみ)
+
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "vad.h"
+
+#define WIRE_VERSION 3
+#define WIRE_HELLO_BYTES 21
+#define WIRE_HELLO_PREFIX 3          // "I3" と版
+#define WIRE_HEADER_MAX 8            // 見出しの最大 (varint 5byte + コーデック + シーケンス番号)
+#define WIRE_READ_BYTES 65536        // 受信で一度に読む最大
+#define WIRE_FLAG_ENTROPY 0x01       // 適応レンジ符号 (-e)
+#define WIRE_FLAG_MASKING 0x02       // フレームごとのマスキングモデル (--masking)
+
+typedef struct {
+    int version;
+    int codec;           // RTP のペイロードタイプ
+    int flags;           // WIRE_FLAG_*
+    int frame_size;
+    int sample_rate;
+    int num_bands;       // 0 なら分け方に合わせて自動
+    int band_layout;
+    int mdct_window;
+    int bfp_bits;
+    int phone_low_hz;
+    int phone_high_hz;
+} WireHello;
+
+typedef struct {
+    int codec;
+    uint16_t sequence;
+    int size;
+    unsigned char *payload;  // 次に wire_reader_fill を呼ぶまで有効 (後ろに padding byte の読み出せる余白がある)
+} WireFrame;
+
+// 受信側の溜め置き
+typedef struct {
+    unsigned char *buf;
+    int capacity;        // buf の大きさ (余白を除く)
+    int max_payload;
+    int start, end;      // まだ取り出していない範囲
+} WireReader;
+
+static inline void wire_put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static inline uint32_t wire_get_u32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline int wire_put_varint(unsigned char *p, uint32_t v) {
+    int n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+// ペイロードが size byte のフレームの見出しの長さ
+static inline int wire_header_bytes(int size) {
+    int n = 1;
+    while (size >= 0x80) {
+        size >>= 7;
+        n++;
+    }
+    return n + 3;
+}
+
+// 読んだバイト数を返す (まだ足りなければ 0、5byte を超えれば -1)
+static inline int wire_get_varint(const unsigned char *p, int len, uint32_t *v) {
+    uint32_t value = 0;
+    for (int i = 0; i < len && i < 5; i++) {
+        value |= (uint32_t)(p[i] & 0x7f) << (7 * i);
+        if (!(p[i] & 0x80)) {
+            *v = value;
+            return i + 1;
+        }
+    }
+    return (len >= 5) ? -1 : 0;
+}
+
+// --- 接続時の HELLO ---
+
+static inline int wire_send_hello(int fd, const WireHello *h) {
+    unsigned char p[WIRE_HELLO_BYTES] = {'I', '3'};
+    p[2] = (unsigned char)h->version;
+    p[3] = (unsigned char)h->codec;
+    p[4] = (unsigned char)h->flags;
+    wire_put_u32(p + 5, (uint32_t)h->frame_size);
+    wire_put_u32(p + 9, (uint32_t)h->sample_rate);
+    p[13] = (unsigned char)h->num_bands;
+    p[14] = (unsigned char)h->band_layout;
+    p[15] = (unsigned char)h->mdct_window;
+    p[16] = (unsigned char)h->bfp_bits;
+    p[17] = (unsigned char)(h->phone_low_hz >> 8);
+    p[18] = (unsigned char)h->phone_low_hz;
+    p[19] = (unsigned char)(h->phone_high_hz >> 8);
+    p[20] = (unsigned char)h->phone_high_hz;
+    return dtx_write_full(fd, p, sizeof(p));
+}
+
+// 相手の HELLO を読む (相手が閉じたか、このプログラムの相手でなければ -1)
+// 版が WIRE_VERSION と違えば version だけを返す
+static inline int wire_recv_hello(int fd, WireHello *h) {
+    unsigned char p[WIRE_HELLO_BYTES];
+    memset(h, 0, sizeof(*h));
+    if (dtx_read_full(fd, p, WIRE_HELLO_PREFIX) < 0 || p[0] != 'I' || p[1] != '3') return -1;
+    h->version = p[2];
+    if (h->version != WIRE_VERSION) return 0;
+    if (dtx_read_full(fd, p + WIRE_HELLO_PREFIX, WIRE_HELLO_BYTES - WIRE_HELLO_PREFIX) < 0) return -1;
+    h->codec = p[3];
+    h->flags = p[4];
+    h->frame_size = (int)wire_get_u32(p + 5);
+    h->sample_rate = (int)wire_get_u32(p + 9);
+    h->num_bands = p[13];
+    h->band_layout = p[14];
+    h->mdct_window = p[15];
+    h->bfp_bits = p[16];
+    h->phone_low_hz = (p[17] << 8) | p[18];
+    h->phone_high_hz = (p[19] << 8) | p[20];
+    return 0;
+}
+
+// --- フレーム ---
+
+// フレームの見出しを header に書いて長さを返す (ペイロードと合わせて writev で送る)
+static inline int wire_put_header(unsigned char *header, int codec, uint16_t sequence, int size) {
+    int n = wire_put_varint(header, (uint32_t)size);
+    header[n++] = (unsigned char)codec;
+    header[n++] = (unsigned char)(sequence >> 8);
+    header[n++] = (unsigned char)sequence;
+    return n;
+}
+
+// padding はペイロードの後ろに要る読み出せる余白 (BITSTREAM_PADDING)
+static inline int wire_reader_init(WireReader *r, int max_payload, int padding) {
+    memset(r, 0, sizeof(*r));
+    r->max_payload = max_payload;
+    r->capacity = WIRE_READ_BYTES + WIRE_HEADER_MAX + max_payload;
+    r->buf = (unsigned char *)calloc(r->capacity + padding, 1);
+    return r->buf ? 0 : -1;
+}
+
+static inline void wire_reader_free(WireReader *r) {
+    free(r->buf);
+    r->buf = NULL;
+}
+
+// 溜めた中の先頭のフレームを取り出す (1 = 取り出した、0 = まだ全部届いていない、-1 = 形式が壊れている)
+static inline int wire_parse_frame(WireReader *r, WireFrame *f) {
+    const unsigned char *p = r->buf + r->start;
+    int len = r->end - r->start;
+    uint32_t size;
+    int n = wire_get_varint(p, len, &size);
+    if (n < 0 || (n > 0 && size > (uint32_t)r->max_payload)) return -1;
+    if (n == 0 || len < n + 3 + (int)size) return 0;
+    f->codec = p[n];
+    f->sequence = (uint16_t)((p[n + 1] << 8) | p[n + 2]);
+    f->size = (int)size;
+    f->payload = r->buf + r->start + n + 3;
+    r->start += n + 3 + (int)size;
+    return 1;
+}
+
+// 読めるだけ読んで溜める (読んだ byte 数、0 = 相手が閉じた、-1 = エラー。非ブロッキングでまだ無いか、
+// 取り出していないフレームで一杯なら -2)
+// 溜めた中のフレームは wire_parse_frame で取り出す (前に取り出したペイロードはここで無効になる)
+static inline int wire_reader_fill(WireReader *r, int fd) {
+    if (r->start > 0) {
+        // 途中のフレームを先頭に寄せる
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+    if (r->end == r->capacity) return -2;
+    while (1) {
+        ssize_t got = read(fd, r->buf + r->end, r->capacity - r->end);
+        if (got > 0) r->end += (int)got;
+        if (got >= 0) return (int)got;
+        if (errno == EINTR) continue;
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? -2 : -1;
+    }
+}
+
+#endif